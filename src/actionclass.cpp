@@ -1,3 +1,6 @@
+//Winsock has to be included before anything that includes windows.h.
+#include "workersocket.h"
+#include "sharedframes.h"
 #include "actionclass.h"
 #include <SDL.h>
 #include "io.h"
@@ -5,11 +8,19 @@
 #include <thread>
 #include <qcolor.h>
 #include <cstdio>
+#include <cmath>
 #include <ctime>
 #include "window.h"
 #include "rawrgbeds.h"
-#include "groundtruth.h"
+#include "groundtruthkernel.h"
 #include "qprocess.h"
+#include <qdir.h>
+#include <qfile.h>
+#include <qlabel.h>
+#include <qcoreapplication.h>
+#include <sstream>
+#include "objectbounds.h"
+#include "trace.h"
 
 //Disable CHECK_CAMERA warning with empty arguments.
 #pragma warning (disable: 4003)
@@ -27,8 +38,32 @@
                           }
 
 
+//Auto cropping looks for the object in a preview of the first colour decoded at 1/kAutoCropShrink of the
+//resolution, counting pixels that differ from the backdrop by more than kAutoCropThreshold of full scale,
+//and keeps kAutoCropMargin preview pixels around it.
+static const int kAutoCropShrink = 8;
+static const double kAutoCropThreshold = 0.05;
+static const int kAutoCropMargin = 4;
+
+//The ground truth worker listens on this socket in the temporary folder.
+static const char* kWorkerSocketName = "groundtruth.sock";
+
+//How long to wait for a newly started worker to accept jobs.
+static const int kWorkerStartMilliseconds = 10000;
+
+//The largest side of the ground truth preview window, and how often to look for the preview when
+//GroundTruth runs without the worker.
+static const int kPreviewSize = 800;
+static const int kPreviewPollMilliseconds = 250;
+
 ActionClass* ActionClass::sActionClass = nullptr;
 
+/** Returns the path of the socket of the ground truth worker. */
+static std::string WorkerSocketPath()
+{
+	return std::string(QDir::tempPath().toUtf8()) + "/" + kWorkerSocketName;
+}
+
 bool ActionClass::initialise()
 {
 	//Initialise camera system
@@ -75,6 +110,14 @@ ActionClass* ActionClass::create()
 
 ActionClass::~ActionClass()
 {
+	if (mStartedWorker)
+	{
+		WorkerSocket worker;
+		std::string reply;
+		if (worker.connect(WorkerSocketPath()) && worker.writeLine("quit"))
+			worker.readLine(reply);
+	}
+
     sActionClass = nullptr;
 }
 
@@ -126,12 +169,13 @@ void ActionClass::whiteBalance(const std::string& text)
 
 bool ActionClass::shootSequence(std::chrono::time_point<std::chrono::system_clock> startTime,
 	const QStringList& colours, bool saveProcessed, bool saveRaw, bool saveGroundTruth,
-	const std::string& processedExtension, const std::string& path)
+	const std::string& processedExtension, const std::string& path, const QRectF& region, bool autoCrop)
 {
 	bool success = true;
 
     Inform("Shooting sequence");
     CHECK_CAMERA(false);
+	TraceSpan span("shootSequence");
 
     //Initialise SDL
 	if (SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -143,7 +187,9 @@ bool ActionClass::shootSequence(std::chrono::time_point<std::chrono::system_cloc
 	//Must not return before uninitialising SDL.
 
 	//Shoot
+	TraceSpan shootForeground("shoot foregrounds");
 	auto foregroundImages = shootPictures(colours, true, startTime);
+	shootForeground.end();
 	decltype(foregroundImages) backgroundImages;
 
 	if (foregroundImages.size() == 0)
@@ -152,23 +198,39 @@ bool ActionClass::shootSequence(std::chrono::time_point<std::chrono::system_cloc
 	//Take Ground Truth pictures
 	if (success && saveGroundTruth)
 	{
-		assert(colours.size() >= 5);
+		assert(colours.size() >= GG::kMinColours);
 
 		//Wait for user
 		Inform("Ground Truth stage: remove the object");
+		TraceSpan wait("wait for user");
 		int secondsToWait = Window::instance()->showGroundTruthDialog();
+		wait.end();
 		if (secondsToWait == -1)
 			saveGroundTruth = false;
 		else
 		{
 			auto backgroundStartTime = std::chrono::system_clock::now() + std::chrono::seconds(secondsToWait);
+			TraceSpan shootBackground("shoot backgrounds");
 			backgroundImages = shootPictures(colours, true, backgroundStartTime);
+			shootBackground.end();
 
 			if (backgroundImages.size() == 0)
 				success = false;
 		}
 	}
 
+	//Find the part of the frame the ground truth is needed for
+	EdsSize frame = { 0, 0 };
+	EdsRect crop = { { 0, 0 }, { 0, 0 } };
+	if (success && saveGroundTruth)
+	{
+		TraceSpan findCropSpan("findCrop");
+		frame = foregroundImages[0].second.rgbSize();
+		crop = findCrop(foregroundImages[0].second, backgroundImages[0].second, region, autoCrop);
+		if (crop.size.width*crop.size.height == 0)
+			success = false;
+	}
+
 	//Save images
 	std::vector<RawRgbEds> foregroundRgbs, backgroundRgbs;
 	time_t t = time(0);
@@ -176,13 +238,14 @@ bool ActionClass::shootSequence(std::chrono::time_point<std::chrono::system_cloc
 	if (success)
 	{
 		Inform("Processing images");
+		TraceSpan processing("saveImages");
 	
 		foregroundRgbs = saveImages(foregroundImages, path, "_foreground",
-			t, saveRaw, saveProcessed, processedExtension);
+			t, saveRaw, saveProcessed, processedExtension, saveGroundTruth ? &crop : nullptr);
 		foregroundImages.clear();
 
 		backgroundRgbs = saveImages(backgroundImages, path, "_background",
-			t, saveRaw, saveProcessed, processedExtension);
+			t, saveRaw, saveProcessed, processedExtension, &crop);
 		backgroundImages.clear();
 
 		if (foregroundRgbs.size() == 0 || backgroundRgbs.size() == 0)
@@ -192,11 +255,13 @@ bool ActionClass::shootSequence(std::chrono::time_point<std::chrono::system_cloc
 	//Generate ground truth
 	if (success && saveGroundTruth)
 	{
-		if (!generateGroundTruth(foregroundRgbs, backgroundRgbs, path, t))
+		if (!generateGroundTruth(foregroundRgbs, backgroundRgbs, path, t, crop, frame))
 			success = false;
 	}
 
 	SDL_Quit();
+	span.end();
+	FlushTrace();
     Inform("Done");
 	return success;
 }
@@ -236,6 +301,7 @@ std::vector < std::pair<QColor, ImageRaw>  > ActionClass::shootPictures
 	{
 
 		QColor colour = QColor(*it);
+		TraceSpan screen("show colour", std::string(it->toUtf8()));
 
 		//Update screen a few times just in case with the colour
 		for (int i = 0; i < 4; ++i)
@@ -248,6 +314,7 @@ std::vector < std::pair<QColor, ImageRaw>  > ActionClass::shootPictures
 			SDL_RenderClear(ren);
 			SDL_RenderPresent(ren);
 		}
+		screen.end();
 
 		//if it is our first time, wait the delay about before continuing now that we're ready.
 		if (it == colours.begin())
@@ -258,6 +325,8 @@ std::vector < std::pair<QColor, ImageRaw>  > ActionClass::shootPictures
 		}
 
 
+		TraceSpan shot("shoot", std::string(it->toUtf8()));
+
 		//Wait a little to ensure the screen has refreshed before sending shoot request
 		std::this_thread::sleep_for(std::chrono::milliseconds(40));
 		camera->shoot();
@@ -269,10 +338,13 @@ std::vector < std::pair<QColor, ImageRaw>  > ActionClass::shootPictures
 			while (SDL_PollEvent(&e)) {}
 			std::this_thread::sleep_for(std::chrono::milliseconds(20));
 		} while (!camera->readyToShoot());
+		shot.end();
 
 
 		//Retrieve image
+		TraceSpan download("download", std::string(it->toUtf8()));
 		foregroundImages.push_back(std::make_pair(colour, camera->retrieveLastImage()));
+		download.end();
 		if (foregroundImages.back().second.failed())
 		{
 			Error("Error retrieving image");
@@ -311,39 +383,174 @@ std::string ActionClass::generateFilePath(const std::string& folder,
 		folder);
 }
 
+EdsRect ActionClass::findCrop(ImageRaw& foreground, ImageRaw& background, const QRectF& region, bool autoCrop)
+{
+	EdsRect crop = { { 0, 0 }, { 0, 0 } };
+	const EdsSize frame = foreground.rgbSize();
+	if (frame.width*frame.height == 0)
+		return crop;
+	crop.size = frame;
+
+	if (!region.isEmpty())
+	{
+		const QRect pixels = QRectF(region.x() * frame.width, region.y() * frame.height,
+			region.width() * frame.width, region.height() * frame.height).toAlignedRect() &
+			QRect(0, 0, frame.width, frame.height);
+
+		if (pixels.isEmpty())
+			Warning("The region of interest lies outside the image, using the whole frame");
+		else
+		{
+			crop.point.x = pixels.x();
+			crop.point.y = pixels.y();
+			crop.size.width = pixels.width();
+			crop.size.height = pixels.height();
+		}
+	}
+
+	if (!autoCrop)
+		return crop;
+
+	//A small preview of the first colour is enough to find the object.
+	RawRgbEds foregroundPreview = foreground.findRgb(crop, kAutoCropShrink);
+	RawRgbEds backgroundPreview = background.findRgb(crop, kAutoCropShrink);
+	if (std::get<2>(foregroundPreview).size() == 0 || std::get<2>(backgroundPreview).size() == 0)
+	{
+		Warning("Could not decode the preview to crop to, using the whole region");
+		return crop;
+	}
+
+	cv::Mat foregroundMat(std::get<1>(foregroundPreview), std::get<0>(foregroundPreview), CV_16UC3,
+		std::get<2>(foregroundPreview).pointer());
+	cv::Mat backgroundMat(std::get<1>(backgroundPreview), std::get<0>(backgroundPreview), CV_16UC3,
+		std::get<2>(backgroundPreview).pointer());
+	const cv::Rect bounds = FindObjectBounds(foregroundMat, backgroundMat, kAutoCropThreshold, kAutoCropMargin);
+	if (bounds.area() == 0)
+	{
+		Warning("No object found in front of the first backdrop, using the whole region");
+		return crop;
+	}
+
+	//Scale the bounds back up, rounding outwards.
+	const double scaleX = (double)crop.size.width / foregroundMat.cols;
+	const double scaleY = (double)crop.size.height / foregroundMat.rows;
+	const int left = (int)(bounds.x * scaleX);
+	const int top = (int)(bounds.y * scaleY);
+	const int right = std::min((int)crop.size.width, (int)std::ceil((bounds.x + bounds.width) * scaleX));
+	const int bottom = std::min((int)crop.size.height, (int)std::ceil((bounds.y + bounds.height) * scaleY));
+
+	crop.point.x += left;
+	crop.point.y += top;
+	crop.size.width = right - left;
+	crop.size.height = bottom - top;
+
+	Inform("Cropping the ground truth to " + ToString(crop.size.width) + "x" + ToString(crop.size.height) +
+		" pixels at " + ToString(crop.point.x) + "," + ToString(crop.point.y));
+	return crop;
+}
+
+bool ActionClass::shareFrames(SharedFrames& shared, const std::string& name,
+	const std::vector<RawRgbEds>& foreground, const std::vector<RawRgbEds>& background, size_t colours)
+{
+	const int width = std::get<0>(foreground[0]);
+	const int height = std::get<1>(foreground[0]);
+	const size_t frameBytes = (size_t)width * height * 3 * sizeof(uint16_t);
+	if (!shared.create(name, 2 * (int)colours, width, height))
+		return false;
+
+	for (size_t i = 0; i < 2 * colours; ++i)
+	{
+		const RawRgbEds& image = i < colours ? foreground[i] : background[i - colours];
+		const EdsStreamContainer& container = std::get<2>(image);
+		if (std::get<0>(image) != width || std::get<1>(image) != height || container.size() != frameBytes)
+		{
+			shared.close();
+			return false;
+		}
+		memcpy(shared.frame((int)i), container.pointer(), frameBytes);
+	}
+	return true;
+}
+
 bool ActionClass::generateGroundTruth(std::vector<RawRgbEds>& foreground,
-	std::vector<RawRgbEds>& background, const std::string& path, time_t t)
+	std::vector<RawRgbEds>& background, const std::string& path, time_t t, const EdsRect& crop, const EdsSize& frame)
 {
-	//Save temp images
-	Inform("Saving ground truth temporaries");
+	Inform("Preparing ground truth inputs");
+	TraceSpan span("generateGroundTruth");
 
-	assert(foreground.size() >= 5 && background.size() >= 5);
+	//A failed shot leaves a gap, after which the foreground and background colours no longer pair up.
+	if (foreground.size() != background.size())
+	{
+		Error("Mismatched number of foreground and background images: " + ToString(foreground.size()) +
+			" and " + ToString(background.size()));
+		return false;
+	}
+
+	size_t colours = foreground.size();
+	if (colours < (size_t)GG::kMinColours)
+	{
+		Error("At least " + ToString(GG::kMinColours) + " colours are needed for ground truth generation");
+		return false;
+	}
+	if (colours > (size_t)GG::kMaxColours)
+	{
+		Warning("Only the first " + ToString(GG::kMaxColours) + " colours are used for ground truth generation");
+		colours = GG::kMaxColours;
+	}
 
-	//Generate file names
-	QStringList fTempNames;
-	QStringList bTempNames;
 	QStringList aName = { generateFilePath(path, "A.png", t).c_str() };
 	QStringList fName = { generateFilePath(path, "F.png", t).c_str() };
 	QStringList afName = { generateFilePath(path, "AF.png", t).c_str() };
+	const std::string previewName = generateFilePath(path, "preview.png", t);
+	QStringList frameArgs;
+	if (crop.size.width != frame.width || crop.size.height != frame.height)
+		frameArgs << "--frame" << QString("%1,%2,%3,%4").arg(crop.point.x).arg(crop.point.y)
+			.arg(frame.width).arg(frame.height);
+
+	//A preview is solved first, so that a bad capture shows before the full solve is done.
+	frameArgs << "--preview" << previewName.c_str();
+
+	//Hand the images over in shared memory where possible, which GroundTruth reads in place.
+	SharedFrames shared;
+	const std::string sharedName = "groundtruth-" + ToString(QCoreApplication::applicationPid()) + "-" + ToString(t);
+	TraceSpan share("share frames", sharedName);
+	const bool sharedFrames = shareFrames(shared, sharedName, foreground, background, colours);
+	share.end();
+	if (sharedFrames)
+	{
+		foreground.clear();
+		background.clear();
 
-	for (size_t i = 0; i < 5; ++i)
-		fTempNames.append(generateFilePath(path, "_temp_f_" + ToString(i) + ".rawrgb", t).c_str());
-	for (size_t i = 0; i < 5; ++i)
-		bTempNames.append(generateFilePath(path, "_temp_b_" + ToString(i) + ".rawrgb", t).c_str());
+		Inform("Executing ground truth application on shared frames " + sharedName);
+		int code = runGroundTruth(QStringList() << "--shared-frames" << sharedName.c_str() << aName << fName <<
+			afName << frameArgs, previewName);
+		shared.close();
 
-	//Save images
-	for (size_t i = 0; i < 5; ++i)
-		if (!SaveRawRgbEds(std::string(fTempNames[i].toUtf8()), foreground[i]))
+		if (code != 0)
 		{
-			Error("Could not save " + std::string(fTempNames[i].toUtf8()));
-			return false;
-		}
-	for (size_t i = 0; i < 5; ++i)
-		if (!SaveRawRgbEds(std::string(bTempNames[i].toUtf8()), background[i]))
-		{
-			Error("Could not save " + std::string(bTempNames[i].toUtf8()));
+			Error("Non zero return code: " + ToString(code));
 			return false;
 		}
+		return true;
+	}
+	Warning("Could not share the images with the ground truth application, saving them instead");
+
+	//Save images as a single bundle
+	const std::string bundleName = generateFilePath(path, "_temp.gtset", t);
+	std::vector<const RawRgbEds*> plates;
+	for (size_t i = 0; i < colours; ++i)
+		plates.push_back(&foreground[i]);
+	for (size_t i = 0; i < colours; ++i)
+		plates.push_back(&background[i]);
+	TraceSpan save("save bundle", bundleName);
+	ThreadPool pool;
+	if (!SaveRawRgbEdsBundle(bundleName, plates, &pool))
+	{
+		Error("Could not save " + bundleName);
+		std::remove(bundleName.c_str());
+		return false;
+	}
+	save.end();
 
 	//Clear buffers
 	foreground.clear();
@@ -351,16 +558,11 @@ bool ActionClass::generateGroundTruth(std::vector<RawRgbEds>& foreground,
 
 	//Execute ground truth application
 	Inform("Executing ground truth application");
-	QProcess* gtProcess = new QProcess(Window::instance());
-	QStringList collectiveArgs = { fTempNames + bTempNames + aName + fName + afName };
-	int code = gtProcess->execute("GroundTruth.exe", collectiveArgs);
-	delete gtProcess;
+	QStringList collectiveArgs = QStringList() << "--bundle" << bundleName.c_str() << aName << fName << afName << frameArgs;
+	int code = runGroundTruth(collectiveArgs, previewName);
 
-	//Delete temporary files
-	for (auto it = fTempNames.begin(); it != fTempNames.end(); ++it)
-		std::remove(it->toUtf8());
-	for (auto it = bTempNames.begin(); it != bTempNames.end(); ++it)
-		std::remove(it->toUtf8());
+	//Delete temporary file
+	std::remove(bundleName.c_str());
 
 	if (code != 0)
 	{
@@ -371,9 +573,116 @@ bool ActionClass::generateGroundTruth(std::vector<RawRgbEds>& foreground,
 	return true;
 }
 
+bool ActionClass::showPreview(const std::string& path)
+{
+	QImage image(path.c_str());
+	if (image.isNull())
+		return false;
+
+	if (!mPreview)
+	{
+		mPreview.reset(new QLabel());
+		mPreview->setWindowTitle("Ground truth preview");
+	}
+	mPreview->setPixmap(QPixmap::fromImage(image.scaled(kPreviewSize, kPreviewSize, Qt::KeepAspectRatio,
+		Qt::SmoothTransformation)));
+	mPreview->adjustSize();
+	mPreview->show();
+	mPreview->raise();
+
+	//The sequence holds the event loop until the ground truth is done, so draw the window now.
+	QCoreApplication::processEvents();
+	Inform("Showing ground truth preview " + path);
+	return true;
+}
+
+int ActionClass::runGroundTruth(const QStringList& arguments, const std::string& preview)
+{
+	//GroundTruth records its stages to the same trace, on the same timeline.
+	QStringList traced = arguments;
+	const std::string trace = TracePath();
+	if (!trace.empty())
+		traced << "--trace" << trace.c_str();
+
+	TraceSpan span("runGroundTruth");
+	const std::string path = WorkerSocketPath();
+	WorkerSocket worker;
+	bool connected = WorkerSocket::startup() && worker.connect(path);
+
+	//The worker is a separate process like a single run, so a crash in it cannot take this one down;
+	//the next sequence simply starts a new one.
+	if (!connected && WorkerSocket::startup())
+	{
+		Inform("Starting ground truth worker");
+		TraceSpan start("start worker");
+		if (QProcess::startDetached("GroundTruth.exe", QStringList() << "--serve" << path.c_str(), QDir::currentPath()))
+		{
+			mStartedWorker = true;
+			for (int waited = 0; waited < kWorkerStartMilliseconds && !connected; waited += 100)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				connected = worker.connect(path);
+			}
+		}
+	}
+
+	if (!connected)
+	{
+		Warning("Could not reach the ground truth worker, running GroundTruth for this sequence alone");
+		TraceSpan process("GroundTruth process");
+		QProcess* gtProcess = new QProcess(Window::instance());
+		gtProcess->start("GroundTruth.exe", traced);
+		if (!gtProcess->waitForStarted())
+		{
+			delete gtProcess;
+			return -2;
+		}
+
+		//Without the worker's status lines, watch for the preview file instead.
+		bool shown = preview.empty();
+		while (!gtProcess->waitForFinished(kPreviewPollMilliseconds))
+		{
+			if (gtProcess->state() == QProcess::NotRunning)
+				break;
+			if (!shown && QFile::exists(preview.c_str()))
+				shown = showPreview(preview);
+		}
+		int code = gtProcess->exitStatus() == QProcess::NormalExit ? gtProcess->exitCode() : -1;
+		delete gtProcess;
+		return code;
+	}
+
+	std::vector<std::string> job;
+	for (auto it = traced.begin(); it != traced.end(); ++it)
+		job.push_back(std::string(it->toUtf8()));
+
+	TraceSpan wait("worker job");
+	std::string line;
+	if (worker.writeLine(JoinArguments(job)))
+		while (worker.readLine(line))
+		{
+			if (line.compare(0, 15, "status preview ") == 0)
+				showPreview(line.substr(15));
+			else if (line.compare(0, 7, "status ") == 0)
+				Inform("Ground truth " + line.substr(7));
+			else if (line.compare(0, 5, "done ") == 0)
+			{
+				int code = -1;
+				double seconds = 0;
+				std::istringstream ss(line.substr(5));
+				ss >> code >> seconds;
+				Inform("Ground truth worker finished in " + ToString(seconds) + " s");
+				return code;
+			}
+		}
+
+	Error("Lost the connection to the ground truth worker");
+	return -1;
+}
+
 std::vector<RawRgbEds> ActionClass::saveImages(std::vector < std::pair<QColor, ImageRaw>  > & images,
 	const std::string& path, const std::string& nameSuffix,
-	time_t t, bool saveRaw, bool saveProcessed, const std::string& processedExtension)
+	time_t t, bool saveRaw, bool saveProcessed, const std::string& processedExtension, const EdsRect* crop)
 {
 	if (images.size() == 0)
 		return{};
@@ -388,21 +697,34 @@ std::vector<RawRgbEds> ActionClass::saveImages(std::vector < std::pair<QColor, I
 		{
 			std::string pathRaw = generateFilePath(
 				path, std::string(images[i].first.name().toUtf8()) + nameSuffix, t) + ".cr2";
+			TraceSpan save("save raw", pathRaw);
 			if (!images[i].second.saveToFile(pathRaw))
 				return{};
 		}
 
-		//Get RGB
-		out.push_back(images[i].second.findRgb());
+		//Get RGB, decoding only the crop unless the whole image is needed for the processed file
+		TraceSpan decode("findRgb", std::string(images[i].first.name().toUtf8()) + nameSuffix);
+		out.push_back(crop && !saveProcessed ? images[i].second.findRgb(*crop) : images[i].second.findRgb());
 		if (std::get<2>(out.back()).size() == 0)
 			return{};
+		decode.end();
 
 		//Save processed
 		if (saveProcessed)
 		{
 			std::string pathProcessed = generateFilePath(
 				path, std::string(images[i].first.name().toUtf8()) + nameSuffix, t) + "." + processedExtension;
+			TraceSpan save("save processed", pathProcessed);
 			images[i].second.saveProcessed(pathProcessed, out.back());
+			save.end();
+
+			if (crop)
+			{
+				TraceSpan cropSpan("cropRgb");
+				out.back() = images[i].second.cropRgb(out.back(), *crop);
+				if (std::get<2>(out.back()).size() == 0)
+					return{};
+			}
 		}
 	}
 
@@ -5,6 +5,7 @@
 #include <qstringlist.h>
 #include <chrono>
 #include <qcolor.h>
+#include <qrect.h>
 
 namespace sf { class RenderWindow; }
 
@@ -14,6 +15,8 @@ namespace sf { class RenderWindow; }
 * */
 
 class CameraList;
+class SharedFrames;
+class QLabel;
 
 class ActionClass
 {
@@ -26,6 +29,30 @@ class ActionClass
     //
     static ActionClass* sActionClass;
 
+	//Whether this instance started the ground truth worker, and so should stop it.
+	bool mStartedWorker = false;
+
+	//The window showing the preview of the last ground truth, created when the first preview arrives.
+	std::unique_ptr<QLabel> mPreview;
+
+	/**
+	* Runs GroundTruth with the given arguments, handing them to the ground truth worker (see
+	* GroundTruth --serve) so that the process stays running between sequences. The worker is started
+	* if it is not running. If it cannot be reached, GroundTruth is run for this job alone instead.
+	* The stages the job reaches are reported as they happen.
+	* @param preview If not empty, the preview GroundTruth was asked to save (see --preview), which is
+	*                shown as soon as it is saved, long before the job finishes.
+	* @return The exit code of the job, or -1 if the worker stopped during it.
+	* */
+	int runGroundTruth(const QStringList& arguments, const std::string& preview = std::string());
+
+	/**
+	* Shows the ground truth preview at path in a window of its own, so that a bad capture can be reshot
+	* straight away.
+	* @return false if the image cannot be read, such as while it is still being written.
+	* */
+	bool showPreview(const std::string& path);
+
     /**
     * Generates a name for an image based on its path, colour and time.
     * @param folder A path to the location where the image is to be stored.
@@ -47,17 +74,42 @@ class ActionClass
 		(const QStringList& colours, bool delay,
 		std::chrono::time_point<std::chrono::system_clock> startTime = std::chrono::system_clock::now());
 
+	/**
+	* Creates a shared memory segment called name and copies the images into it, foregrounds first,
+	* so that GroundTruth can read them in place (see GroundTruth --shared-frames).
+	* @param colours The number of foreground and of background images to share.
+	* @return false if shared memory is unavailable or the images differ in size.
+	* */
+	bool shareFrames(SharedFrames& shared, const std::string& name, const std::vector<RawRgbEds>& foreground,
+		const std::vector<RawRgbEds>& background, size_t colours);
+
 	/**
 	* Takes in a list of RGB images and starts the process to compute the appropriate ground truth.
 	* The inputs are destroyed.
+	* They are handed over in shared memory, or in temporary files if that is not possible.
 	* These images are saved in the .tiff format regardless of the chosen extension to preserve detail.
-	* @param foreground The foreground images (minimum of 5)
-	* @param background The background images (minimum of 5)
+	* Every colour shot is used, up to GG::kMaxColours.
+	* @param foreground The foreground images (minimum of GG::kMinColours)
+	* @param background The background images, one for each foreground image
 	* @param path The location where the images should be saved
 	* @param t The current time as returned by time(0). Used for generating temp file names.
+	* @param crop The region of the frame the images cover. The ground truth is 0 outside it.
+	* @param frame The size of the whole frame.
 	* */
 	bool generateGroundTruth(std::vector<RawRgbEds>& foreground, std::vector<RawRgbEds>& background,
-		const std::string& path, time_t t);
+		const std::string& path, time_t t, const EdsRect& crop, const EdsSize& frame);
+
+	/**
+	* Works out the region of the frame to generate the ground truth for, so that nothing outside it
+	* needs to be decoded, stored or solved.
+	* @param foreground The first foreground image.
+	* @param background The background image shot with the same colour.
+	* @param region The region drawn by the user, as fractions of the frame, or an empty rectangle for the whole frame.
+	* @param autoCrop Whether to narrow the region to the object, found from a preview of the difference
+	*                 between foreground and background.
+	* @return The region in pixels, or an empty region upon failure.
+	* */
+	EdsRect findCrop(ImageRaw& foreground, ImageRaw& background, const QRectF& region, bool autoCrop);
 
 	/**
 	* Saves the images using their colours and t to determine the names.
@@ -68,18 +120,20 @@ class ActionClass
 	* @param saveRaw Whether to save the raw images.
 	* @param saveProcessed Whether to save the processed images
 	* @param processedExtension The processed extension to save (e.g., "tiff")
+	* @param crop If given, the returned RGB data covers only this region, and only it is decoded unless
+	*             the processed images are saved.
 	* @return An array of RawRgbEds values corresponding to the inputs, or {} upon failure.
 	* */
 	std::vector<RawRgbEds> saveImages(std::vector < std::pair<QColor, ImageRaw>  > & images,
 		const std::string& path, const std::string& nameSuffix, time_t t, bool saveRaw,
-		bool saveProcessed, const std::string& processedExtension);
+		bool saveProcessed, const std::string& processedExtension, const EdsRect* crop = nullptr);
 
 public:
 
     /** Attempts to create the class, returning null if the class exists of if creation failed. */
     static ActionClass* create();
 
-    /** Undregisters the class. */
+    /** Undregisters the class, stopping the ground truth worker if it was started by it. */
     ~ActionClass();
 
     /** Returns the current camera is. */
@@ -133,8 +187,12 @@ public:
     * @param saveraw Whether to saw the raw .cr2 images.
     * @param processedExtension The extension with which to save the processed image.
 	* @param path The folder where the images should be saved.
+	* @param region The region of the frame to generate the ground truth for, as fractions of the frame.
+	*               An empty rectangle uses the whole frame.
+	* @param autoCrop Whether to narrow the ground truth to the bounding box of the object.
     * */
     bool shootSequence(std::chrono::time_point<std::chrono::system_clock> startTime,
         const QStringList& colours, bool saveProcessed, bool saveRaw,bool saveGroundTruth,
-		const std::string& processedExtension, const std::string& path);
+		const std::string& processedExtension, const std::string& path,
+		const QRectF& region = QRectF(), bool autoCrop = false);
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+/** Defines the background cache file, which holds the background factors of a capture set (see
+ * GG::factorRow) so that foregrounds shot against the same backdrops can be solved without the images of
+ * the backdrops. The format is a header of the characters "GTBF" and the ints version, width, height and
+ * colours, followed by each row of factors as GG::factorPlanes(colours) planes of width floats, 3 * colours
+ * floats per pixel. Version 1 also held the factors that can be derived from the others, and is no longer read.
+ * */
+
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include "io.h"
+
+static const char kBackgroundCacheMagic[4] = { 'G', 'T', 'B', 'F' };
+static const int kBackgroundCacheVersion = 2;
+
+/**
+* Writes a background cache a band of rows at a time.
+* */
+class BackgroundCacheWriter
+{
+	std::fstream mOut;
+
+public:
+
+	/** Creates the file and writes the header, returning false upon failure. */
+	bool open(const std::string& path, int width, int height, int colours)
+	{
+		mOut.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (mOut.fail())
+			return false;
+
+		mOut.write(kBackgroundCacheMagic, sizeof(kBackgroundCacheMagic));
+		mOut.write((const char*)&kBackgroundCacheVersion, sizeof(int));
+		mOut.write((const char*)&width, sizeof(int));
+		mOut.write((const char*)&height, sizeof(int));
+		mOut.write((const char*)&colours, sizeof(int));
+		return !mOut.fail();
+	}
+
+	/** Appends count floats of factors. */
+	bool write(const float* factors, size_t count)
+	{
+		mOut.write((const char*)factors, count * sizeof(float));
+		return !mOut.fail();
+	}
+
+	/** Finishes the file, returning false if any write failed. */
+	bool close()
+	{
+		mOut.close();
+		return !mOut.fail();
+	}
+};
+
+/**
+* Reads a background cache a band of rows at a time.
+* */
+class BackgroundCacheReader
+{
+	std::fstream mIn;
+	int mWidth = 0;
+	int mHeight = 0;
+	int mColours = 0;
+
+public:
+
+	/** Opens the file and reads its header, returning false upon failure or if it is not a background cache. */
+	bool open(const std::string& path)
+	{
+		mIn.open(path, std::ios::in | std::ios::binary);
+		if (mIn.fail())
+			return false;
+
+		char magic[4];
+		int version = 0;
+		mIn.read(magic, sizeof(magic));
+		mIn.read((char*)&version, sizeof(int));
+		mIn.read((char*)&mWidth, sizeof(int));
+		mIn.read((char*)&mHeight, sizeof(int));
+		mIn.read((char*)&mColours, sizeof(int));
+
+		return !mIn.fail() && memcmp(magic, kBackgroundCacheMagic, sizeof(magic)) == 0 &&
+			version == kBackgroundCacheVersion && mWidth > 0 && mHeight > 0 && mColours > 0;
+	}
+
+	/** Returns the width of the image. */
+	int width() const { return mWidth; }
+
+	/** Returns the height of the image. */
+	int height() const { return mHeight; }
+
+	/** Returns the number of backdrop colours the factors were computed for. */
+	int colours() const { return mColours; }
+
+	/**
+	* Reads the factors of rows [row, row + count) into out, which must hold count rows of
+	* rowFloats floats. Returns false if the file is too short.
+	* */
+	bool readRows(int row, int count, size_t rowFloats, float* out)
+	{
+		const std::streamoff header = sizeof(kBackgroundCacheMagic) + 4 * sizeof(int);
+		mIn.seekg(header + (std::streamoff)row * rowFloats * sizeof(float));
+		mIn.read((char*)out, (std::streamoff)count * rowFloats * sizeof(float));
+		return !mIn.fail();
+	}
+};
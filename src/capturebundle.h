@@ -0,0 +1,282 @@
+#pragma once
+/** Defines the capture bundle, a single file holding every plate of a capture set, the N foregrounds
+ * followed by the N backgrounds, so that a set can be handed to GroundTruth, archived or moved as one file.
+ * The plates are cut into tiles of kCaptureBundleTileRows whole rows, and the tiles of every plate are
+ * interleaved: tile 0 of each plate in turn, then tile 1 of each plate, and so on. The rows that one band
+ * of the solve needs therefore lie together and are fetched with a single sequential read.
+ *
+ * The file starts with a CaptureBundleHeader, followed by an index of a RawRgbBlock entry for each tile of
+ * each plate in file order, followed by the tiles, each compressed as a .rawrgb version 2 block (see
+ * rawrgbformat.h).
+ * */
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "rawrgbformat.h"
+
+static const char kCaptureBundleMagic[4] = { 'G', 'T', 'C', 'B' };
+static const int kCaptureBundleVersion = 1;
+
+//Rows per tile. A tile of every plate of a 6000 pixel wide set is a read of a few tens of megabytes at most.
+static const int kCaptureBundleTileRows = 64;
+
+/** The start of a capture bundle. */
+struct CaptureBundleHeader
+{
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int plates;
+	int tileRows;
+	int tileCount;
+
+	//The checksum of the header, with this field 0, and of the index.
+	uint32_t checksum;
+};
+
+/** Returns the number of rows in tile i. */
+static int CaptureBundleTileRows(const CaptureBundleHeader& header, int i)
+{
+	return std::min(header.tileRows, header.height - i * header.tileRows);
+}
+
+/**
+* Writes a capture bundle a tile at a time.
+* */
+class CaptureBundleWriter
+{
+	std::fstream mOut;
+	CaptureBundleHeader mHeader = CaptureBundleHeader();
+	std::vector<RawRgbBlock> mIndex;
+	uint64_t mOffset = 0;
+	int mTile = 0;
+
+public:
+
+	/** Creates the file for plates images of width by height pixels, returning false upon failure. */
+	bool open(const std::string& path, int width, int height, int plates)
+	{
+		if (width <= 0 || height <= 0 || plates <= 0)
+			return false;
+
+		memcpy(mHeader.magic, kCaptureBundleMagic, sizeof(kCaptureBundleMagic));
+		mHeader.version = kCaptureBundleVersion;
+		mHeader.width = width;
+		mHeader.height = height;
+		mHeader.plates = plates;
+		mHeader.tileRows = kCaptureBundleTileRows;
+		mHeader.tileCount = (height + kCaptureBundleTileRows - 1) / kCaptureBundleTileRows;
+		mHeader.checksum = 0;
+		mIndex.assign((size_t)mHeader.tileCount * plates, RawRgbBlock());
+		mTile = 0;
+
+		mOut.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (mOut.fail())
+			return false;
+
+		//The index is written once every tile is known.
+		mOffset = sizeof(mHeader) + mIndex.size() * sizeof(RawRgbBlock);
+		mOut.seekp((std::streamoff)mOffset);
+		return !mOut.fail();
+	}
+
+	/** Returns the number of rows the next tile must have. */
+	int tileRows() const
+	{
+		return CaptureBundleTileRows(mHeader, mTile);
+	}
+
+	/**
+	* Compresses the next tile of every plate and appends them.
+	* @param rows For each plate, tileRows() rows of width*3 values.
+	* @param pool The pool to compress the plates on, or nullptr to compress them on the calling thread.
+	* */
+	bool writeTile(const uint16_t* const* rows, ThreadPool* pool = nullptr)
+	{
+		if (mTile >= mHeader.tileCount)
+			return false;
+
+		std::vector<std::vector<unsigned char>> data(mHeader.plates);
+		RawRgbBlock* entries = &mIndex[(size_t)mTile * mHeader.plates];
+		ForEachRawRgbBlock(mHeader.plates, pool, [&](int i) {
+			CompressRawRgbBlock(rows[i], mHeader.width, tileRows(), data[i]);
+			entries[i].size = (uint32_t)data[i].size();
+			entries[i].checksum = RawRgbChecksum(data[i].data(), data[i].size());
+		});
+
+		for (int i = 0; i < mHeader.plates; ++i)
+		{
+			entries[i].offset = mOffset;
+			mOffset += entries[i].size;
+			mOut.write((const char*)data[i].data(), data[i].size());
+		}
+		++mTile;
+		return !mOut.fail();
+	}
+
+	/** Writes the header and index, returning false if a tile is missing or any write failed. */
+	bool close()
+	{
+		if (mTile != mHeader.tileCount)
+		{
+			mOut.close();
+			return false;
+		}
+
+		mHeader.checksum = RawRgbChecksum(&mIndex[0], mIndex.size() * sizeof(RawRgbBlock),
+			RawRgbChecksum(&mHeader, sizeof(mHeader)));
+		mOut.seekp(0);
+		mOut.write((const char*)&mHeader, sizeof(mHeader));
+		mOut.write((const char*)&mIndex[0], mIndex.size() * sizeof(RawRgbBlock));
+		mOut.close();
+		return !mOut.fail();
+	}
+};
+
+/**
+* Reads a capture bundle a band of rows at a time, fetching each tile of every plate in one read and
+* keeping only the last tile.
+* */
+class CaptureBundleReader
+{
+	std::fstream mIn;
+	CaptureBundleHeader mHeader = CaptureBundleHeader();
+	std::vector<RawRgbBlock> mIndex;
+
+	//The last tile read, its bytes, and for each plate whether it was decoded and its pixels.
+	int mTile = -1;
+	std::vector<unsigned char> mTileData;
+	std::vector<char> mDecoded;
+	std::vector<std::vector<uint16_t>> mPixels;
+
+	/** Reads tile t if it is not the last one read, returning false upon failure. */
+	bool readTile(int t)
+	{
+		if (t == mTile)
+			return true;
+		mTile = -1;
+
+		const RawRgbBlock* entries = &mIndex[(size_t)t * mHeader.plates];
+		const RawRgbBlock& last = entries[mHeader.plates - 1];
+		mTileData.resize((size_t)(last.offset + last.size - entries[0].offset));
+		mIn.seekg((std::streamoff)entries[0].offset);
+		mIn.read((char*)mTileData.data(), mTileData.size());
+		if (mIn.fail())
+			return false;
+
+		mDecoded.assign(mHeader.plates, 0);
+		mTile = t;
+		return true;
+	}
+
+	/** Decodes plate i of the last tile read if it has not been, returning false if it is malformed. */
+	bool decodePlate(int i)
+	{
+		if (mDecoded[i])
+			return true;
+
+		const RawRgbBlock& entry = mIndex[(size_t)mTile * mHeader.plates + i];
+		const unsigned char* data = &mTileData[(size_t)(entry.offset - mIndex[(size_t)mTile * mHeader.plates].offset)];
+		mPixels[i].resize((size_t)mHeader.tileRows * mHeader.width * 3);
+		if (RawRgbChecksum(data, entry.size) != entry.checksum ||
+			!DecompressRawRgbBlock(data, entry.size, mHeader.width, CaptureBundleTileRows(mHeader, mTile), &mPixels[i][0]))
+			return false;
+		mDecoded[i] = 1;
+		return true;
+	}
+
+public:
+
+	/** Opens the file and reads its index, returning false upon failure or if it is not a valid bundle. */
+	bool open(const std::string& path)
+	{
+		mIn.open(path, std::ios::in | std::ios::binary);
+		if (mIn.fail())
+			return false;
+
+		mIn.seekg(0, std::ios::end);
+		const uint64_t fileSize = (uint64_t)mIn.tellg();
+		mIn.seekg(0);
+		mIn.read((char*)&mHeader, sizeof(mHeader));
+		if (mIn.fail() || memcmp(mHeader.magic, kCaptureBundleMagic, sizeof(kCaptureBundleMagic)) != 0 ||
+			mHeader.version != kCaptureBundleVersion || mHeader.width <= 0 || mHeader.height <= 0 ||
+			mHeader.plates <= 0 || mHeader.tileRows <= 0 ||
+			mHeader.tileCount != (mHeader.height + mHeader.tileRows - 1) / mHeader.tileRows ||
+			(uint64_t)mHeader.tileCount * mHeader.plates * sizeof(RawRgbBlock) > fileSize)
+			return false;
+
+		mIndex.resize((size_t)mHeader.tileCount * mHeader.plates);
+		mIn.read((char*)&mIndex[0], mIndex.size() * sizeof(RawRgbBlock));
+		if (mIn.fail())
+			return false;
+
+		CaptureBundleHeader copy = mHeader;
+		copy.checksum = 0;
+		if (RawRgbChecksum(&mIndex[0], mIndex.size() * sizeof(RawRgbBlock), RawRgbChecksum(&copy, sizeof(copy))) !=
+			mHeader.checksum)
+			return false;
+
+		//The plates of a tile must follow each other, so that each tile is one read.
+		for (size_t i = 0; i < mIndex.size(); ++i)
+			if (mIndex[i].offset > fileSize || mIndex[i].size > fileSize - mIndex[i].offset ||
+				(i % mHeader.plates != 0 && mIndex[i].offset != mIndex[i - 1].offset + mIndex[i - 1].size))
+				return false;
+
+		mPixels.resize(mHeader.plates);
+		return true;
+	}
+
+	/** Returns the width of the plates. */
+	int width() const { return mHeader.width; }
+
+	/** Returns the height of the plates. */
+	int height() const { return mHeader.height; }
+
+	/** Returns the number of plates. */
+	int plates() const { return mHeader.plates; }
+
+	/**
+	* Reads columns [x, x + width) of rows [row, row + count) of every plate i for which out[i] is not
+	* nullptr into out[i], which must hold count*width*3 values.
+	* @param pool The pool to decode the plates on, or nullptr to decode them on the calling thread.
+	* @return false if the file is too short or damaged.
+	* */
+	bool readRegion(int row, int count, int x, int width, uint16_t* const* out, ThreadPool* pool = nullptr)
+	{
+		if (row < 0 || count < 0 || row + count > mHeader.height)
+			return false;
+
+		for (int r = row; r < row + count;)
+		{
+			const int t = r / mHeader.tileRows;
+			const int tileRow = r - t * mHeader.tileRows;
+			const int rows = std::min(row + count - r, CaptureBundleTileRows(mHeader, t) - tileRow);
+			if (!readTile(t))
+				return false;
+
+			std::atomic<bool> valid(true);
+			ForEachRawRgbBlock(mHeader.plates, pool, [&](int i) {
+				if (!out[i])
+					return;
+				if (!decodePlate(i))
+				{
+					valid = false;
+					return;
+				}
+				for (int j = 0; j < rows; ++j)
+					memcpy(out[i] + (size_t)(r - row + j) * width * 3,
+						&mPixels[i][((size_t)(tileRow + j) * mHeader.width + x) * 3], (size_t)width * 3 * sizeof(uint16_t));
+			});
+			if (!valid)
+				return false;
+			r += rows;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,724 @@
+/**
+* This application renders synthetic capture sets, so that GroundTruth can be run and load-tested at any
+* resolution on a machine without a camera. Each set is an object photographed in front of a screen showing
+* each colour in turn, and then the screen alone, written in the same .rawrgb format as CameraControl writes
+* (see rawrgbformat.h), together with the A, F and AF the solve should recover.
+*
+* The object is a disc with a soft edge and partly transparent regions, with fine strands of hair around it.
+* The screens are lit as a monitor photographed through a lens: the black level of the panel, the colour of
+* the screen, and vignetting towards the corners. Every plate then gets sensor noise of its own, is clipped
+* at the saturation level of the sensor and quantised to the bit depth of the sensor, before being scaled to
+* 16 bits as the raw decoder does. Rows are rendered in bands on every thread and written as they are
+* finished, so that sets far larger than memory, up to gigapixels, can be made. The noise of each row is
+* seeded from the seed, set, plate and row alone, so the output does not depend on the number of threads.
+*
+* Arguments:
+* @arg The name of the program (default argument)
+* @arg OutputPath The directory to write the capture sets to.
+*
+* For set k of N screen colours, the files set<k>_fg<i>.rawrgb and set<k>_bg<i>.rawrgb hold the plates
+* with and without the object, and set<k>_refA.png, set<k>_refF.png and set<k>_refAF.png the reference,
+* as 16 bit RGB PNG files like those GroundTruth saves. F is 0 where alpha is. manifest.txt lists every set
+* for GroundTruth --manifest, with outputs named set<k>_A.png, set<k>_F.png and set<k>_AF.png.
+*
+* Options may be given anywhere among the arguments:
+* --size WxH  The resolution of the plates. Default 5760x3840, that of the camera.
+* --screens C1,C2,...  The screen colours, as #rrggbb like colours.txt of CameraControl. Default
+*                #0000ff,#00ff00,#ff0000. Between GG::kMinColours and GG::kMaxColours colours.
+* --screens-file PATH  Reads the screen colours from a file of one #rrggbb colour per line, such as the
+*                colours.txt that CameraControl keeps.
+* --sets K  The number of capture sets, each with the object in a different place. Default 1.
+* --format F  v2 (default) writes compressed .rawrgb files as CameraControl does, v1 the older uncompressed
+*                ones, and bundle a single capture bundle set<k>.gtset per set (see capturebundle.h), which
+*                GroundTruth reads with --bundle; no manifest is written for bundles.
+* --alpha-min A  The alpha of the most transparent parts of the object, from 0 to 1. Default 0.3.
+* --edge E  The width of the soft edge of the object, relative to its radius. Default 0.05.
+* --strands S  The number of strands of hair around the object. Default 64.
+* --exposure E  The level a white screen reaches, relative to full scale. Default 0.8.
+* --vignette V  The share of light lost in the corners. Default 0.25.
+* --noise S  The standard deviation of the read noise, relative to full scale. Default 0.001.
+* --shot-noise K  Adds photon noise of variance K times the level. Default 0.0001.
+* --clip L  The saturation level of the sensor, relative to full scale, at which every plate is clipped.
+*                Default 1.
+* --bits B  The bit depth of the sensor, from 8 to 16. Default 14.
+* --seed N  The seed of the noise and of the placement of the objects. Default 1.
+* --references R  png (default) writes the reference outputs, none skips them.
+* --png-compression L  The compression level of the reference PNG files, from 0 to 9. Default 1.
+* --band-rows R  The rows rendered at a time, rounded up to a multiple of kCaptureBundleTileRows. Default 256.
+* --threads N  The number of threads to render with. Defaults to 0, meaning every hardware thread.
+*/
+
+#include "io.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "groundtruthkernel.h"
+#include "rawrgbformat.h"
+#include "capturebundle.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+
+//The level of the screen showing black, relative to white, from the backlight of the panel and glare.
+static const double kScreenBlack = 0.02;
+
+//The half width of a strand of hair, in pixels, and how far beyond the object the strands reach, relative
+//to its radius.
+static const double kStrandHalfWidth = 0.75;
+static const double kStrandLength = 0.35;
+
+/** The formats the plates can be written in. */
+enum class PlateFormat { RawRgbV1, RawRgbV2, Bundle };
+
+/** Settings of the generator. */
+struct GeneratorOptions
+{
+	int width = 5760;
+	int height = 3840;
+	std::vector<cv::Vec3d> screens;
+	int sets = 1;
+	PlateFormat format = PlateFormat::RawRgbV2;
+	double alphaMin = 0.3;
+	double edge = 0.05;
+	int strands = 64;
+	double exposure = 0.8;
+	double vignette = 0.25;
+	double noise = 0.001;
+	double shotNoise = 0.0001;
+	double clip = 1;
+	int bits = 14;
+	unsigned seed = 1;
+	bool references = true;
+	int pngCompression = 1;
+	int bandRows = 256;
+	unsigned threads = 0;
+};
+
+/** Where the object of a set lies, in units of the image height from the centre of the image. */
+struct SceneObject
+{
+	double x;
+	double y;
+	double radius;
+
+	//The angle of each strand, and its length relative to kStrandLength.
+	std::vector<double> strandAngle;
+	std::vector<double> strandLength;
+};
+
+/** Writes the plates of a set in one of the formats, a band of rows at a time. */
+class PlateWriter
+{
+	PlateFormat mFormat = PlateFormat::RawRgbV2;
+	int mWidth = 0;
+	std::vector<std::unique_ptr<RawRgbWriter> > mRawRgb;
+	std::vector<std::unique_ptr<std::fstream> > mLegacy;
+	CaptureBundleWriter mBundle;
+
+public:
+
+	/**
+	* Creates the files.
+	* @param paths The paths of the plates, or for a bundle a single path.
+	* @param plates The number of plates, which for a bundle all go into the one file.
+	* */
+	bool open(PlateFormat format, const std::vector<std::string>& paths, int width, int height, int plates)
+	{
+		mFormat = format;
+		mWidth = width;
+		if (format == PlateFormat::Bundle)
+			return mBundle.open(paths[0], width, height, plates);
+
+		for (const std::string& path : paths)
+		{
+			if (format == PlateFormat::RawRgbV2)
+			{
+				mRawRgb.emplace_back(new RawRgbWriter());
+				if (!mRawRgb.back()->open(path, width, height))
+					return false;
+				continue;
+			}
+
+			//Version 1 is the width and height followed by the samples.
+			mLegacy.emplace_back(new std::fstream(path, std::ios::out | std::ios::binary | std::ios::trunc));
+			mLegacy.back()->write((const char*)&width, sizeof(width));
+			mLegacy.back()->write((const char*)&height, sizeof(height));
+			if (mLegacy.back()->fail())
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	* Appends rows to every plate.
+	* @param plates For each plate, rows*width*3 samples. rows is a multiple of kCaptureBundleTileRows, except
+	*               for the last rows of the image.
+	* @param pool The pool to compress on.
+	* */
+	bool writeRows(const std::vector<std::vector<uint16_t> >& plates, int rows, ThreadPool* pool)
+	{
+		const size_t rowSamples = (size_t)mWidth * 3;
+		if (mFormat == PlateFormat::Bundle)
+		{
+			std::vector<const uint16_t*> tile(plates.size());
+			for (int row = 0; row < rows; row += kCaptureBundleTileRows)
+			{
+				for (size_t i = 0; i < plates.size(); ++i)
+					tile[i] = &plates[i][row * rowSamples];
+				if (!mBundle.writeTile(&tile[0], pool))
+					return false;
+			}
+			return true;
+		}
+
+		for (size_t i = 0; i < plates.size(); ++i)
+		{
+			if (mFormat == PlateFormat::RawRgbV2)
+			{
+				if (!mRawRgb[i]->writeRows(&plates[i][0], rows, pool))
+					return false;
+			}
+			else if (!mLegacy[i]->write((const char*)&plates[i][0], rows * rowSamples * sizeof(uint16_t)))
+				return false;
+		}
+		return true;
+	}
+
+	/** Finishes the files, returning false if any write failed. */
+	bool close()
+	{
+		if (mFormat == PlateFormat::Bundle)
+			return mBundle.close();
+
+		bool ok = true;
+		for (auto& writer : mRawRgb)
+			ok = writer->close() && ok;
+		for (auto& out : mLegacy)
+		{
+			out->close();
+			ok = !out->fail() && ok;
+		}
+		return ok;
+	}
+};
+
+/**
+* A fast source of approximately Gaussian noise of unit variance: the sum of four 16 bit uniform values
+* from a SplitMix64 generator, which is within a few percent of a Gaussian out to three standard deviations.
+* The standard library generators would take most of the rendering time.
+* */
+class NoiseSource
+{
+	uint64_t mState;
+
+	uint64_t next()
+	{
+		uint64_t z = (mState += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+public:
+
+	/** Starts the sequence of a row of a plate, independent of every other row. */
+	NoiseSource(unsigned seed, int set, int plate, int row)
+	{
+		mState = ((uint64_t)seed << 32) ^ ((uint64_t)set << 48) ^ ((uint64_t)plate << 40) ^ (uint64_t)row;
+		mState = next();
+	}
+
+	double gaussian()
+	{
+		const uint64_t bits = next();
+		const double sum = (double)(bits & 0xffff) + (double)((bits >> 16) & 0xffff) +
+			(double)((bits >> 32) & 0xffff) + (double)(bits >> 48);
+
+		//Four uniform values have a mean of 2 and a variance of 1/3 in units of 65536.
+		return (sum / 65536.0 - 2.0) * 1.7320508075688772;
+	}
+};
+
+/** Returns the seconds elapsed since start. */
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** A smooth step from 0 at edge0 to 1 at edge1. */
+static double SmoothStep(double edge0, double edge1, double x)
+{
+	const double t = std::min(1.0, std::max(0.0, (x - edge0) / (edge1 - edge0)));
+	return t * t * (3 - 2 * t);
+}
+
+/** Converts an 8 bit sRGB value, as sent to the screen, to linear light between 0 and 1. */
+static double LinearFromSrgb(int value)
+{
+	const double c = value / 255.0;
+	return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+/**
+* Reads a colour given as #rrggbb into its linear light, in OpenCV's BGR order.
+* @return false if the colour is malformed.
+* */
+static bool ParseScreen(const std::string& value, cv::Vec3d& screen)
+{
+	unsigned rgb = 0;
+	std::istringstream ss(value.size() == 7 && value[0] == '#' ? value.substr(1) : std::string());
+	if (!(ss >> std::hex >> rgb) || !ss.eof())
+		return false;
+	screen = cv::Vec3d(LinearFromSrgb(rgb & 0xff), LinearFromSrgb((rgb >> 8) & 0xff), LinearFromSrgb(rgb >> 16));
+	return true;
+}
+
+/** Places the object of set k, from the seed alone. */
+static SceneObject MakeObject(const GeneratorOptions& options, int set)
+{
+	std::mt19937 random(options.seed * 7919u + set);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	SceneObject object;
+	object.x = (uniform(random) - 0.5) * 0.2;
+	object.y = (uniform(random) - 0.5) * 0.2;
+	object.radius = 0.25 + 0.1 * uniform(random);
+	for (int i = 0; i < options.strands; ++i)
+	{
+		//The strands are spread evenly, each turned by up to a quarter of the gap to its neighbours.
+		object.strandAngle.push_back((i + (uniform(random) - 0.5) * 0.5) * 2 * CV_PI / options.strands);
+		object.strandLength.push_back(0.5 + 0.5 * uniform(random));
+	}
+	return object;
+}
+
+/**
+* Computes the alpha and alpha-premultiplied foreground of a pixel, in linear light before exposure.
+* @param px, py The position of the pixel centre from the centre of the image, in units of the image height.
+* @param pixel The size of a pixel in the same units.
+* */
+static double RenderObject(const GeneratorOptions& options, const SceneObject& object, double px, double py,
+	double pixel, cv::Vec3d& af)
+{
+	const double dx = px - object.x, dy = py - object.y;
+	const double distance = std::sqrt(dx * dx + dy * dy);
+	const double r = object.radius;
+
+	//The body: opaque and partly transparent regions, fading out over the edge.
+	const double inside = 1 - SmoothStep(r * (1 - options.edge), r, distance);
+	const double pattern = std::min(1.0, std::max(0.0, 0.5 + 0.75 * std::sin(9 * dx / r) * std::cos(7 * dy / r)));
+	const double body = inside * (options.alphaMin + (1 - options.alphaMin) * pattern);
+
+	//A fine texture of a few pixels, so that the plates are not unrealistically smooth.
+	const double texture = 0.05 * std::sin(px / pixel * 1.7) * std::sin(py / pixel * 2.3);
+	const cv::Vec3d bodyColour(0.45 + 0.3 * dy / r + texture, 0.5 + 0.25 * dx / r + texture, 0.7 - 0.2 * dy / r + texture);
+
+	//The strands: the nearest strand in angle covers part of the pixel if the pixel lies along it.
+	double strand = 0;
+	if (options.strands > 0 && distance > r * (1 - options.edge))
+	{
+		const double gap = 2 * CV_PI / options.strands;
+		double angle = std::atan2(dy, dx);
+		if (angle < 0)
+			angle += 2 * CV_PI;
+		const int nearest = (int)std::floor(angle / gap + 0.5);
+		for (int k = nearest - 1; k <= nearest + 1; ++k)
+		{
+			const int i = ((k % options.strands) + options.strands) % options.strands;
+			const double a = object.strandAngle[i];
+			const double along = dx * std::cos(a) + dy * std::sin(a);
+			const double across = std::fabs(dy * std::cos(a) - dx * std::sin(a)) / pixel;
+			const double length = r * kStrandLength * object.strandLength[i];
+			if (along < r * (1 - options.edge) || along > r + length)
+				continue;
+			const double fade = 1 - std::max(0.0, along - r) / length;
+			strand = std::max(strand, 0.9 * fade * std::max(0.0, 1 - across / (2 * kStrandHalfWidth)));
+		}
+	}
+	const cv::Vec3d strandColour(0.05, 0.1, 0.2);
+
+	//The strands lie over the body.
+	af = bodyColour * (body * (1 - strand)) + strandColour * strand;
+	return body + strand - body * strand;
+}
+
+/** Quantises a level, relative to full scale, to the sensor and scales it to 16 bits. */
+static uint16_t Quantise(double value, double clip, double sensorMax)
+{
+	value = std::min(clip, std::max(0.0, value));
+	return (uint16_t)std::lround(std::floor(value * sensorMax + 0.5) * 65535.0 / sensorMax);
+}
+
+/** Quantises a reference value to 16 bits, as GroundTruth saves its outputs. */
+static uint16_t QuantiseReference(double value)
+{
+	return (uint16_t)std::lround(std::min(1.0, std::max(0.0, value)) * 65535);
+}
+
+/**
+* Renders one row of every plate and of the references.
+* @param plates The N foregrounds followed by the N backgrounds, each receiving width*3 samples.
+* @param a, f, af If not nullptr, receive the reference row.
+* */
+static void RenderRow(const GeneratorOptions& options, const SceneObject& object, int set, int y,
+	uint16_t* const* plates, uint16_t* a, uint16_t* f, uint16_t* af)
+{
+	const int colours = (int)options.screens.size();
+	const double pixel = 1.0 / options.height;
+	const double py = (y + 0.5 - options.height * 0.5) * pixel;
+	const double sensorMax = (1 << options.bits) - 1;
+	const double halfDiagonal2 = 0.25 * (1 + (double)options.width * options.width / ((double)options.height * options.height));
+
+	std::vector<NoiseSource> noise;
+	for (int i = 0; i < 2 * colours; ++i)
+		noise.push_back(NoiseSource(options.seed, set, i, y));
+
+	for (int x = 0; x < options.width; ++x)
+	{
+		const double px = (x + 0.5 - options.width * 0.5) * pixel;
+		cv::Vec3d premultiplied;
+		const double alpha = RenderObject(options, object, px, py, pixel, premultiplied);
+		const double vignette = 1 - options.vignette * (px * px + py * py) / halfDiagonal2;
+
+		//The object is lit by the room, so the exposure applies to it as it does to the screen.
+		premultiplied *= options.exposure;
+
+		for (int i = 0; i < colours; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				const double screen = options.exposure * vignette * (kScreenBlack + (1 - kScreenBlack) * options.screens[i][k]);
+				const double with = premultiplied[k] + (1 - alpha) * screen;
+				const double noiseWith = std::sqrt(options.noise * options.noise + options.shotNoise * std::max(0.0, with));
+				const double noiseWithout = std::sqrt(options.noise * options.noise + options.shotNoise * screen);
+				plates[i][x * 3 + k] = Quantise(with + noiseWith * noise[i].gaussian(), options.clip, sensorMax);
+				plates[colours + i][x * 3 + k] = Quantise(screen + noiseWithout * noise[colours + i].gaussian(),
+					options.clip, sensorMax);
+			}
+		}
+
+		if (!a)
+			continue;
+		for (int k = 0; k < 3; ++k)
+		{
+			a[x * 3 + k] = QuantiseReference(alpha);
+			f[x * 3 + k] = alpha > 0 ? QuantiseReference(premultiplied[k] / alpha) : 0;
+			af[x * 3 + k] = QuantiseReference(premultiplied[k]);
+		}
+	}
+}
+
+/** Quotes a path for a manifest line. */
+static std::string Quote(const std::string& path)
+{
+	return "\"" + path + "\"";
+}
+
+/**
+* Renders and writes capture set k.
+* @param manifest Receives the manifest line of the set, unless the plates are written as a bundle.
+* @return false upon failure, which is reported.
+* */
+static bool GenerateSet(const GeneratorOptions& options, const std::string& folder, int set, ThreadPool& pool,
+	std::string& manifest)
+{
+	const int colours = (int)options.screens.size();
+	const std::string prefix = "set" + ToString(set) + "_";
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> platePaths;
+	if (options.format == PlateFormat::Bundle)
+		platePaths.push_back(appendNameToPath("set" + ToString(set) + ".gtset", folder));
+	else
+	{
+		for (int i = 0; i < 2 * colours; ++i)
+			platePaths.push_back(appendNameToPath(prefix + (i < colours ? "fg" : "bg") + ToString(i % colours) + ".rawrgb", folder));
+		manifest.clear();
+		for (const std::string& path : platePaths)
+			manifest += Quote(path) + " ";
+		manifest += Quote(appendNameToPath(prefix + "A.png", folder)) + " " +
+			Quote(appendNameToPath(prefix + "F.png", folder)) + " " + Quote(appendNameToPath(prefix + "AF.png", folder));
+	}
+
+	PlateWriter plates;
+	if (!plates.open(options.format, platePaths, options.width, options.height, 2 * colours))
+	{
+		Error("Could not create the plates of set " + ToString(set) + " in " + folder);
+		return false;
+	}
+
+	const char* referenceNames[3] = { "refA.png", "refF.png", "refAF.png" };
+	PngWriter references[3];
+	if (options.references)
+		for (int i = 0; i < 3; ++i)
+			if (!references[i].open(appendNameToPath(prefix + referenceNames[i], folder), options.width, options.height, 3,
+				options.pngCompression))
+			{
+				Error("Could not create " + appendNameToPath(prefix + referenceNames[i], folder));
+				return false;
+			}
+
+	const SceneObject object = MakeObject(options, set);
+	const size_t rowSamples = (size_t)options.width * 3;
+	std::vector<std::vector<uint16_t> > band(2 * colours, std::vector<uint16_t>(options.bandRows * rowSamples));
+	cv::Mat reference[3];
+	if (options.references)
+		for (int i = 0; i < 3; ++i)
+			reference[i].create(options.bandRows, options.width, CV_16UC3);
+
+	for (int row = 0; row < options.height; row += options.bandRows)
+	{
+		const int rows = std::min(options.bandRows, options.height - row);
+		pool.run(rows, [&](int r) {
+			uint16_t* planes[2 * GG::kMaxColours];
+			for (int i = 0; i < 2 * colours; ++i)
+				planes[i] = &band[i][r * rowSamples];
+			if (options.references)
+				RenderRow(options, object, set, row + r, planes, reference[0].ptr<uint16_t>(r),
+					reference[1].ptr<uint16_t>(r), reference[2].ptr<uint16_t>(r));
+			else
+				RenderRow(options, object, set, row + r, planes, nullptr, nullptr, nullptr);
+		});
+
+		if (!plates.writeRows(band, rows, &pool))
+		{
+			Error("Could not write the plates of set " + ToString(set));
+			return false;
+		}
+		if (options.references)
+			for (int i = 0; i < 3; ++i)
+				if (!references[i].writeRows(reference[i].rowRange(0, rows), &pool))
+				{
+					Error("Could not write the reference of set " + ToString(set));
+					return false;
+				}
+	}
+
+	bool ok = plates.close();
+	if (options.references)
+		for (int i = 0; i < 3; ++i)
+			ok = references[i].close() && ok;
+	if (!ok)
+	{
+		Error("Could not finish the files of set " + ToString(set));
+		return false;
+	}
+
+	const double megapixels = (double)options.width * options.height / 1e6;
+	Inform("Set " + ToString(set) + ": " + ToString(2 * colours) + " plates of " + ToString(megapixels) +
+		" megapixels in " + ToString(SecondsSince(start)) + " s");
+	return true;
+}
+
+/**
+* Reads the screen colours from a list of #rrggbb colours.
+* @return false if a colour is malformed.
+* */
+static bool ParseScreens(const std::vector<std::string>& values, std::vector<cv::Vec3d>& screens)
+{
+	screens.clear();
+	for (const std::string& value : values)
+	{
+		cv::Vec3d screen;
+		if (!ParseScreen(value, screen))
+		{
+			Error("Invalid screen colour " + value + ", expected #rrggbb");
+			return false;
+		}
+		screens.push_back(screen);
+	}
+	return true;
+}
+
+/**
+* Separates the options from the positional arguments.
+* @return false if an option is unknown or malformed.
+* */
+static bool ParseArguments(const std::vector<std::string>& arguments, std::vector<std::string>& positional,
+	GeneratorOptions& options)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		const std::string& arg = arguments[i];
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			positional.push_back(arg);
+			continue;
+		}
+
+		if (i + 1 >= arguments.size())
+		{
+			Error("Missing value for " + arg);
+			return false;
+		}
+		const std::string& value = arguments[++i];
+		std::istringstream ss(value);
+
+		if (arg == "--size")
+		{
+			char x;
+			if (!(ss >> options.width >> x >> options.height) || x != 'x' || !ss.eof() ||
+				options.width <= 0 || options.height <= 0)
+			{
+				Error("Invalid size " + value + ", expected WxH");
+				return false;
+			}
+		}
+		else if (arg == "--screens")
+		{
+			std::vector<std::string> values;
+			std::string item;
+			while (std::getline(ss, item, ','))
+				values.push_back(item);
+			if (!ParseScreens(values, options.screens))
+				return false;
+		}
+		else if (arg == "--screens-file")
+		{
+			std::ifstream in(value);
+			if (in.fail())
+			{
+				Error("Could not open " + value);
+				return false;
+			}
+			std::vector<std::string> values;
+			std::string line;
+			while (std::getline(in, line))
+			{
+				line.erase(line.find_last_not_of(" \t\r") + 1);
+				if (!line.empty())
+					values.push_back(line);
+			}
+			if (!ParseScreens(values, options.screens))
+				return false;
+		}
+		else if (arg == "--format")
+		{
+			if (value == "v1")
+				options.format = PlateFormat::RawRgbV1;
+			else if (value == "v2")
+				options.format = PlateFormat::RawRgbV2;
+			else if (value == "bundle")
+				options.format = PlateFormat::Bundle;
+			else
+			{
+				Error("Invalid format " + value + ", expected v1, v2 or bundle");
+				return false;
+			}
+		}
+		else if (arg == "--references")
+		{
+			if (value == "png" || value == "none")
+				options.references = value == "png";
+			else
+			{
+				Error("Invalid references " + value + ", expected png or none");
+				return false;
+			}
+		}
+		else if (arg == "--sets" || arg == "--strands" || arg == "--bits" || arg == "--png-compression" ||
+			arg == "--band-rows")
+		{
+			int& count = arg == "--sets" ? options.sets : arg == "--strands" ? options.strands :
+				arg == "--bits" ? options.bits : arg == "--png-compression" ? options.pngCompression : options.bandRows;
+			const int minimum = arg == "--bits" ? 8 : arg == "--sets" || arg == "--band-rows" ? 1 : 0;
+			const int maximum = arg == "--bits" ? 16 : arg == "--png-compression" ? 9 : 1 << 30;
+			if (!(ss >> count) || !ss.eof() || count < minimum || count > maximum)
+			{
+				Error("Invalid value " + value + " for " + arg + ", expected " + ToString(minimum) + " to " + ToString(maximum));
+				return false;
+			}
+		}
+		else if (arg == "--threads" || arg == "--seed")
+		{
+			if (!(ss >> (arg == "--threads" ? options.threads : options.seed)) || !ss.eof())
+			{
+				Error("Invalid value " + value + " for " + arg);
+				return false;
+			}
+		}
+		else if (arg == "--alpha-min" || arg == "--edge" || arg == "--exposure" || arg == "--vignette" ||
+			arg == "--noise" || arg == "--shot-noise" || arg == "--clip")
+		{
+			double& level = arg == "--alpha-min" ? options.alphaMin : arg == "--edge" ? options.edge :
+				arg == "--exposure" ? options.exposure : arg == "--vignette" ? options.vignette :
+				arg == "--noise" ? options.noise : arg == "--shot-noise" ? options.shotNoise : options.clip;
+			const bool unit = arg == "--alpha-min" || arg == "--edge" || arg == "--vignette" || arg == "--clip";
+			if (!(ss >> level) || !ss.eof() || level < 0 || (unit && level > 1))
+			{
+				Error("Invalid value " + value + " for " + arg);
+				return false;
+			}
+		}
+		else
+		{
+			Error("Unknown option " + arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> args;
+	GeneratorOptions options;
+	if (!ParseArguments(std::vector<std::string>(argv + 1, argv + argc), args, options))
+		return 1;
+
+	if (args.size() != 1)
+	{
+		Error("Expected the output directory as the only argument");
+		return 1;
+	}
+	if (options.screens.empty())
+		ParseScreens({ "#0000ff", "#00ff00", "#ff0000" }, options.screens);
+	if ((int)options.screens.size() < GG::kMinColours || (int)options.screens.size() > GG::kMaxColours)
+	{
+		Error("Between " + ToString(GG::kMinColours) + " and " + ToString(GG::kMaxColours) + " screen colours are needed");
+		return 1;
+	}
+	if (options.edge <= 0)
+		options.edge = 1e-6;
+	options.bandRows = (options.bandRows + kCaptureBundleTileRows - 1) / kCaptureBundleTileRows * kCaptureBundleTileRows;
+
+	ThreadPool pool(options.threads);
+	std::ofstream manifest;
+	if (options.format != PlateFormat::Bundle)
+	{
+		const std::string manifestPath = appendNameToPath("manifest.txt", args[0]);
+		manifest.open(manifestPath, std::ios::out | std::ios::trunc);
+		if (manifest.fail())
+		{
+			Error("Could not create " + manifestPath);
+			return 1;
+		}
+	}
+
+	for (int set = 0; set < options.sets; ++set)
+	{
+		std::string line;
+		if (!GenerateSet(options, args[0], set, pool, line))
+			return 1;
+		if (manifest.is_open())
+			manifest << line << "\n";
+	}
+
+	if (manifest.is_open())
+	{
+		manifest.close();
+		if (manifest.fail())
+		{
+			Error("Could not write the manifest");
+			return 1;
+		}
+	}
+	return 0;
+}
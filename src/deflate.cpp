@@ -0,0 +1,494 @@
+#include "deflate.h"
+#include <algorithm>
+#include <cstring>
+
+//The farthest back a match may reach, and the shortest and longest matches.
+static const int kWindowSize = 32768;
+static const int kMinMatch = 3;
+static const int kMaxMatch = 258;
+
+//Entries in the table of recent positions by the hash of their first three bytes.
+static const int kHashBits = 15;
+
+//Symbols per block. Each block gets its own Huffman codes, so they follow changes in the data.
+static const size_t kBlockSymbols = 1 << 15;
+
+//Largest payload of a stored block.
+static const size_t kStoredBlockSize = 65535;
+
+//How many earlier positions with the same hash are tried at each level.
+static const int kMaxChain[10] = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+
+//Match lengths and distances: the first value of each code and the extra bits after it.
+static const int kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83,
+	99, 115, 131, 163, 195, 227, 258 };
+static const int kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int kDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 13, 13 };
+
+//The order in which the lengths of the code length codes are sent.
+static const int kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+//A match is stored as kMatchFlag | length << 16 | (distance - 1), a literal as its byte.
+static const uint32_t kMatchFlag = 0x80000000u;
+
+/** Returns the length code, less 257, of each match length. */
+static const uint8_t* LengthCodes()
+{
+	struct Table
+	{
+		uint8_t codes[kMaxMatch + 1];
+		Table()
+		{
+			for (int code = 0; code < 29; ++code)
+				for (int length = kLengthBase[code]; length < (code < 28 ? kLengthBase[code + 1] : kMaxMatch + 1); ++length)
+					codes[length] = (uint8_t)code;
+		}
+	};
+	static const Table table;
+	return table.codes;
+}
+
+/** Returns the distance code of a match distance. */
+static int DistanceCode(int distance)
+{
+	//Codes of distances up to 256, then of larger distances in steps of 128, which no code boundary splits.
+	struct Table
+	{
+		uint8_t codes[512];
+		Table()
+		{
+			for (int code = 0; code < 30; ++code)
+				for (int d = kDistanceBase[code]; d < (code < 29 ? kDistanceBase[code + 1] : kWindowSize + 1); ++d)
+					codes[d <= 256 ? d - 1 : 256 + ((d - 1) >> 7)] = (uint8_t)code;
+		}
+	};
+	static const Table table;
+	return table.codes[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+}
+
+/**
+* Writes bits least significant first, as deflate packs them.
+* */
+class BitWriter
+{
+	std::vector<unsigned char>& mOut;
+	uint64_t mBits = 0;
+	int mCount = 0;
+
+public:
+
+	explicit BitWriter(std::vector<unsigned char>& out) : mOut(out) {}
+
+	void put(uint32_t bits, int count)
+	{
+		mBits |= (uint64_t)bits << mCount;
+		mCount += count;
+		while (mCount >= 8)
+		{
+			mOut.push_back((unsigned char)mBits);
+			mBits >>= 8;
+			mCount -= 8;
+		}
+	}
+
+	/** Pads with zero bits to a byte boundary. */
+	void align()
+	{
+		if (mCount > 0)
+			put(0, 8 - mCount);
+	}
+
+	/** Appends bytes, which must start on a byte boundary. */
+	void bytes(const unsigned char* data, size_t size)
+	{
+		mOut.insert(mOut.end(), data, data + size);
+	}
+};
+
+/**
+* Computes Huffman code lengths of at most maxBits for count symbols of the given frequencies.
+* Unused symbols get length 0. At least two symbols must be used.
+* */
+static void HuffmanLengths(const uint32_t* frequencies, int count, int maxBits, uint8_t* lengths)
+{
+	std::vector<std::pair<uint32_t, int> > symbols;
+	for (int i = 0; i < count; ++i)
+	{
+		lengths[i] = 0;
+		if (frequencies[i])
+			symbols.push_back(std::make_pair(frequencies[i], i));
+	}
+	std::sort(symbols.begin(), symbols.end());
+
+	//Build the tree from two queues: the sorted leaves, and the inner nodes in the order they are made,
+	//which is also sorted. Nodes below n are leaves.
+	const int n = (int)symbols.size();
+	std::vector<uint64_t> weights(2 * n - 1);
+	std::vector<int> parents(2 * n - 1);
+	for (int i = 0; i < n; ++i)
+		weights[i] = symbols[i].first;
+
+	int leaf = 0, inner = n;
+	for (int node = n; node < 2 * n - 1; ++node)
+	{
+		int pick[2];
+		for (int k = 0; k < 2; ++k)
+			pick[k] = leaf < n && (inner == node || weights[leaf] <= weights[inner]) ? leaf++ : inner++;
+		weights[node] = weights[pick[0]] + weights[pick[1]];
+		parents[pick[0]] = parents[pick[1]] = node;
+	}
+
+	//Depths from the root down, counting how many leaves end at each depth, the deepest clamped to maxBits.
+	std::vector<int> depths(2 * n - 1, 0);
+	int lengthCounts[16] = {};
+	for (int node = 2 * n - 3; node >= 0; --node)
+	{
+		depths[node] = depths[parents[node]] + 1;
+		if (node < n)
+			++lengthCounts[std::min(depths[node], maxBits)];
+	}
+
+	//Clamping oversubscribes the code; lengthen shorter codes until it fits again.
+	uint32_t total = 0;
+	for (int bits = 1; bits <= maxBits; ++bits)
+		total += (uint32_t)lengthCounts[bits] << (maxBits - bits);
+	while (total > (1u << maxBits))
+	{
+		--lengthCounts[maxBits];
+		for (int bits = maxBits - 1; bits > 0; --bits)
+			if (lengthCounts[bits])
+			{
+				--lengthCounts[bits];
+				lengthCounts[bits + 1] += 2;
+				break;
+			}
+		--total;
+	}
+
+	//The rarest symbols get the longest codes.
+	int next = 0;
+	for (int bits = maxBits; bits > 0; --bits)
+		for (int i = 0; i < lengthCounts[bits]; ++i)
+			lengths[symbols[next++].second] = (uint8_t)bits;
+}
+
+/** Computes the canonical codes for code lengths, bit reversed as deflate sends them. */
+static void HuffmanCodes(const uint8_t* lengths, int count, uint16_t* codes)
+{
+	int lengthCounts[16] = {};
+	for (int i = 0; i < count; ++i)
+		++lengthCounts[lengths[i]];
+	lengthCounts[0] = 0;
+
+	int next[16] = {};
+	for (int bits = 1, code = 0; bits < 16; ++bits)
+	{
+		code = (code + lengthCounts[bits - 1]) << 1;
+		next[bits] = code;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		const int bits = lengths[i];
+		if (!bits)
+			continue;
+		const int code = next[bits]++;
+		int reversed = 0;
+		for (int b = 0; b < bits; ++b)
+			reversed |= ((code >> b) & 1) << (bits - 1 - b);
+		codes[i] = (uint16_t)reversed;
+	}
+}
+
+/** Makes sure at least two symbols are used, as HuffmanLengths needs, without changing used ones. */
+static void UseTwoSymbols(uint32_t* frequencies, int count)
+{
+	int used = 0;
+	for (int i = 0; i < count; ++i)
+		used += frequencies[i] != 0;
+	for (int i = 0; i < count && used < 2; ++i)
+		if (!frequencies[i])
+		{
+			frequencies[i] = 1;
+			++used;
+		}
+}
+
+/** Writes data as stored blocks. */
+static void WriteStored(BitWriter& writer, const unsigned char* data, size_t size)
+{
+	for (size_t i = 0; i < size; i += kStoredBlockSize)
+	{
+		const size_t length = std::min(kStoredBlockSize, size - i);
+		writer.put(0, 3);
+		writer.align();
+		const unsigned char header[4] = { (unsigned char)length, (unsigned char)(length >> 8),
+			(unsigned char)~length, (unsigned char)(~length >> 8) };
+		writer.bytes(header, 4);
+		writer.bytes(data + i, length);
+	}
+}
+
+/**
+* Writes symbols as a block with its own Huffman codes, or the bytes they stand for as stored blocks if
+* that is smaller.
+* */
+static void WriteBlock(BitWriter& writer, const uint32_t* symbols, size_t count, const unsigned char* data, size_t size)
+{
+	const uint8_t* lengthCodes = LengthCodes();
+
+	uint32_t literalFrequencies[286] = {};
+	uint32_t distanceFrequencies[30] = {};
+	for (size_t i = 0; i < count; ++i)
+		if (symbols[i] & kMatchFlag)
+		{
+			++literalFrequencies[257 + lengthCodes[(symbols[i] >> 16) & 0x1ff]];
+			++distanceFrequencies[DistanceCode((symbols[i] & 0xffff) + 1)];
+		}
+		else
+			++literalFrequencies[symbols[i]];
+	literalFrequencies[256] = 1;
+	UseTwoSymbols(distanceFrequencies, 30);
+
+	uint8_t lengths[286 + 30];
+	uint8_t* literalLengths = lengths;
+	uint8_t* distanceLengths = lengths + 286;
+	HuffmanLengths(literalFrequencies, 286, 15, literalLengths);
+	HuffmanLengths(distanceFrequencies, 30, 15, distanceLengths);
+
+	int literalCount = 286;
+	while (literalCount > 257 && !literalLengths[literalCount - 1])
+		--literalCount;
+	int distanceCount = 30;
+	while (distanceCount > 1 && !distanceLengths[distanceCount - 1])
+		--distanceCount;
+
+	//The code lengths, sent back to back and run length coded: 16 repeats the last length 3 to 6 times,
+	//17 and 18 give 3 to 10 and 11 to 138 zeros. The extra bits are kept above bit 8.
+	uint8_t sequence[286 + 30];
+	memcpy(sequence, literalLengths, literalCount);
+	memcpy(sequence + literalCount, distanceLengths, distanceCount);
+	const int sequenceLength = literalCount + distanceCount;
+
+	std::vector<uint32_t> runs;
+	uint32_t codeLengthFrequencies[19] = {};
+	for (int i = 0; i < sequenceLength;)
+	{
+		int run = 1;
+		while (i + run < sequenceLength && sequence[i + run] == sequence[i])
+			++run;
+
+		if (sequence[i] == 0 && run >= 3)
+		{
+			run = std::min(run, 138);
+			runs.push_back(run >= 11 ? 18 | (run - 11) << 8 : 17 | (run - 3) << 8);
+		}
+		else if (sequence[i] != 0 && run >= 4)
+		{
+			run = std::min(run - 1, 6) + 1;
+			runs.push_back(sequence[i]);
+			runs.push_back(16 | (run - 4) << 8);
+		}
+		else
+		{
+			run = 1;
+			runs.push_back(sequence[i]);
+		}
+		i += run;
+	}
+	for (size_t i = 0; i < runs.size(); ++i)
+		++codeLengthFrequencies[runs[i] & 0xff];
+	UseTwoSymbols(codeLengthFrequencies, 19);
+
+	uint8_t codeLengthLengths[19];
+	HuffmanLengths(codeLengthFrequencies, 19, 7, codeLengthLengths);
+	int codeLengthCount = 19;
+	while (codeLengthCount > 4 && !codeLengthLengths[kCodeLengthOrder[codeLengthCount - 1]])
+		--codeLengthCount;
+
+	//Compare the size of the block with storing the bytes, counting five bytes of header per stored block.
+	uint64_t bits = 3 + 5 + 5 + 4 + 3 * codeLengthCount;
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		const uint32_t symbol = runs[i] & 0xff;
+		bits += codeLengthLengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+	}
+	for (int i = 0; i < 286; ++i)
+		bits += (uint64_t)literalFrequencies[i] * (literalLengths[i] + (i > 256 ? kLengthExtra[i - 257] : 0));
+	for (int i = 0; i < 30; ++i)
+		bits += (uint64_t)distanceFrequencies[i] * (distanceLengths[i] + kDistanceExtra[i]);
+	const uint64_t storedBits = (uint64_t)size * 8 + ((size + kStoredBlockSize - 1) / kStoredBlockSize) * 40;
+	if (bits >= storedBits)
+	{
+		WriteStored(writer, data, size);
+		return;
+	}
+
+	uint16_t literalCodes[286];
+	uint16_t distanceCodes[30];
+	uint16_t codeLengthCodes[19];
+	HuffmanCodes(literalLengths, 286, literalCodes);
+	HuffmanCodes(distanceLengths, 30, distanceCodes);
+	HuffmanCodes(codeLengthLengths, 19, codeLengthCodes);
+
+	//Header: not final, dynamic codes, then the code lengths.
+	writer.put(0, 1);
+	writer.put(2, 2);
+	writer.put(literalCount - 257, 5);
+	writer.put(distanceCount - 1, 5);
+	writer.put(codeLengthCount - 4, 4);
+	for (int i = 0; i < codeLengthCount; ++i)
+		writer.put(codeLengthLengths[kCodeLengthOrder[i]], 3);
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		const uint32_t symbol = runs[i] & 0xff;
+		writer.put(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+		if (symbol >= 16)
+			writer.put(runs[i] >> 8, symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t symbol = symbols[i];
+		if (symbol & kMatchFlag)
+		{
+			const int length = (symbol >> 16) & 0x1ff;
+			const int distance = (symbol & 0xffff) + 1;
+			const int lengthCode = lengthCodes[length];
+			const int distanceCode = DistanceCode(distance);
+			writer.put(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+			writer.put(length - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+			writer.put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+			writer.put(distance - kDistanceBase[distanceCode], kDistanceExtra[distanceCode]);
+		}
+		else
+			writer.put(literalCodes[symbol], literalLengths[symbol]);
+	}
+	writer.put(literalCodes[256], literalLengths[256]);
+}
+
+void DeflateBlocks(const unsigned char* data, size_t size, int level, std::vector<unsigned char>& out)
+{
+	BitWriter writer(out);
+	level = std::max(0, std::min(level, 9));
+	if (level == 0)
+	{
+		WriteStored(writer, data, size);
+		return;
+	}
+
+	//Greedy matching against the most recent positions sharing the hash of the next three bytes.
+	const int maxChain = kMaxChain[level];
+	std::vector<int32_t> head(1 << kHashBits, -1);
+	std::vector<int32_t> previous(size);
+	auto hash = [data](size_t i) {
+		const uint32_t bytes = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+		return (bytes * 2654435761u) >> (32 - kHashBits);
+	};
+	auto insert = [&](size_t i) {
+		const uint32_t h = hash(i);
+		previous[i] = head[h];
+		head[h] = (int32_t)i;
+	};
+
+	std::vector<uint32_t> symbols;
+	symbols.reserve(kBlockSymbols);
+	size_t blockStart = 0;
+	for (size_t i = 0; i < size;)
+	{
+		int best = 0;
+		int bestDistance = 0;
+		if (i + kMinMatch <= size)
+		{
+			const int limit = (int)std::min<size_t>(kMaxMatch, size - i);
+			int chain = maxChain;
+			for (int32_t candidate = head[hash(i)]; candidate >= 0 && (int)(i - candidate) <= kWindowSize && chain-- > 0;
+				candidate = previous[candidate])
+			{
+				const unsigned char* a = data + candidate;
+				const unsigned char* b = data + i;
+				if (a[best] != b[best])
+					continue;
+				int length = 0;
+				while (length < limit && a[length] == b[length])
+					++length;
+				if (length > best)
+				{
+					best = length;
+					bestDistance = (int)(i - candidate);
+					if (best == limit)
+						break;
+				}
+			}
+			insert(i);
+		}
+
+		if (best >= kMinMatch)
+		{
+			symbols.push_back(kMatchFlag | (uint32_t)best << 16 | (uint32_t)(bestDistance - 1));
+			for (size_t j = i + 1; j < i + best && j + kMinMatch <= size; ++j)
+				insert(j);
+			i += best;
+		}
+		else
+		{
+			symbols.push_back(data[i]);
+			++i;
+		}
+
+		if (symbols.size() == kBlockSymbols || i == size)
+		{
+			WriteBlock(writer, symbols.data(), symbols.size(), data + blockStart, i - blockStart);
+			symbols.clear();
+			blockStart = i;
+		}
+	}
+
+	//An empty stored block brings the stream to a byte boundary, as zlib's sync flush does.
+	writer.put(0, 3);
+	writer.align();
+	const unsigned char empty[4] = { 0, 0, 0xff, 0xff };
+	writer.bytes(empty, 4);
+}
+
+uint32_t Adler32(const unsigned char* data, size_t size, uint32_t adler)
+{
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+
+	//Reduced often enough not to overflow.
+	for (size_t i = 0; i < size;)
+	{
+		const size_t end = std::min(size, i + 5552);
+		for (; i < end; ++i)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondSize)
+{
+	static const uint32_t kBase = 65521;
+	const uint32_t remainder = (uint32_t)(secondSize % kBase);
+	uint32_t a = first & 0xffff;
+	uint32_t b = (uint32_t)(((uint64_t)remainder * a) % kBase);
+	a += (second & 0xffff) + kBase - 1;
+	b += (first >> 16) + (second >> 16) + kBase - remainder;
+	if (a >= kBase)
+		a -= kBase;
+	if (a >= kBase)
+		a -= kBase;
+	if (b >= kBase << 1)
+		b -= kBase << 1;
+	if (b >= kBase)
+		b -= kBase;
+	return b << 16 | a;
+}
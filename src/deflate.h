@@ -0,0 +1,19 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+* Compresses data into deflate blocks (RFC 1951) appended to out, so that PNG files can be compressed
+* without a zlib dependency. None of the blocks is final, and the output ends on a byte boundary, so the
+* outputs of consecutive calls join into one stream; the caller ends the stream with a final block.
+* Matches never reach back before data, so calls are independent and may run in parallel.
+* @param level 0 stores the data uncompressed. 1 to 9 search for matches ever harder, trading speed for size.
+* */
+void DeflateBlocks(const unsigned char* data, size_t size, int level, std::vector<unsigned char>& out);
+
+/** Returns the Adler-32 checksum of size bytes, continuing from adler. */
+uint32_t Adler32(const unsigned char* data, size_t size, uint32_t adler = 1);
+
+/** Returns the Adler-32 checksum of two byte ranges given the checksum of each and the size of the second. */
+uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondSize);
@@ -0,0 +1,136 @@
+#include "floatimage.h"
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "io.h"
+
+//The alignment of the data of a .npy file required by the format.
+static const size_t kNpyAlignment = 64;
+
+/** Returns whether path ends in extension, ignoring case. */
+static bool HasExtension(const std::string& path, const std::string& extension)
+{
+	if (path.size() < extension.size())
+		return false;
+	for (size_t i = 0; i < extension.size(); ++i)
+		if (tolower((unsigned char)path[path.size() - extension.size() + i]) != extension[i])
+			return false;
+	return true;
+}
+
+/** Copies channel k of a row of an OpenCV image into out, so that planes or RGB order can be written. */
+static void CopyChannel(const float* row, int width, int channels, int k, float* out)
+{
+	for (int x = 0; x < width; ++x)
+		out[x] = row[x * channels + k];
+}
+
+/** Replaces values that are not finite, as F is where alpha is 0, with 0, as the 16 bit outputs have there. */
+static void ZeroNonFinite(float* values, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		if (!std::isfinite(values[i]))
+			values[i] = 0;
+}
+
+bool IsFloatImagePath(const std::string& path)
+{
+	return HasExtension(path, ".npy") || HasExtension(path, ".rawf");
+}
+
+/** Writes the rows of the image as interleaved RGB values after a .npy header. */
+static void WriteNpy(std::ofstream& out, const cv::Mat& image)
+{
+	const int channels = image.channels();
+	std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + ToString(image.rows) + ", " +
+		ToString(image.cols) + (channels == 1 ? "" : ", " + ToString(channels)) + "), }";
+
+	//The magic, version and header length take 10 bytes, and the header ends in a newline.
+	const size_t unpadded = 10 + header.size() + 1;
+	header.append((kNpyAlignment - unpadded % kNpyAlignment) % kNpyAlignment, ' ');
+	header += '\n';
+
+	const unsigned char preamble[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+		(unsigned char)header.size(), (unsigned char)(header.size() >> 8) };
+	out.write((const char*)preamble, sizeof(preamble));
+	out.write(header.data(), header.size());
+
+	std::vector<float> row((size_t)image.cols * channels);
+	for (int y = 0; y < image.rows; ++y)
+	{
+		const float* in = image.ptr<float>(y);
+		if (channels == 1)
+			memcpy(&row[0], in, row.size() * sizeof(float));
+		else
+			for (int x = 0; x < image.cols; ++x)
+				for (int k = 0; k < 3; ++k)
+					row[x * 3 + k] = in[x * 3 + 2 - k];
+		ZeroNonFinite(&row[0], row.size());
+		out.write((const char*)&row[0], row.size() * sizeof(float));
+	}
+}
+
+/** Writes the channels of the image as planes after a .rawf header. */
+static void WriteRawFloat(std::ofstream& out, const cv::Mat& image)
+{
+	const int channels = image.channels();
+	const uint64_t planeBytes = (uint64_t)image.cols * image.rows * sizeof(float);
+
+	RawFloatHeader header = RawFloatHeader();
+	memcpy(header.magic, kRawFloatMagic, sizeof(kRawFloatMagic));
+	header.version = kRawFloatVersion;
+	header.width = image.cols;
+	header.height = image.rows;
+	header.channels = channels;
+	header.dataOffset = kRawFloatAlignment;
+	header.planeStride = (planeBytes + kRawFloatAlignment - 1) / kRawFloatAlignment * kRawFloatAlignment;
+
+	std::vector<char> padding(kRawFloatAlignment, 0);
+	out.write((const char*)&header, sizeof(header));
+	out.write(&padding[0], kRawFloatAlignment - sizeof(header));
+
+	//Planes are written in RGB order, from channels 2, 1, 0 of the BGR image.
+	std::vector<float> row(image.cols);
+	for (int plane = 0; plane < channels; ++plane)
+	{
+		for (int y = 0; y < image.rows; ++y)
+		{
+			CopyChannel(image.ptr<float>(y), image.cols, channels, channels - 1 - plane, &row[0]);
+			ZeroNonFinite(&row[0], row.size());
+			out.write((const char*)&row[0], row.size() * sizeof(float));
+		}
+		out.write(&padding[0], (std::streamsize)(header.planeStride - planeBytes));
+	}
+}
+
+bool SaveFloatImage(const std::string& path, const cv::Mat& image)
+{
+	if (image.depth() != CV_32F || (image.channels() != 1 && image.channels() != 3))
+	{
+		Error("Float images must have 1 or 3 float32 channels: " + path);
+		return false;
+	}
+
+	std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (out.fail())
+	{
+		Error("Could not create " + path);
+		return false;
+	}
+
+	if (HasExtension(path, ".npy"))
+		WriteNpy(out, image);
+	else
+		WriteRawFloat(out, image);
+
+	out.close();
+	if (out.fail())
+	{
+		Error("Could not write " + path);
+		return false;
+	}
+	return true;
+}
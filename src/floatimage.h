@@ -0,0 +1,51 @@
+#pragma once
+/** Saves float32 images in forms that other tools can map into memory and use as they lie, without
+ * decoding them or losing precision to 16 bit quantisation. The format follows from the extension:
+ *
+ * .npy  A NumPy array file (format version 1.0) of little endian float32 values, of shape (height, width)
+ *       for one channel or (height, width, 3) in RGB order, in row major order. The header is padded so
+ *       that the data starts on a multiple of 64 bytes, so numpy.load(path, mmap_mode='r') maps it.
+ * .rawf A planar file: a RawFloatHeader padded to kRawFloatAlignment bytes, followed by one plane per
+ *       channel (R, G, B for colour) of height rows of width float32 values. Every plane starts on a
+ *       multiple of kRawFloatAlignment bytes, so each can be mapped on its own, and occupies planeStride
+ *       bytes including its padding.
+ *
+ * Both hold the values as the solver produced them, nominally in [0;1] but neither clamped nor quantised,
+ * except that values that are not finite are written as 0.
+ * */
+
+#include <string>
+#include <stdint.h>
+
+namespace cv { class Mat; }
+
+static const char kRawFloatMagic[4] = { 'R', 'F', 'L', 'T' };
+static const int kRawFloatVersion = 1;
+
+//The alignment of the planes of a .rawf file, that of a memory page on every platform we run on.
+static const int kRawFloatAlignment = 4096;
+
+/** The start of a .rawf file. */
+struct RawFloatHeader
+{
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int channels;
+	int reserved;
+
+	//The offset of the first plane, and the distance between planes, in bytes.
+	uint64_t dataOffset;
+	uint64_t planeStride;
+};
+
+/** Returns whether a path names a .npy or .rawf file, which SaveFloatImage writes. */
+bool IsFloatImagePath(const std::string& path);
+
+/**
+* Saves an image as a .npy or .rawf file, depending on the extension of path.
+* @param image A CV_32FC1 or CV_32FC3 (BGR, as used by OpenCV) image.
+* @return false upon failure, which is reported.
+* */
+bool SaveFloatImage(const std::string& path, const cv::Mat& image);
@@ -1,63 +1,876 @@
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <chrono>
 #include <opencv2\opencv.hpp>
 #include "rawrgbchar.h"
 #include "io.h"
 #include "groundtruth.h"
+#include "pngwriter.h"
+#include "backgroundcache.h"
+#include "objectbounds.h"
+#include "capturebundle.h"
+#include "trace.h"
 
-std::vector<cv::Mat> GenerateGroundTruth (RawRgbChar* foreground, RawRgbChar* background)
+/** Prints how many pixels were refined or classified as background, where those options are enabled. */
+static void ReportSolve(const GG::SolveStats& stats, const GroundTruthOptions& options)
+{
+	const double pixels = (double)std::max(1LL, stats.pixels);
+
+	if (options.solver.precision == GG::Precision::Mixed)
+		Inform("Refined " + ToString(stats.refined) + " of " + ToString(stats.pixels) + " pixels (" +
+			ToString(100.0 * stats.refined / pixels) + "%) in double precision");
+
+	if (options.solver.backgroundNoise > 0)
+		Inform("Classified " + ToString(100.0 * stats.background / pixels) + "% of pixels as background, " +
+			"skipping the solve for " + ToString(100.0 * stats.skipped / pixels) + "%");
+}
+
+bool ReportQuality(const GG::SolveStats& stats, const GroundTruthOptions& options)
+{
+	const double pixels = (double)std::max(1LL, stats.pixels);
+	const double badResidual = stats.badResidual / pixels;
+	const double illConditioned = stats.illConditioned / pixels;
+
+	if (options.qualityMaps)
+		Inform("Residual: mean " + ToString(stats.residualSum / pixels) + ", max " + ToString(stats.residualMax) +
+			", " + ToString(100.0 * badResidual) + "% above " + ToString(options.solver.residualLimit));
+	Inform("Conditioning: " + ToString(100.0 * illConditioned) + "% below " +
+		ToString(options.solver.conditioningLimit));
+
+	if (std::max(badResidual, illConditioned) > options.rejectAbove)
+	{
+		::Error("Rejecting capture: more than " + ToString(100.0 * options.rejectAbove) + "% of pixels are bad");
+		return false;
+	}
+	return true;
+}
+
+//Pixels kept around the object when the region is found automatically, so that soft edges and blur
+//around it are still solved.
+static const int kAutoRoiMargin = 16;
+
+/**
+* Works out which region of the inputs to solve and where it goes in the outputs, from options.roi and
+* options.frame. The region is narrowed further by options.autoRoi once the images are read.
+* @param size The size of the inputs.
+* @param region Receives the region of the inputs to solve.
+* @param canvas Receives the size of the outputs.
+* @param offset Receives the position of the inputs in the outputs.
+* @return false if the region is empty or the inputs do not fit in the frame.
+* */
+static bool PlaceRegion(cv::Size size, const GroundTruthOptions& options, cv::Rect& region, cv::Size& canvas,
+	cv::Point& offset)
+{
+	region = cv::Rect(cv::Point(), size);
+	if (options.roi.area() > 0)
+		region &= options.roi;
+	if (region.area() == 0)
+	{
+		::Error("The region of interest lies outside the " + ToString(size.width) + "x" + ToString(size.height) + " image");
+		return false;
+	}
+
+	canvas = size;
+	offset = cv::Point();
+	if (options.frame.area() > 0)
+	{
+		if (options.frame.x < 0 || options.frame.y < 0 || options.frame.x + size.width > options.frame.width ||
+			options.frame.y + size.height > options.frame.height)
+		{
+			::Error("The " + ToString(size.width) + "x" + ToString(size.height) + " images do not fit in the frame");
+			return false;
+		}
+		canvas = options.frame.size();
+		offset = options.frame.tl();
+	}
+
+	return true;
+}
+
+/** Reports the region being solved if it is not the whole output. */
+static void ReportRegion(const cv::Rect& target, cv::Size canvas)
+{
+	if (target.size() != canvas)
+		Inform("Solving " + ToString(target.width) + "x" + ToString(target.height) + " pixels at " +
+			ToString(target.x) + "," + ToString(target.y) + " of the " + ToString(canvas.width) + "x" +
+			ToString(canvas.height) + " image");
+}
+
+//The side of the tiles that the full solve classifies from the preview, in pixels.
+static const int kPreviewTileSize = 64;
+
+/**
+* Shrinks a CV_16UC3 image by scale in each direction, averaging every scale by scale block of pixels.
+* Pixels past the last whole block are dropped, unless the image is smaller than a block.
+* */
+static void ShrinkImage(const cv::Mat& image, int scale, cv::Mat& out, ThreadPool* pool)
+{
+	out.create(std::max(1, image.rows / scale), std::max(1, image.cols / scale), CV_16UC3);
+	pool->run(out.rows, [&](int y) {
+		const int rows = std::min(scale, image.rows - y * scale);
+		const int cols = std::min(scale, image.cols);
+		uint16_t* po = (uint16_t*)(out.data + y*out.step);
+		for (int x = 0; x < out.cols; ++x)
+		{
+			uint32_t sums[3] = {};
+			for (int i = 0; i < rows; ++i)
+			{
+				const uint16_t* pi = (const uint16_t*)(image.data + (y * scale + i)*image.step) + x * scale * 3;
+				for (int j = 0; j < cols * 3; ++j)
+					sums[j % 3] += pi[j];
+			}
+			const uint32_t count = (uint32_t)(rows * cols);
+			for (int k = 0; k < 3; ++k)
+				po[x * 3 + k] = (uint16_t)((sums[k] + count / 2) / count);
+		}
+	});
+}
+
+/** Returns the alpha-premultiplied foreground over mid grey, for the preview (see GroundTruthOptions::onPreview). */
+static cv::Mat CompositePreview(const cv::Mat& a, const cv::Mat& af)
+{
+	cv::Mat preview(a.rows, a.cols, CV_16UC3);
+	for (int y = 0; y < a.rows; ++y)
+	{
+		const float* pa = (const float*)(a.data + y*a.step);
+		const float* paf = (const float*)(af.data + y*af.step);
+		uint16_t* pp = (uint16_t*)(preview.data + y*preview.step);
+		for (int x = 0; x < a.cols; ++x)
+			for (int k = 0; k < 3; ++k)
+			{
+				const double value = paf[x * 3 + k] + (1.0 - pa[x * a.channels()]) * 0.5;
+				pp[x * 3 + k] = (uint16_t)(std::min(std::max(value, 0.0), 1.0) * 65535 + 0.5);
+			}
+	}
+	return preview;
+}
+
+/**
+* Returns the tiles of a region that the full solve needs, given the alpha of its preview: those where the
+* preview alpha somewhere in or next to the tile exceeds threshold, or could not be solved. The solver
+* leaves alpha at 0 where the backdrops are too alike to solve, so those pixels are told by a conditioning
+* of 0 instead.
+* @param alpha The CV_32FC1 preview alpha, solved at 1/scale of the resolution.
+* @param conditioning The CV_32FC1 conditioning map of the preview.
+* @param size The size of the region.
+* */
+static std::vector<cv::Rect> PreviewTiles(const cv::Mat& alpha, const cv::Mat& conditioning, int scale, cv::Size size,
+	double threshold)
+{
+	std::vector<cv::Rect> tiles;
+	for (int y = 0; y < size.height; y += kPreviewTileSize)
+		for (int x = 0; x < size.width; x += kPreviewTileSize)
+		{
+			const cv::Rect tile = cv::Rect(x, y, kPreviewTileSize, kPreviewTileSize) & cv::Rect(0, 0, size.width, size.height);
+
+			//The preview pixels over the tile and one more on every side, since a preview pixel averages
+			//away the edge of an object that only just reaches into the tile.
+			const int left = tile.x / scale - 1;
+			const int top = tile.y / scale - 1;
+			const cv::Rect covered = cv::Rect(left, top, (tile.x + tile.width - 1) / scale + 2 - left,
+				(tile.y + tile.height - 1) / scale + 2 - top) & cv::Rect(0, 0, alpha.cols, alpha.rows);
+
+			bool needed = false;
+			for (int i = covered.y; i < covered.y + covered.height && !needed; ++i)
+			{
+				const float* pa = (const float*)(alpha.data + i*alpha.step);
+				const float* pc = (const float*)(conditioning.data + i*conditioning.step);
+				for (int j = covered.x; j < covered.x + covered.width && !needed; ++j)
+					needed = !(pa[j] <= threshold) || !(pc[j] > 0);
+			}
+			if (needed)
+				tiles.push_back(tile);
+		}
+	return tiles;
+}
+
+/**
+* Solves a region at 1/options.previewScale of its resolution, handing the result to options.onPreview.
+* @param foreground The colours images with each backdrop, cropped to the region.
+* @param background The colours images of each backdrop, cropped to the region.
+* @param tiles With options.previewSkipBelow, receives the tiles of the region that the full solve needs.
+* */
+static void SolvePreview(const std::vector<cv::Mat>& foreground, const std::vector<cv::Mat>& background,
+	int colours, const GroundTruthOptions& options, ThreadPool* pool, std::vector<cv::Rect>& tiles)
+{
+	using namespace cv;
+	TraceSpan span("preview");
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<Mat> small(2 * colours);
+	for (int i = 0; i < 2 * colours; ++i)
+		ShrinkImage(i < colours ? foreground[i] : background[i - colours], options.previewScale, small[i], pool);
+
+	Mat f(small[0].size(), CV_32FC3);
+	Mat af(small[0].size(), CV_32FC3);
+	Mat conditioning;
+	Mat a = GG::groundTruthAlpha2(&small[0], &small[colours], colours, f, af, pool, options.solver, nullptr, 1,
+		nullptr, options.previewSkipBelow > 0 ? &conditioning : nullptr);
+	Inform("Solved a " + ToString(a.cols) + "x" + ToString(a.rows) + " preview in " +
+		ToString(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()) + " s");
+
+	if (options.onPreview)
+	{
+		TraceSpan save("save preview");
+		options.onPreview(CompositePreview(a, af));
+	}
+
+	if (options.previewSkipBelow > 0)
+	{
+		const Size size = foreground[0].size();
+		tiles = PreviewTiles(a, conditioning, options.previewScale, size, options.previewSkipBelow);
+		const int total = ((size.width + kPreviewTileSize - 1) / kPreviewTileSize) *
+			((size.height + kPreviewTileSize - 1) / kPreviewTileSize);
+		Inform("The preview leaves " + ToString(tiles.size()) + " of " + ToString(total) + " tiles to solve");
+	}
+}
+
+/**
+* Solves the given tiles of a region in parallel, leaving the outputs elsewhere as they are.
+* @param foreground The colours images with each backdrop, cropped to the region.
+* @param background The colours images of each backdrop, cropped to the region.
+* @param f Receives the foreground of the tiles. Allocated as for GG::groundTruthAlpha2.
+* @param af Receives the alpha-premultiplied foreground of the tiles.
+* @param stats Receives counts for the tiles.
+* @param residual, conditioning If given, receive the quality maps of the region, 0 outside the tiles.
+* @return The alpha of the region, 0 outside the tiles.
+* */
+static cv::Mat SolveTiles(const std::vector<cv::Mat>& foreground, const std::vector<cv::Mat>& background,
+	int colours, cv::Mat& f, cv::Mat& af, const std::vector<cv::Rect>& tiles, const GroundTruthOptions& options,
+	ThreadPool* pool, GG::SolveStats& stats, cv::Mat* residual, cv::Mat* conditioning)
 {
-	//Prepare and wrap in Mat:
-	Inform("Preparing ground truth");
 	using namespace cv;
+	const Size size = foreground[0].size();
+	Mat a = Mat::zeros(size, CV_MAKETYPE(f.depth(), options.alphaChannels));
+	if (residual)
+	{
+		*residual = Mat::zeros(size, CV_32FC1);
+		*conditioning = Mat::zeros(size, CV_32FC1);
+	}
 
-	Mat matCharF[5];
-	Mat matCharB[5];
+	//Pixels are independent, so each tile is solved exactly as it would be as part of the whole region.
+	std::vector<GG::SolveStats> tileStats(tiles.size());
+	pool->run((int)tiles.size(), [&](int t) {
+		const Rect& tile = tiles[t];
+		std::vector<Mat> inputs(2 * colours);
+		for (int i = 0; i < colours; ++i)
+		{
+			inputs[i] = foreground[i](tile);
+			inputs[colours + i] = background[i](tile);
+		}
+		Mat fTile = f(tile);
+		Mat afTile = af(tile);
+		Mat tileResidual;
+		Mat tileConditioning;
+		GG::groundTruthAlpha2(&inputs[0], &inputs[colours], colours, fTile, afTile, nullptr, options.solver,
+			&tileStats[t], options.alphaChannels, residual ? &tileResidual : nullptr,
+			residual ? &tileConditioning : nullptr).copyTo(a(tile));
+		if (residual)
+		{
+			tileResidual.copyTo((*residual)(tile));
+			tileConditioning.copyTo((*conditioning)(tile));
+		}
+	});
+
+	stats = GG::SolveStats();
+	for (size_t t = 0; t < tiles.size(); ++t)
+		stats += tileStats[t];
+	return a;
+}
+
+std::vector<cv::Mat> GenerateGroundTruth (RawRgbChar* foreground, RawRgbChar* background, int colours,
+	const GroundTruthOptions& options, ThreadPool* pool)
+{
+	//Wrap in Mat:
+	using namespace cv;
+
+	std::vector<Mat> matCharF(colours);
+	std::vector<Mat> matCharB(colours);
 
 	size_t imageLen = std::get<2>(foreground[0]).size();
 
-	for (int i = 0; i < 5; ++i)
+	for (int i = 0; i < colours; ++i)
 	{
+		if (imageLen != std::get<2>(foreground[i]).size() || imageLen != std::get<2>(background[i]).size())
+		{
+			::Error("Mismatched image sizes in ground truth");
+			return{};
+		}
+
 		matCharF[i] = Mat(std::get<1>(foreground[i]), std::get<0>(foreground[i]), CV_16UC3, &std::get<2>(foreground[i])[0]);
 		matCharB[i] = Mat(std::get<1>(background[i]), std::get<0>(background[i]), CV_16UC3, &std::get<2>(background[i])[0]);
+	}
 
-		if (imageLen != std::get<2>(foreground[i]).size() || imageLen != std::get<2>(background[i]).size())
+	std::vector<Mat> groundTruth = GenerateGroundTruth(&matCharF[0], &matCharB[0], colours, options, pool);
+
+	for (int i = 0; i < colours; ++i)
+	{
+		std::get<2>(foreground[i]).swap(std::vector<uint16_t>());
+		std::get<2>(background[i]).swap(std::vector<uint16_t>());
+	}
+
+	return groundTruth;
+}
+
+std::vector<cv::Mat> GenerateGroundTruth(const cv::Mat* foreground, const cv::Mat* background, int colours,
+	const GroundTruthOptions& options, ThreadPool* pool)
+{
+	Inform("Preparing ground truth for " + ToString(colours) + " colours");
+	using namespace cv;
+	TraceSpan span("GenerateGroundTruth");
+
+	if (!GG::rowSolver(colours))
+	{
+		::Error("Unsupported number of colours: " + ToString(colours) + ", expected " +
+			ToString(GG::kMinColours) + " to " + ToString(GG::kMaxColours));
+		return{};
+	}
+
+	//Only the views are cropped; the images are never copied.
+	std::vector<Mat> matCharF(foreground, foreground + colours);
+	std::vector<Mat> matCharB(background, background + colours);
+
+	for (int i = 0; i < colours; ++i)
+		if (matCharF[i].size() != matCharF[0].size() || matCharB[i].size() != matCharF[0].size() ||
+			matCharF[i].type() != CV_16UC3 || matCharB[i].type() != CV_16UC3)
 		{
 			::Error("Mismatched image sizes in ground truth");
 			return{};
 		}
+
+	Rect region;
+	Size canvas;
+	Point offset;
+	if (!PlaceRegion(matCharF[0].size(), options, region, canvas, offset))
+		return{};
+
+	if (options.autoRoi > 0)
+	{
+		const Rect bounds = FindObjectBounds(matCharF[0](region), matCharB[0](region), options.autoRoi, kAutoRoiMargin);
+		if (bounds.area() > 0)
+			region = bounds + region.tl();
+		else
+			Warning("No object found in front of the first backdrop, solving the whole region");
 	}
 
-	//Convert to float:
+	for (int i = 0; i < colours; ++i)
+	{
+		matCharF[i] = matCharF[i](region);
+		matCharB[i] = matCharB[i](region);
+	}
+
+	//Everything outside the region stays 0, which is transparent.
+	const Rect target = region + offset;
+	const bool cropped = target.size() != canvas;
+	ReportRegion(target, canvas);
 
-	Mat matFloatF[5];
-	Mat matFloatB[5];
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+
+	//The preview may narrow the full solve to the tiles holding the object.
+	const bool skipTiles = options.previewScale > 1 && options.previewSkipBelow > 0;
+	std::vector<Rect> tiles;
+	if (options.previewScale > 1)
+		SolvePreview(matCharF, matCharB, colours, options, pool, tiles);
 
 	Mat a;
 	Mat f;
 	Mat af;
 
-	for(int i = 0; i < 5; ++i)
+	//The solver reads the 16 bit images directly, so no float copies are made, and writes 16 bit results
+	//unless float outputs are wanted.
+	const int outputType = options.floatOutputs ? CV_32FC3 : CV_16UC3;
+	if (cropped || skipTiles)
 	{
-		matCharF[i].convertTo(matFloatF[i], CV_32FC3, 1.0 / 65535);
-		std::get<2>(foreground[i]).swap(std::vector<uint16_t> ());
-		matCharB[i].convertTo(matFloatB[i], CV_32FC3, 1.0 / 65535);
-		std::get<2>(background[i]).swap(std::vector<uint16_t>());
+		f = Mat::zeros(canvas, outputType);
+		af = Mat::zeros(canvas, outputType);
 	}
-
-	f.create(std::get<1>(foreground[0]), std::get<0>(foreground[0]), CV_32FC3);
-	af.create(std::get<1>(foreground[0]), std::get<0>(foreground[0]), CV_32FC3);
+	else
+	{
+		f.create(canvas, outputType);
+		af.create(canvas, outputType);
+	}
+	Mat fRegion = f(target);
+	Mat afRegion = af(target);
 
 	//Compute:
-	Inform("Generating ground truth");
-	a = GG::groundTruthAlpha2(matFloatF[0], matFloatF[1], matFloatF[2], matFloatF[3], matFloatF[4],
-							  matFloatB[0], matFloatB[1], matFloatB[2], matFloatB[3], matFloatB[4],
-							  f, af);
+	Inform("Generating ground truth on " + ToString(pool->size()) + " threads");
+	TraceSpan solve(skipTiles ? "solve tiles" : "solve");
+	GG::SolveStats stats;
+	Mat residual;
+	Mat conditioning;
+	if (skipTiles)
+		a = SolveTiles(matCharF, matCharB, colours, fRegion, afRegion, tiles, options, pool, stats,
+			options.qualityMaps ? &residual : nullptr, options.qualityMaps ? &conditioning : nullptr);
+	else
+		a = GG::groundTruthAlpha2(&matCharF[0], &matCharB[0], colours, fRegion, afRegion, pool, options.solver,
+			&stats, options.alphaChannels, options.qualityMaps ? &residual : nullptr,
+			options.qualityMaps ? &conditioning : nullptr);
+	solve.end();
+
+	if (cropped)
+	{
+		Mat* outputs[] = { &a, &residual, &conditioning };
+		for (int i = 0; i < (options.qualityMaps ? 3 : 1); ++i)
+		{
+			Mat whole = Mat::zeros(canvas, outputs[i]->type());
+			outputs[i]->copyTo(whole(target));
+			*outputs[i] = whole;
+		}
+	}
+
+	ReportSolve(stats, options);
+
+	if (options.qualityMaps)
+	{
+		if (!ReportQuality(stats, options))
+			return{};
+		return{ a, f, af, residual, conditioning };
+	}
+
+	return{ a, f, af };
+}
+
+/**
+* Reads columns [x, x + width) of rows [row, row + count) of every input i for which out[i] is not nullptr
+* into out[i], foregrounds first, reporting any failure.
+* */
+typedef std::function<bool(int row, int count, int x, int width, uint16_t* const* out)> BandReader;
+
+/**
+* Generates the ground truth band by band from inputs of the given size, as GenerateGroundTruthStreamed.
+* */
+static bool StreamGroundTruth(cv::Size size, int colours, const BandReader& read, const std::string* outputs,
+	const GroundTruthOptions& options, ThreadPool* pool)
+{
+	using namespace cv;
+	TraceSpan span("stream ground truth");
+
+	Rect region;
+	Size canvas;
+	Point offset;
+	if (!PlaceRegion(size, options, region, canvas, offset))
+		return false;
+
+	const int bandRows = std::max(1, std::min(options.bandRows, canvas.height));
+
+	std::vector<Mat> bands(2 * colours);
+	std::vector<Mat> bandInputs(2 * colours);
+
+	//Finding the object takes a pass over the first pair, band by band, before anything is solved.
+	if (options.autoRoi > 0)
+	{
+		bands[0].create(bandRows, region.width, CV_16UC3);
+		bands[colours].create(bandRows, region.width, CV_16UC3);
+		Rect bounds;
+		for (int row = region.y; row < region.y + region.height; row += bandRows)
+		{
+			const int rows = std::min(bandRows, region.y + region.height - row);
+			std::vector<uint16_t*> out(2 * colours, nullptr);
+			out[0] = (uint16_t*)bands[0].data;
+			out[colours] = (uint16_t*)bands[colours].data;
+			if (!read(row, rows, region.x, region.width, &out[0]))
+				return false;
+
+			const Rect bandBounds = FindObjectBounds(bands[0].rowRange(0, rows), bands[colours].rowRange(0, rows),
+				options.autoRoi, 0);
+			if (bandBounds.area() > 0)
+				bounds = bounds.area() > 0 ? bounds | (bandBounds + Point(0, row)) : bandBounds + Point(0, row);
+		}
+
+		if (bounds.area() > 0)
+			region = Rect(bounds.x + region.x - kAutoRoiMargin, bounds.y - kAutoRoiMargin,
+				bounds.width + 2 * kAutoRoiMargin, bounds.height + 2 * kAutoRoiMargin) & region;
+		else
+			Warning("No object found in front of the first backdrop, solving the whole region");
+	}
+
+	//Band buffers, reused for every band and packed to the width of the region. Only the last band may be shorter.
+	for (int i = 0; i < 2 * colours; ++i)
+		bands[i].create(bandRows, region.width, CV_16UC3);
+
+	const Rect target = region + offset;
+	const bool cropped = target.size() != canvas;
+	ReportRegion(target, canvas);
+
+	const int outputCount = options.qualityMaps ? 5 : 3;
+	PngWriter writers[5];
+	for (int i = 0; i < outputCount; ++i)
+		if (!writers[i].open(outputs[i], canvas.width, canvas.height, i == 0 ? options.alphaChannels : i < 3 ? 3 : 1,
+			options.pngCompression))
+			return false;
+
+	//Output bands span the whole width of the canvas; the solver writes into the part inside the target.
+	Mat a(bandRows, canvas.width, CV_16UC(options.alphaChannels));
+	Mat f(bandRows, canvas.width, CV_16UC3);
+	Mat af(bandRows, canvas.width, CV_16UC3);
+	Mat residual;
+	Mat conditioning;
+	Mat quantised[2];
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+	Inform("Generating ground truth on " + ToString(pool->size()) + " threads in bands of " +
+		ToString(bandRows) + " rows");
+	GG::SolveStats stats;
+
+	for (int row = 0; row < canvas.height; row += bandRows)
+	{
+		const int rows = std::min(bandRows, canvas.height - row);
+		Mat aBand = a.rowRange(0, rows);
+		Mat fBand = f.rowRange(0, rows);
+		Mat afBand = af.rowRange(0, rows);
+		if (options.qualityMaps)
+			for (int i = 0; i < 2; ++i)
+			{
+				quantised[i].create(rows, canvas.width, CV_16UC1);
+				if (cropped)
+					quantised[i].setTo(Scalar::all(0));
+			}
+		if (cropped)
+		{
+			aBand.setTo(Scalar::all(0));
+			fBand.setTo(Scalar::all(0));
+			afBand.setTo(Scalar::all(0));
+		}
+
+		//The rows of the band that are solved, in output and in input coordinates.
+		const Rect solved = target & Rect(0, row, canvas.width, rows);
+		if (solved.area() > 0)
+		{
+			const int inputRow = solved.y - offset.y;
+			std::vector<uint16_t*> out(2 * colours);
+			for (int i = 0; i < 2 * colours; ++i)
+			{
+				out[i] = (uint16_t*)bands[i].data;
+				bandInputs[i] = bands[i].rowRange(0, solved.height);
+			}
+			TraceSpan load("read band");
+			if (!read(inputRow, solved.height, region.x, region.width, &out[0]))
+				return false;
+			load.end();
+
+			TraceSpan solve("solve band");
+			const Rect inBand = solved - Point(0, row);
+			Mat fSolved = fBand(inBand);
+			Mat afSolved = afBand(inBand);
+			GG::SolveStats bandStats;
+			GG::groundTruthAlpha2(&bandInputs[0], &bandInputs[colours], colours, fSolved, afSolved, pool,
+				options.solver, &bandStats, options.alphaChannels, options.qualityMaps ? &residual : nullptr,
+				options.qualityMaps ? &conditioning : nullptr).copyTo(aBand(inBand));
+			stats += bandStats;
+
+			if (options.qualityMaps)
+			{
+				Mat residualSolved = quantised[0](inBand);
+				Mat conditioningSolved = quantised[1](inBand);
+				residual.convertTo(residualSolved, CV_16UC1, 65535);
+				conditioning.convertTo(conditioningSolved, CV_16UC1, 65535);
+			}
+		}
+
+		TraceSpan encode("encode band");
+		if (!writers[0].writeRows(aBand, pool) || !writers[1].writeRows(fBand, pool) ||
+			!writers[2].writeRows(afBand, pool))
+			return false;
+
+		if (options.qualityMaps &&
+			(!writers[3].writeRows(quantised[0], pool) || !writers[4].writeRows(quantised[1], pool)))
+			return false;
+	}
+
+	ReportSolve(stats, options);
+
+	bool succeeded = !options.qualityMaps || ReportQuality(stats, options);
+	for (int i = 0; i < outputCount; ++i)
+		if (!writers[i].close())
+		{
+			::Error("Could not save " + outputs[i]);
+			succeeded = false;
+		}
+
+	return succeeded;
+}
+
+bool GenerateGroundTruthStreamed(const std::string* foreground, const std::string* background, int colours,
+	const std::string* outputs, const GroundTruthOptions& options, ThreadPool* pool)
+{
+	Inform("Preparing streamed ground truth for " + ToString(colours) + " colours");
+
+	if (!GG::rowSolver(colours))
+	{
+		::Error("Unsupported number of colours: " + ToString(colours) + ", expected " +
+			ToString(GG::kMinColours) + " to " + ToString(GG::kMaxColours));
+		return false;
+	}
+
+	//Open every input, checking that the sizes agree:
+	std::vector<RawRgbReader> readers(2 * colours);
+	for (int i = 0; i < 2 * colours; ++i)
+	{
+		const std::string& path = i < colours ? foreground[i] : background[i - colours];
+		if (!readers[i].open(path))
+		{
+			::Error("Could not load " + path);
+			return false;
+		}
+
+		if (readers[i].width() != readers[0].width() || readers[i].height() != readers[0].height())
+		{
+			::Error("Mismatched image sizes in ground truth");
+			return false;
+		}
+	}
+
+	auto read = [&](int row, int count, int x, int width, uint16_t* const* out) {
+		for (int i = 0; i < 2 * colours; ++i)
+			if (out[i] && !readers[i].readRegion(row, count, x, width, out[i]))
+			{
+				::Error("Could not read rows " + ToString(row) + " to " + ToString(row + count) + " of " +
+					(i < colours ? foreground[i] : background[i - colours]));
+				return false;
+			}
+		return true;
+	};
+
+	return StreamGroundTruth(cv::Size(readers[0].width(), readers[0].height()), colours, read, outputs, options, pool);
+}
+
+bool GenerateGroundTruthStreamed(const std::string& bundle, const std::string* outputs, const GroundTruthOptions& options,
+	ThreadPool* pool)
+{
+	CaptureBundleReader reader;
+	if (!reader.open(bundle))
+	{
+		::Error("Could not load " + bundle);
+		return false;
+	}
+
+	const int colours = reader.plates() / 2;
+	Inform("Preparing streamed ground truth for " + ToString(colours) + " colours");
+	if (reader.plates() % 2 != 0 || !GG::rowSolver(colours))
+	{
+		::Error("Unsupported number of plates in " + bundle + ": " + ToString(reader.plates()) + ", expected 2N for N from " +
+			ToString(GG::kMinColours) + " to " + ToString(GG::kMaxColours));
+		return false;
+	}
+
+	//The tiles are decoded between the solves of the bands, so on the same pool.
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+
+	auto read = [&](int row, int count, int x, int width, uint16_t* const* out) {
+		if (reader.readRegion(row, count, x, width, out, pool))
+			return true;
+		::Error("Could not read rows " + ToString(row) + " to " + ToString(row + count) + " of " + bundle);
+		return false;
+	};
+
+	return StreamGroundTruth(cv::Size(reader.width(), reader.height()), colours, read, outputs, options, pool);
+}
+
+//The band height used when reading background caches and their foregrounds if none is given.
+static const int kDefaultCacheBandRows = 256;
+
+bool WriteBackgroundCache(const std::string* background, int colours, const std::string& path,
+	const GroundTruthOptions& options, ThreadPool* pool)
+{
+	using namespace cv;
+
+	if (!GG::rowSolver(colours))
+	{
+		::Error("Unsupported number of colours: " + ToString(colours));
+		return false;
+	}
+
+	std::vector<RawRgbReader> readers(colours);
+	for (int i = 0; i < colours; ++i)
+	{
+		if (!readers[i].open(background[i]))
+		{
+			::Error("Could not load " + background[i]);
+			return false;
+		}
+
+		if (readers[i].width() != readers[0].width() || readers[i].height() != readers[0].height())
+		{
+			::Error("Mismatched image sizes in background cache");
+			return false;
+		}
+	}
+
+	const int width = readers[0].width();
+	const int height = readers[0].height();
+	const int bandRows = std::min(options.bandRows > 0 ? options.bandRows : kDefaultCacheBandRows, height);
+	const int planes = GG::factorPlanes(colours);
+
+	BackgroundCacheWriter writer;
+	if (!writer.open(path, width, height, colours))
+	{
+		::Error("Could not create " + path);
+		return false;
+	}
+
+	std::vector<Mat> bands(colours);
+	for (int i = 0; i < colours; ++i)
+		bands[i].create(bandRows, width, CV_16UC3);
+	Mat factor(bandRows, width * planes, CV_32FC1);
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+	Inform("Writing background cache " + path + " for " + ToString(colours) + " colours");
+
+	for (int row = 0; row < height; row += bandRows)
+	{
+		const int rows = std::min(bandRows, height - row);
+		for (int i = 0; i < colours; ++i)
+			if (!readers[i].readRows(row, rows, (uint16_t*)bands[i].data))
+			{
+				::Error("Could not read rows " + ToString(row) + " to " + ToString(row + rows) + " of " + background[i]);
+				return false;
+			}
+
+		pool->run(rows, [&](int r){
+			const uint16_t* pb[GG::kMaxColours];
+			for (int i = 0; i < colours; ++i)
+				pb[i] = (const uint16_t*)(bands[i].data + r*bands[i].step);
+			GG::factorRow(pb, colours, width, (float*)(factor.data + r*factor.step));
+		});
+
+		if (!writer.write((const float*)factor.data, (size_t)rows * width * planes))
+		{
+			::Error("Could not write " + path);
+			return false;
+		}
+	}
+
+	return writer.close();
+}
+
+std::vector<cv::Mat> GenerateGroundTruthFromCache(const std::string* foreground, int colours,
+	const std::string& cachePath, const GroundTruthOptions& options, ThreadPool* pool)
+{
+	Inform("Preparing ground truth for " + ToString(colours) + " colours from " + cachePath);
+	using namespace cv;
+	TraceSpan span("GenerateGroundTruthFromCache", cachePath);
+
+	if (options.qualityMaps)
+	{
+		::Error("Residual maps need the images of the backdrops, so cannot be made from a background cache");
+		return{};
+	}
+	if (options.solver.precision == GG::Precision::Mixed || options.solver.backgroundNoise > 0)
+	{
+		::Error("Mixed precision and --background-noise need the images of the backdrops, so cannot be used "
+			"with a background cache");
+		return{};
+	}
+
+	BackgroundCacheReader cache;
+	if (!cache.open(cachePath))
+	{
+		::Error("Could not load background cache " + cachePath);
+		return{};
+	}
+
+	if (cache.colours() != colours)
+	{
+		::Error("The background cache is for " + ToString(cache.colours()) + " colours, but " +
+			ToString(colours) + " foregrounds were given");
+		return{};
+	}
+
+	std::vector<RawRgbReader> readers(colours);
+	for (int i = 0; i < colours; ++i)
+	{
+		if (!readers[i].open(foreground[i]))
+		{
+			::Error("Could not load " + foreground[i]);
+			return{};
+		}
+
+		if (readers[i].width() != cache.width() || readers[i].height() != cache.height())
+		{
+			::Error("Mismatched image sizes in ground truth");
+			return{};
+		}
+	}
+
+	const int width = cache.width();
+	const int height = cache.height();
+	const int bandRows = std::min(options.bandRows > 0 ? options.bandRows : kDefaultCacheBandRows, height);
+	const size_t rowFloats = (size_t)width * GG::factorPlanes(colours);
+
+	const int depth = options.floatOutputs ? CV_32F : CV_16U;
+	Mat a(height, width, CV_MAKETYPE(depth, options.alphaChannels));
+	Mat f(height, width, CV_MAKETYPE(depth, 3));
+	Mat af(height, width, CV_MAKETYPE(depth, 3));
+
+	std::vector<Mat> bands(colours);
+	for (int i = 0; i < colours; ++i)
+		bands[i].create(bandRows, width, CV_16UC3);
+	std::vector<Mat> bandInputs(colours);
+	Mat factor(bandRows, (int)rowFloats, CV_32FC1);
+	Mat conditioning;
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+	Inform("Generating ground truth on " + ToString(pool->size()) + " threads");
+	GG::SolveStats stats;
+
+	for (int row = 0; row < height; row += bandRows)
+	{
+		const int rows = std::min(bandRows, height - row);
+		for (int i = 0; i < colours; ++i)
+		{
+			if (!readers[i].readRows(row, rows, (uint16_t*)bands[i].data))
+			{
+				::Error("Could not read rows " + ToString(row) + " to " + ToString(row + rows) + " of " + foreground[i]);
+				return{};
+			}
+			bandInputs[i] = bands[i].rowRange(0, rows);
+		}
+
+		if (!cache.readRows(row, rows, rowFloats, (float*)factor.data))
+		{
+			::Error("Could not read rows " + ToString(row) + " to " + ToString(row + rows) + " of " + cachePath);
+			return{};
+		}
+
+		Mat aBand = a.rowRange(row, row + rows);
+		Mat fBand = f.rowRange(row, row + rows);
+		Mat afBand = af.rowRange(row, row + rows);
+		GG::SolveStats bandStats;
+		GG::groundTruthFromFactor(&bandInputs[0], colours, factor.rowRange(0, rows), aBand, fBand, afBand, pool,
+			options.solver, &bandStats, &conditioning);
+		stats += bandStats;
+	}
 
-		//Convert results to rgb:
-	a.convertTo(a, CV_16UC1, 65535);
-	cvtColor(a, a, CV_GRAY2RGB);
-	f.convertTo(f, CV_16UC3, 65535);
-	af.convertTo(af, CV_16UC3, 65535);
+	ReportSolve(stats, options);
+	if (!ReportQuality(stats, options))
+		return{};
 
 	return{ a, f, af };
-}
\ No newline at end of file
+}
@@ -1,46 +1,168 @@
 #pragma once
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <algorithm>
+#include <functional>
 #include "Vec.h"
+#include "groundtruthkernel.h"
+#include "threadpool.h"
 #include "rawrgbchar.h"
 
 namespace GG
 {
 	/**
+	* Returns the number of rows per band when splitting an image between threads.
+	* Aims for about eight bands per thread, so that work stealing can even out slow bands.
+	* */
+	inline int bandHeight(int rows, unsigned threads)
+	{
+		return std::max(16, rows / (int)(threads * 8));
+	}
 
-	* where b is the image with the blue background, bb the image of the blue background, g is the image with the green background, bg is the image of the green background...
+	/**
+
+	* where c[i] is the image with backdrop i (blue, green, ...), and b[i] the image OF backdrop i.
 	* Remark: Input format is expected to be 32 bits floats and pixel values are normalised between [0;1] (instead of [0;255] for 8 bits pixels for example)
-	* @param b Image with blue background
-	* @param bb Image OF the blue background... etc.
+	* 16 bit CV_16UC3 inputs are also accepted, and are normalised to [0;1] as they are read.
+	* Uses the closed form solver specialised for n backdrops (see groundtruthkernel.h).
+	* See groundTruthAlpha2Reference for the original QR formulation.
+	* @param c n images with each backdrop, CV_32FC3 or CV_16UC3.
+	* @param b n images OF each backdrop, of the same type as c.
+	* @param n The number of backdrops, between kMinColours and kMaxColours.
+	* @param F Receives the foreground. Must be allocated as CV_32FC3, or as CV_16UC3 to receive the result
+	*          already scaled by 65535 and quantised, identically to convertTo(CV_16UC3, 65535).
+	* @param AF Receives the alpha-premultiplied foreground. Must be allocated with the same type as F.
+	* @param pool If given, row bands are solved in parallel on the pool. The result is identical to a serial run.
+	* @param settings The precision to solve in.
+	* @param stats If given, receives counts for the whole image.
+	* @param alphaChannels 3 for the alpha repeated in every channel, as GroundTruth saves it by default (see
+	*          GroundTruthOptions::alphaChannels), or 1 for a single channel alpha.
+	* @param residual If given, receives the CV_32FC1 residual map (see SolveImages) and stats its summary.
+	* @param conditioning If given, receives the CV_32FC1 conditioning map and stats its summary.
+	* @return The alpha, with the depth of F, or an empty Mat if n is not supported.
 	*
 	* */
-	static cv::Mat groundTruthAlpha2(cv::Mat &b, cv::Mat &g, cv::Mat &k, cv::Mat &y, cv::Mat &r,
-		cv::Mat &bb, cv::Mat &bg, cv::Mat &bk, cv::Mat &by, cv::Mat &br,
+	static cv::Mat groundTruthAlpha2(const cv::Mat* c, const cv::Mat* b, int n,
+		cv::Mat &F, cv::Mat &AF, ThreadPool* pool = nullptr,
+		const SolveSettings& settings = SolveSettings(), SolveStats* stats = nullptr, int alphaChannels = 3,
+		cv::Mat* residual = nullptr, cv::Mat* conditioning = nullptr){
+
+
+		RowSolver solver = rowSolver(n);
+		if (!solver)
+			return cv::Mat();
+
+
+		cv::Mat A = cv::Mat::zeros(c[0].rows, c[0].cols, CV_MAKETYPE(F.depth(), alphaChannels));
+		if (residual)
+			residual->create(A.rows, A.cols, CV_32FC1);
+		if (conditioning)
+			conditioning->create(A.rows, A.cols, CV_32FC1);
+		SolveImages images = { c, b, &A, &F, &AF, residual, conditioning };
+
+
+		//Pixels are independent, so splitting the rows into bands gives the same result on any number of threads.
+		if (!pool || pool->size() == 1)
+		{
+			SolveStats total;
+			solver(images, settings, 0, A.rows, total);
+			if (stats)
+				*stats = total;
+			return A;
+		}
+
+		const int bandRows = bandHeight(A.rows, pool->size());
+		const int bands = (A.rows + bandRows - 1) / bandRows;
+		std::vector<SolveStats> bandStats(bands);
+		pool->run(bands, [&](int band){
+			solver(images, settings, band * bandRows, std::min(A.rows, (band + 1) * bandRows), bandStats[band]);
+		});
+
+		if (stats)
+		{
+			*stats = SolveStats();
+			for (int i = 0; i < bands; ++i)
+				*stats += bandStats[i];
+		}
+
+
+		return A;
+
+
+	}
+
+	/**
+	* Solves the ground truth from precomputed background factors (see factorRow) instead of the images
+	* of the backdrops. Apart from the factors having been rounded to float, the result is that of
+	* groundTruthAlpha2.
+	* @param c n images with each backdrop, CV_32FC3 or CV_16UC3.
+	* @param n The number of backdrops the factors were computed for.
+	* @param factor CV_32FC1 with one row of factorPlanes(n) planes per image row.
+	* @param A Receives the alpha. Must be allocated like F, with 3 channels for the alpha repeated in every
+	*          channel or 1 for a single channel alpha, so that it may be a view into a larger image.
+	* @param F, AF, pool, settings, stats, conditioning As in groundTruthAlpha2.
+	* */
+	static void groundTruthFromFactor(const cv::Mat* c, int n, const cv::Mat& factor, cv::Mat& A,
+		cv::Mat &F, cv::Mat &AF, ThreadPool* pool = nullptr, const SolveSettings& settings = SolveSettings(),
+		SolveStats* stats = nullptr, cv::Mat* conditioning = nullptr)
+	{
+		if (conditioning)
+			conditioning->create(A.rows, A.cols, CV_32FC1);
+		FactorImages images = { c, n, &factor, &A, &F, &AF, conditioning };
+
+		const unsigned threads = pool ? pool->size() : 1;
+		const int bandRows = threads == 1 ? A.rows : bandHeight(A.rows, threads);
+		const int bands = (A.rows + bandRows - 1) / bandRows;
+		std::vector<SolveStats> bandStats(bands);
+		auto solveBand = [&](int band){
+			applyFactorRows(images, settings, band * bandRows, std::min(A.rows, (band + 1) * bandRows), bandStats[band]);
+		};
+		if (threads == 1)
+			solveBand(0);
+		else
+			pool->run(bands, solveBand);
+
+		if (stats)
+		{
+			*stats = SolveStats();
+			for (int i = 0; i < bands; ++i)
+				*stats += bandStats[i];
+		}
+	}
+
+	/**
+
+	* where c[i] is the image with backdrop i (blue, green, ...), and b[i] the image OF backdrop i.
+	* Remark: Input format is expected to be 32 bits floats and pixel values are normalised between [0;1] (instead of [0;255] for 8 bits pixels for example)
+	* This is the original per-pixel QR formulation, generalised to n backdrops. It is much slower than
+	* groundTruthAlpha2 and is kept as the reference for verifying the closed form solver.
+	* @param c n images with each backdrop.
+	* @param b n images OF each backdrop.
+	* @param n The number of backdrops.
+	*
+	* */
+	static cv::Mat groundTruthAlpha2Reference(const cv::Mat* c, const cv::Mat* b, int n,
 		cv::Mat &F, cv::Mat &AF){
 
 
-		cv::Mat A = cv::Mat::zeros(b.rows, b.cols, CV_32FC1);
+		cv::Mat A = cv::Mat::zeros(c[0].rows, c[0].cols, CV_32FC1);
 
 
-		cv::Mat mA = cv::Mat::zeros(15, 4, CV_64FC1);
-		cv::Mat mb = cv::Mat::zeros(15, 1, CV_64FC1);
+		cv::Mat mA = cv::Mat::zeros(3 * n, 4, CV_64FC1);
+		cv::Mat mb = cv::Mat::zeros(3 * n, 1, CV_64FC1);
 		cv::Mat mx = cv::Mat::zeros(4, 1, CV_64FC1);
 
+		std::vector<const float*> pc(n), pb(n);
 
-		for (int i = 0; i < b.rows; i++){
 
+		for (int i = 0; i < A.rows; i++){
 
-			float *pb = (float*)(b.data + i*b.step);
-			float *pg = (float*)(g.data + i*g.step);
-			float *pk = (float*)(k.data + i*k.step);
-			float *py = (float*)(y.data + i*y.step);
-			float *pr = (float*)(r.data + i*r.step);
-			float *pbb = (float*)(bb.data + i*bb.step);
-			float *pbg = (float*)(bg.data + i*bg.step);
-			float *pbk = (float*)(bk.data + i*bk.step);
-			float *pby = (float*)(by.data + i*by.step);
-			float *pbr = (float*)(br.data + i*br.step);
 
+			for (int k = 0; k < n; ++k)
+			{
+				pc[k] = (const float*)(c[k].data + i*c[k].step);
+				pb[k] = (const float*)(b[k].data + i*b[k].step);
+			}
 
 
 			float *pA = (float*)(A.data + i*A.step);
@@ -48,55 +170,26 @@ namespace GG
 			float *pAF = (float*)(AF.data + i*AF.step);
 
 
-			for (int j = 0; j < b.cols; j++){
-
-
-				GG::Vec B(pb, j);
-				GG::Vec G(pg, j);
-				GG::Vec K(pk, j);
-				GG::Vec Y(py, j);
-				GG::Vec R(pr, j);
-				GG::Vec BB(pbb, j);
-				GG::Vec BG(pbg, j);
-				GG::Vec BK(pbk, j);
-				GG::Vec BY(pby, j);
-				GG::Vec BR(pbr, j);
-
-
-				//mA
-				mA.at<double>(0, 0) = -BB.x; mA.at<double>(0, 1) = 1.0;
-				mA.at<double>(1, 0) = -BB.y; mA.at<double>(1, 2) = 1.0;
-				mA.at<double>(2, 0) = -BB.z; mA.at<double>(2, 3) = 1.0;
-				mA.at<double>(3, 0) = -BG.x; mA.at<double>(3, 1) = 1.0;
-				mA.at<double>(4, 0) = -BG.y; mA.at<double>(4, 2) = 1.0;
-				mA.at<double>(5, 0) = -BG.z; mA.at<double>(5, 3) = 1.0;
-				mA.at<double>(6, 0) = -BK.x; mA.at<double>(6, 1) = 1.0;
-				mA.at<double>(7, 0) = -BK.y; mA.at<double>(7, 2) = 1.0;
-				mA.at<double>(8, 0) = -BK.z; mA.at<double>(8, 3) = 1.0;
-				mA.at<double>(9, 0) = -BY.x; mA.at<double>(9, 1) = 1.0;
-				mA.at<double>(10, 0) = -BY.y; mA.at<double>(10, 2) = 1.0;
-				mA.at<double>(11, 0) = -BY.z; mA.at<double>(11, 3) = 1.0;
-				mA.at<double>(12, 0) = -BR.x; mA.at<double>(12, 1) = 1.0;
-				mA.at<double>(13, 0) = -BR.y; mA.at<double>(13, 2) = 1.0;
-				mA.at<double>(14, 0) = -BR.z; mA.at<double>(14, 3) = 1.0;
-
-
-				//mb
-				mb.at<double>(0, 0) = B.x - BB.x;
-				mb.at<double>(1, 0) = B.y - BB.y;
-				mb.at<double>(2, 0) = B.z - BB.z;
-				mb.at<double>(3, 0) = G.x - BG.x;
-				mb.at<double>(4, 0) = G.y - BG.y;
-				mb.at<double>(5, 0) = G.z - BG.z;
-				mb.at<double>(6, 0) = K.x - BK.x;
-				mb.at<double>(7, 0) = K.y - BK.y;
-				mb.at<double>(8, 0) = K.z - BK.z;
-				mb.at<double>(9, 0) = Y.x - BY.x;
-				mb.at<double>(10, 0) = Y.y - BY.y;
-				mb.at<double>(11, 0) = Y.z - BY.z;
-				mb.at<double>(12, 0) = R.x - BR.x;
-				mb.at<double>(13, 0) = R.y - BR.y;
-				mb.at<double>(14, 0) = R.z - BR.z;
+			for (int j = 0; j < A.cols; j++){
+
+
+				for (int k = 0; k < n; ++k)
+				{
+					GG::Vec C((float*)pc[k], j);
+					GG::Vec B((float*)pb[k], j);
+
+
+					//mA
+					mA.at<double>(3 * k, 0) = -B.x; mA.at<double>(3 * k, 1) = 1.0;
+					mA.at<double>(3 * k + 1, 0) = -B.y; mA.at<double>(3 * k + 1, 2) = 1.0;
+					mA.at<double>(3 * k + 2, 0) = -B.z; mA.at<double>(3 * k + 2, 3) = 1.0;
+
+
+					//mb
+					mb.at<double>(3 * k, 0) = C.x - B.x;
+					mb.at<double>(3 * k + 1, 0) = C.y - B.y;
+					mb.at<double>(3 * k + 2, 0) = C.z - B.z;
+				}
 
 
 				//mx
@@ -125,10 +218,145 @@ namespace GG
 
 }
 
+/** Settings for GenerateGroundTruth. */
+struct GroundTruthOptions
+{
+	//The number of threads to solve with. 0 uses every hardware thread.
+	unsigned threads = 0;
+
+	//The precision of the solver.
+	GG::SolveSettings solver;
+
+	//If positive, GenerateGroundTruthStreamed works through the images this many rows at a time.
+	int bandRows = 0;
+
+	//The channels of the alpha output: 3 repeats the alpha as an RGB image, while 1 gives a greyscale
+	//image a third of the size.
+	int alphaChannels = 3;
+
+	//Whether GenerateGroundTruth returns A, F and AF as CV_32F, nominally in [0;1], instead of quantising
+	//them to CV_16U, for outputs saved as floats (see floatimage.h). Streaming always quantises.
+	bool floatOutputs = false;
+
+	//The compression level of PNG outputs, from 0 (stored uncompressed) to 9. Low levels already
+	//gain most of the size, since filtering does much of the work on smooth images.
+	int pngCompression = 1;
+
+	//Whether to produce the residual and conditioning maps, and print a summary of them.
+	bool qualityMaps = false;
+
+	//With qualityMaps, the generation fails if a larger share of the pixels than this has a residual
+	//or conditioning outside the limits in solver, so that bad captures can be rejected.
+	double rejectAbove = 1;
+
+	//If not empty, only this region of the inputs is read and solved. Alpha, F and AF are 0 outside it,
+	//as are the quality maps.
+	cv::Rect roi;
+
+	//If positive, the region solved is narrowed to the bounding box of the pixels where the first
+	//foreground differs from its background by more than this share of full scale (see FindObjectBounds).
+	double autoRoi = 0;
+
+	//If not empty, the inputs are a crop of a larger capture, lying at frame.x, frame.y in an image of
+	//frame.width by frame.height. The outputs are then of the whole capture, with alpha 0 outside the crop.
+	cv::Rect frame;
+
+	//If above 1, GenerateGroundTruth first solves the region at 1/previewScale of its resolution, which
+	//takes a small share of the time, and hands the result to onPreview before the full solve starts.
+	int previewScale = 0;
+
+	//With previewScale, tiles of the full solve around which the preview alpha nowhere exceeds this, and
+	//every preview pixel could be solved, are left transparent without being solved, like the outside of the
+	//region. 0 solves every tile.
+	double previewSkipBelow = 0;
+
+	//Receives the preview: a CV_16UC3 image of the alpha-premultiplied foreground over mid grey, so that
+	//both the object and its matte show. Called on the thread calling GenerateGroundTruth.
+	std::function<void(const cv::Mat&)> onPreview;
+};
+
+/**
+* Prints a summary of the quality maps gathered in stats: the residual if options.qualityMaps, since only
+* then is it gathered, and the conditioning.
+* @return false if the share of bad pixels exceeds options.rejectAbove.
+* */
+bool ReportQuality(const GG::SolveStats& stats, const GroundTruthOptions& options);
+
 /**
 * Generates the ground truth for the given images.
-* @param foreground A pointer to 5 RawRgbChar objects. These objects are DESTROYED inside the function.
-* @param background A pointer to 5 RawRgbChar objects. These objects are DESTROYED inside the function.
+* @param foreground A pointer to colours RawRgbChar objects. These objects are DESTROYED inside the function.
+* @param background A pointer to colours RawRgbChar objects. These objects are DESTROYED inside the function.
+* @param colours The number of backdrop colours, between GG::kMinColours and GG::kMaxColours.
+* @param options Settings for the computation.
 * @return empty upon failure, or 3 images upon success, corresponding to A, F and AF respectively.
+*         With options.qualityMaps, the CV_32FC1 residual and conditioning maps follow. The outputs are
+*         the size of options.frame if given, and are 0 outside the region solved (see options.roi).
+* @param pool If given, the pool to solve on, so that runs of many capture sets can share one.
+*             Otherwise a pool of options.threads threads is made for the run.
+* */
+std::vector<cv::Mat> GenerateGroundTruth(RawRgbChar* foreground, RawRgbChar* background, int colours,
+	const GroundTruthOptions& options = GroundTruthOptions(), ThreadPool* pool = nullptr);
+
+/**
+* Generates the ground truth for images that are already in memory, such as frames in shared memory
+* (see sharedframes.h), without copying them.
+* @param foreground colours CV_16UC3 images with each backdrop. They are only read.
+* @param background colours CV_16UC3 images of each backdrop, of the same size.
+* @return As GenerateGroundTruth above.
+* */
+std::vector<cv::Mat> GenerateGroundTruth(const cv::Mat* foreground, const cv::Mat* background, int colours,
+	const GroundTruthOptions& options = GroundTruthOptions(), ThreadPool* pool = nullptr);
+
+/**
+* Generates the ground truth band by band, reading bandRows rows of every input, solving them and
+* appending the results to the outputs before moving on. Peak memory is proportional to the band
+* rather than the image, and the output pixels are identical to GenerateGroundTruth.
+* The outputs are written as 16 bit PNG files at options.pngCompression, whatever their extension. Float
+* outputs (.npy, .rawf) cannot be streamed and are rejected by the caller.
+* @param foreground The paths of colours .rawrgb images with each backdrop.
+* @param background The paths of colours .rawrgb images of each backdrop.
+* @param colours The number of backdrop colours, between GG::kMinColours and GG::kMaxColours.
+* @param outputs The paths of the A, F and AF outputs, followed by the residual and conditioning maps
+*                with options.qualityMaps. The maps are saved scaled to 16 bits.
+* @param options Settings for the computation. bandRows is the band height, 1 if not positive. With
+*                options.roi or options.autoRoi, only the rows and columns of the inputs in the region are read.
+* @param pool The pool to solve and compress on, or nullptr to create one of options.threads threads.
+* @return false upon failure.
+* */
+bool GenerateGroundTruthStreamed(const std::string* foreground, const std::string* background, int colours,
+	const std::string* outputs, const GroundTruthOptions& options, ThreadPool* pool = nullptr);
+
+/**
+* Generates the ground truth band by band as above, from a capture bundle (see capturebundle.h) holding the
+* foregrounds followed by the backgrounds. Each band is read from the bundle a tile at a time.
+* */
+bool GenerateGroundTruthStreamed(const std::string& bundle, const std::string* outputs, const GroundTruthOptions& options,
+	ThreadPool* pool = nullptr);
+
+/**
+* Computes the background factors of the images of each backdrop and saves them as a background cache
+* (see backgroundcache.h), reading the images options.bandRows rows at a time (256 if not positive).
+* @param background The paths of colours .rawrgb images of each backdrop.
+* @param colours The number of backdrop colours, between GG::kMinColours and GG::kMaxColours.
+* @param path The path of the cache to write.
+* @param pool The pool to compute the factors on, or nullptr to create one of options.threads threads.
+* @return false upon failure.
+* */
+bool WriteBackgroundCache(const std::string* background, int colours, const std::string& path,
+	const GroundTruthOptions& options, ThreadPool* pool = nullptr);
+
+/**
+* Generates the ground truth for the given foregrounds from a background cache, so that the images of the
+* backdrops are not needed. The foregrounds and cache are read options.bandRows rows at a time (256 if
+* not positive); the outputs are returned whole.
+* @param foreground The paths of the .rawrgb images with each backdrop, as many as the cache was made for.
+* @param cachePath The path of a cache written by WriteBackgroundCache.
+* @param colours The number of foregrounds given, which must match the cache.
+* @param pool The pool to solve on, or nullptr to create one of options.threads threads.
+* @return empty upon failure, or A, F and AF as from GenerateGroundTruth. Residual maps cannot be made
+*         without the backdrops, so options.qualityMaps is not supported, and neither are Mixed precision
+*         and options.solver.backgroundNoise, which need them too. The conditioning is still summarised,
+*         and the capture rejected as by options.rejectAbove.
 * */
-std::vector<cv::Mat> GenerateGroundTruth(RawRgbChar* foreground, RawRgbChar* background);
\ No newline at end of file
+std::vector<cv::Mat> GenerateGroundTruthFromCache(const std::string* foreground, int colours,
+	const std::string& cachePath, const GroundTruthOptions& options, ThreadPool* pool = nullptr);
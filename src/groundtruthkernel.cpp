@@ -0,0 +1,26 @@
+#include "groundtruthkernel.h"
+
+namespace GG
+{
+#define GG_INSTANTIATE_SOLVE_ROWS(N) template void solveRows<N>(const SolveImages&, const SolveSettings&, \
+	int, int, SolveStats&);
+	GG_INSTANTIATE_SOLVE_ROWS(2) GG_INSTANTIATE_SOLVE_ROWS(3) GG_INSTANTIATE_SOLVE_ROWS(4) GG_INSTANTIATE_SOLVE_ROWS(5)
+	GG_INSTANTIATE_SOLVE_ROWS(6) GG_INSTANTIATE_SOLVE_ROWS(7) GG_INSTANTIATE_SOLVE_ROWS(8) GG_INSTANTIATE_SOLVE_ROWS(9)
+	GG_INSTANTIATE_SOLVE_ROWS(10) GG_INSTANTIATE_SOLVE_ROWS(11) GG_INSTANTIATE_SOLVE_ROWS(12)
+#undef GG_INSTANTIATE_SOLVE_ROWS
+
+	//Indexed by the number of backdrops.
+	static const RowSolver rowSolvers[kMaxColours + 1] =
+	{
+		nullptr, nullptr,
+		solveRows<2>, solveRows<3>, solveRows<4>, solveRows<5>, solveRows<6>,
+		solveRows<7>, solveRows<8>, solveRows<9>, solveRows<10>, solveRows<11>, solveRows<12>
+	};
+
+	RowSolver rowSolver(int n)
+	{
+		if (n < kMinColours || n > kMaxColours)
+			return nullptr;
+		return rowSolvers[n];
+	}
+}
@@ -0,0 +1,670 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <opencv2/opencv.hpp>
+#include "simdpack.h"
+
+/**
+* The per-pixel ground truth solver, specialised at compile time for each supported number of backdrop
+* colours. The specialisations are instantiated once in groundtruthkernel.cpp; use rowSolver() to pick
+* one at runtime.
+* */
+
+namespace GG
+{
+	//Backdrop variance at or below which a pixel is treated as unsolvable (all backdrops identical).
+	static const double kDegenerateVariance = 1e-12;
+
+	//Rounding leaves identical backdrops a variance of up to about (N * epsilon)^2 * sum(|B_i|^2) in the
+	//precision of the solve. Variances within this many times that are treated as unsolvable too.
+	static const double kDegenerateRounding = 16;
+
+	//The range of backdrop colour counts with a compiled solver.
+	static const int kMinColours = 2;
+	static const int kMaxColours = 12;
+
+	/**
+	* The arithmetic used by the solver. Float32 is the fast path. Mixed solves in float32 and then
+	* solves again in float64 every pixel whose backdrop spread is below SolveSettings::refineBelow.
+	* */
+	enum class Precision { Float32, Float64, Mixed };
+
+	/** Settings shared by every row of a solve. */
+	struct SolveSettings
+	{
+		Precision precision = Precision::Float64;
+
+		//In Mixed precision, pixels with a backdrop spread below this are refined in float64. At 1e-6 the
+		//float32 pixels that remain stay within 1/16 of the 16 bit output quantum of the float64 result.
+		double refineBelow = 1e-6;
+
+		//When quality maps are produced, pixels with a residual above residualLimit or a conditioning
+		//below conditioningLimit are counted in SolveStats. Both are relative to full scale.
+		double residualLimit = 0.01;
+		double conditioningLimit = 0.01;
+
+		//If positive, pixels whose colours in front of every backdrop match the backdrop to within this
+		//(relative to full scale) in every channel are pure background: they get alpha = 0 straight away,
+		//and the solve is skipped for whole batches of them.
+		double backgroundNoise = 0;
+	};
+
+	/** Counters gathered while solving. */
+	struct SolveStats
+	{
+		//Pixels solved.
+		long long pixels = 0;
+
+		//Pixels solved a second time in float64 by Mixed precision.
+		long long refined = 0;
+
+		//Pixels classified as pure background (see SolveSettings::backgroundNoise), and those of them
+		//whose solve was skipped.
+		long long background = 0;
+		long long skipped = 0;
+
+		//Gathered only with a residual map: the sum and maximum of the residuals, and the number of
+		//pixels above SolveSettings::residualLimit.
+		double residualSum = 0;
+		double residualMax = 0;
+		long long badResidual = 0;
+
+		//Gathered only with a conditioning map: pixels below SolveSettings::conditioningLimit.
+		long long illConditioned = 0;
+
+		SolveStats& operator += (const SolveStats& s)
+		{
+			pixels += s.pixels;
+			refined += s.refined;
+			background += s.background;
+			skipped += s.skipped;
+			residualSum += s.residualSum;
+			residualMax = std::max(residualMax, s.residualMax);
+			badResidual += s.badResidual;
+			illConditioned += s.illConditioned;
+			return *this;
+		}
+	};
+
+	/**
+	* Solves C_i = AF + (1 - alpha) * B_i in the least squares sense, where C_i is the colour of the
+	* pixel in front of backdrop i and B_i is the colour of backdrop i itself.
+	*
+	* This is the same system that groundTruthAlpha2Reference hands to cv::solve: 3N rows, with column 0
+	* holding -B_i and columns 1-3 an identity block per backdrop. Eliminating AF from the normal
+	* equations leaves a single scalar equation for alpha, which in centred form reads
+	*     alpha = 1 - sum((B_i - mean(B)) . (C_i - mean(C))) / sum(|B_i - mean(B)|^2)
+	*     AF    = mean(C) - (1 - alpha) * mean(B)
+	* so a pixel costs a few dozen flops and no allocation.
+	*
+	* Tolerance: in double precision both paths compute the exact least squares minimiser and differ only
+	* by rounding. For pixels whose backdrop variance exceeds 1e-6 the results agree with DECOMP_QR to
+	* within 1e-9 absolute, several orders of magnitude below the 16 bit output quantum (1/65535). Pixels
+	* with a variance of at most kDegenerateVariance are rank deficient; like a failed cv::solve they
+	* return 0. So do pixels whose variance is within kDegenerateRounding times the rounding noise of the
+	* precision solved in, which in float precision alone exceeds kDegenerateVariance, so that flat or
+	* clipped backdrops give 0 in every precision rather than rounding noise.
+	*
+	* The spread is the share of the backdrop energy that varies between backdrops,
+	*     sum(|B_i - mean(B)|^2) / sum(|B_i|^2),
+	* between 0 and 1. Rounding errors in alpha grow roughly with eps / sqrt(spread), so a small spread
+	* marks a badly conditioned pixel.
+	*
+	* N is the number of backdrops. T is float or double for a single pixel, or a simd::Pack for a batch;
+	* see simdpack.h.
+	* @param c The colours of the pixel in front of each backdrop.
+	* @param b The colours of each backdrop.
+	* @param alpha Receives the alpha value.
+	* @param af Receives the alpha-premultiplied foreground colour.
+	* @param spread Receives the backdrop spread.
+	* */
+	template<int N, class T>
+	inline void solve(const Rgb<T>* c, const Rgb<T>* b, T& alpha, Rgb<T>& af, T& spread)
+	{
+		T mcx = T(0.0), mcy = T(0.0), mcz = T(0.0);
+		T mbx = T(0.0), mby = T(0.0), mbz = T(0.0);
+		for (int i = 0; i < N; ++i)
+		{
+			mcx += c[i].x; mcy += c[i].y; mcz += c[i].z;
+			mbx += b[i].x; mby += b[i].y; mbz += b[i].z;
+		}
+
+		const T invN = T(1.0 / N);
+		mcx *= invN; mcy *= invN; mcz *= invN;
+		mbx *= invN; mby *= invN; mbz *= invN;
+
+		T sbb = T(0.0), sbc = T(0.0);
+		for (int i = 0; i < N; ++i)
+		{
+			const T dbx = b[i].x - mbx, dby = b[i].y - mby, dbz = b[i].z - mbz;
+			sbb += dbx*dbx + dby*dby + dbz*dbz;
+			sbc += dbx*(c[i].x - mcx) + dby*(c[i].y - mcy) + dbz*(c[i].z - mcz);
+		}
+
+		//sum(|B_i|^2) = sum(|B_i - mean(B)|^2) + N * |mean(B)|^2
+		const T energy = sbb + T((double)N) * (mbx*mbx + mby*mby + mbz*mbz);
+		const double epsilon = N * machineEpsilon(sbb);
+		const T variance = sbb - T(kDegenerateRounding * epsilon * epsilon) * energy;
+
+		alpha = zeroUnlessAbove(variance, kDegenerateVariance, T(1.0) - sbc / sbb);
+		const T background = T(1.0) - alpha;
+		af.x = zeroUnlessAbove(variance, kDegenerateVariance, mcx - background*mbx);
+		af.y = zeroUnlessAbove(variance, kDegenerateVariance, mcy - background*mby);
+		af.z = zeroUnlessAbove(variance, kDegenerateVariance, mcz - background*mbz);
+
+		spread = sbb / energy;
+	}
+
+	/**
+	* Returns the root mean square of the least squares residual C_i - AF - (1 - alpha) * B_i over the
+	* 3N channel values of a pixel, for the alpha and AF actually returned by solve.
+	* */
+	template<int N, class T>
+	inline T residual(const Rgb<T>* c, const Rgb<T>* b, const T& alpha, const Rgb<T>& af)
+	{
+		const T background = T(1.0) - alpha;
+		T ss = T(0.0);
+		for (int i = 0; i < N; ++i)
+		{
+			const T rx = c[i].x - af.x - background*b[i].x;
+			const T ry = c[i].y - af.y - background*b[i].y;
+			const T rz = c[i].z - af.z - background*b[i].z;
+			ss += rx*rx + ry*ry + rz*rz;
+		}
+		return squareRoot(ss * T(1.0 / (3 * N)));
+	}
+
+	/** Pointers to one row of every image of a solve. In and Out are the element types of the inputs and outputs. */
+	template<class In, class Out>
+	struct SolveRow
+	{
+		const In* c[kMaxColours];
+		const In* b[kMaxColours];
+		Out* A;
+		Out* F;
+		Out* AF;
+
+		//Whether A has three identical channels rather than one.
+		bool alphaRgb;
+
+		//The optional quality maps, or null.
+		float* residual;
+		float* conditioning;
+	};
+
+	/** Stores the alpha, foreground, alpha-premultiplied foreground and conditioning of the pixels at column j. */
+	template<class T, class In, class Out>
+	inline void storeResult(const SolveRow<In, Out>& row, int j, const T& alpha, const Rgb<T>& af, const Rgb<T>& f,
+		const T& spread)
+	{
+		if (row.alphaRgb)
+		{
+			const Rgb<T> grey = { alpha, alpha, alpha };
+			store(row.A + j * 3, grey);
+		}
+		else
+			store(row.A + j, alpha);
+		store(row.AF + j * 3, af);
+		store(row.F + j * 3, f);
+
+		if (row.conditioning)
+			store(row.conditioning + j, zeroUnlessAbove(spread, 0.0, squareRoot(spread)));
+	}
+
+	/** As above, computing the foreground as af / alpha. */
+	template<class T, class In, class Out>
+	inline void storeResult(const SolveRow<In, Out>& row, int j, const T& alpha, const Rgb<T>& af, const T& spread)
+	{
+		Rgb<T> f;
+		f.x = af.x / alpha;
+		f.y = af.y / alpha;
+		f.z = af.z / alpha;
+		storeResult(row, j, alpha, af, f, spread);
+	}
+
+	/**
+	* Solves the pixels starting at column j of one row: a single pixel if T is a scalar, or
+	* T::kLanes pixels if T is a simd::Pack.
+	*
+	* If noise is positive, pixels whose colour in front of every backdrop differs from the backdrop by at
+	* most noise in every channel are pure background, and get alpha = 0 and AF = 0 like an unsolvable
+	* pixel. When every pixel of the batch is pure background the solve is skipped altogether, unless a
+	* conditioning map is wanted, which needs the spread.
+	* @param spread Receives the backdrop spread of each pixel, or 1 if the solve was skipped.
+	* @return A bit per pixel, set for pure background.
+	* */
+	template<int N, class T, class In, class Out>
+	inline unsigned long long solveAt(const SolveRow<In, Out>& row, int j, double noise, T& spread)
+	{
+		Rgb<T> c[N];
+		Rgb<T> b[N];
+		for (int i = 0; i < N; ++i)
+		{
+			load(row.c[i] + j * 3, c[i]);
+			load(row.b[i] + j * 3, b[i]);
+		}
+
+		T alpha;
+		Rgb<T> af;
+		T difference;
+		unsigned long long background = 0;
+		if (noise > 0)
+		{
+			difference = T(0.0);
+			for (int i = 0; i < N; ++i)
+				difference = maximum(difference, maximum(absolute(c[i].x - b[i].x),
+					maximum(absolute(c[i].y - b[i].y), absolute(c[i].z - b[i].z))));
+			background = atMostMask(difference, noise);
+
+			if (background == (1ULL << laneCount(difference)) - 1 && !row.conditioning)
+			{
+				//The result of dividing by alpha is the same 0 / 0 as for an unsolvable pixel.
+				alpha = T(0.0);
+				af.x = af.y = af.z = T(0.0);
+				const T undefined = T(std::numeric_limits<double>::quiet_NaN());
+				const Rgb<T> f = { undefined, undefined, undefined };
+				spread = T(1.0);
+				storeResult(row, j, alpha, af, f, spread);
+				if (row.residual)
+					store(row.residual + j, residual<N>(c, b, alpha, af));
+				return background;
+			}
+		}
+
+		solve<N>(c, b, alpha, af, spread);
+
+		if (background)
+		{
+			alpha = zeroUnlessAbove(difference, noise, alpha);
+			af.x = zeroUnlessAbove(difference, noise, af.x);
+			af.y = zeroUnlessAbove(difference, noise, af.y);
+			af.z = zeroUnlessAbove(difference, noise, af.z);
+		}
+
+		storeResult(row, j, alpha, af, spread);
+		if (row.residual)
+			store(row.residual + j, residual<N>(c, b, alpha, af));
+		return background;
+	}
+
+	/** Returns the number of bits set in mask. */
+	inline int countBits(unsigned long long mask)
+	{
+		int count = 0;
+		for (; mask; mask &= mask - 1)
+			++count;
+		return count;
+	}
+
+	/** The images of one solve. */
+	struct SolveImages
+	{
+		//N images with each backdrop, either CV_32FC3 normalised to [0;1] or CV_16UC3, which is
+		//normalised while it is loaded so that no float copy of the inputs is needed.
+		const cv::Mat* c;
+
+		//N images of each backdrop, of the same type as c.
+		const cv::Mat* b;
+
+		//The alpha, foreground and alpha-premultiplied foreground outputs. F and AF are both CV_32FC3, or
+		//both CV_16UC3 to have the results quantised as they are written, as convertTo(CV_16U, 65535)
+		//would. A has the depth of F and either one channel or three identical ones.
+		cv::Mat* A;
+		cv::Mat* F;
+		cv::Mat* AF;
+
+		//Optional CV_32FC1 quality maps, filled in the same pass when not null. The residual is the root
+		//mean square least squares residual of each pixel (see residual()). The conditioning is the
+		//square root of the backdrop spread (see solve()), to which the error in alpha is roughly
+		//inversely proportional; it is 0 for pixels that could not be solved.
+		cv::Mat* residual;
+		cv::Mat* conditioning;
+	};
+
+	/** Adds one row of the quality maps to the statistics. */
+	inline void gatherQuality(const float* residual, const float* conditioning, int cols,
+		const SolveSettings& settings, SolveStats& stats)
+	{
+		if (residual)
+			for (int j = 0; j < cols; ++j)
+			{
+				stats.residualSum += residual[j];
+				stats.residualMax = std::max(stats.residualMax, (double)residual[j]);
+				if (!(residual[j] <= settings.residualLimit))
+					++stats.badResidual;
+			}
+
+		if (conditioning)
+			for (int j = 0; j < cols; ++j)
+				if (!(conditioning[j] >= settings.conditioningLimit))
+					++stats.illConditioned;
+	}
+
+	/**
+	* Solves rows [rowBegin, rowEnd) for N backdrops with scalar type S (float or double). Pixels are
+	* solved in SIMD batches where the build enables AVX2 or AVX-512, with the remainder of each row going
+	* through the scalar path, which gives identical results. In and Out are the element types of the
+	* inputs and outputs.
+	* @param refineBelow If positive, pixels with a backdrop spread below this are solved again in double.
+	* */
+	template<int N, class S, class In, class Out>
+	void solveRowsAs(const SolveImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		double refineBelow, SolveStats& stats)
+	{
+		const double noise = settings.backgroundNoise;
+		SolveRow<In, Out> r;
+		r.alphaRgb = images.A->channels() == 3;
+		const bool refine = refineBelow > 0;
+		const int cols = images.A->cols;
+
+		for (int row = rowBegin; row < rowEnd; ++row)
+		{
+			for (int i = 0; i < N; ++i)
+			{
+				r.c[i] = (const In*)(images.c[i].data + row*images.c[i].step);
+				r.b[i] = (const In*)(images.b[i].data + row*images.b[i].step);
+			}
+
+			r.A = (Out*)(images.A->data + row*images.A->step);
+			r.F = (Out*)(images.F->data + row*images.F->step);
+			r.AF = (Out*)(images.AF->data + row*images.AF->step);
+			r.residual = images.residual ? (float*)(images.residual->data + row*images.residual->step) : nullptr;
+			r.conditioning = images.conditioning ?
+				(float*)(images.conditioning->data + row*images.conditioning->step) : nullptr;
+
+			double unused;
+			int j = 0;
+#ifdef GG_SIMD
+			typedef typename simd::PackOf<S>::type P;
+			for (; j + P::kLanes <= cols; j += P::kLanes)
+			{
+				P spread;
+				const unsigned long long background = solveAt<N, P>(r, j, noise, spread);
+				if (background)
+				{
+					const int pure = countBits(background);
+					stats.background += pure;
+					if (pure == P::kLanes && !r.conditioning)
+						stats.skipped += pure;
+				}
+				if (!refine)
+					continue;
+
+				unsigned long long mask = belowMask(spread, refineBelow);
+				for (int lane = 0; mask; ++lane, mask >>= 1)
+					if (mask & 1)
+					{
+						solveAt<N, double>(r, j + lane, noise, unused);
+						++stats.refined;
+					}
+			}
+#endif
+			for (; j < cols; j++)
+			{
+				S spread;
+				if (solveAt<N, S>(r, j, noise, spread))
+				{
+					++stats.background;
+					if (!r.conditioning)
+						++stats.skipped;
+				}
+				if (refine && belowMask(spread, refineBelow))
+				{
+					solveAt<N, double>(r, j, noise, unused);
+					++stats.refined;
+				}
+			}
+
+			//The row of the maps is still in cache, so summarising it here avoids another pass.
+			gatherQuality(r.residual, r.conditioning, cols, settings, stats);
+		}
+
+		stats.pixels += (long long)(rowEnd - rowBegin) * cols;
+	}
+
+	/** Solves rows [rowBegin, rowEnd) for N backdrops with inputs of element type In and outputs of type Out. */
+	template<int N, class In, class Out>
+	void solveRowsFrom(const SolveImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats)
+	{
+		switch (settings.precision)
+		{
+		case Precision::Float32:
+			solveRowsAs<N, float, In, Out>(images, settings, rowBegin, rowEnd, 0, stats);
+			break;
+		case Precision::Mixed:
+			solveRowsAs<N, float, In, Out>(images, settings, rowBegin, rowEnd, settings.refineBelow, stats);
+			break;
+		default:
+			solveRowsAs<N, double, In, Out>(images, settings, rowBegin, rowEnd, 0, stats);
+			break;
+		}
+	}
+
+	/**
+	* Solves rows [rowBegin, rowEnd) for N backdrops in the precision given by the settings.
+	* @param stats Receives counts for these rows.
+	* */
+	template<int N>
+	void solveRows(const SolveImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats)
+	{
+		const bool in16 = images.c[0].depth() == CV_16U;
+		const bool out16 = images.F->depth() == CV_16U;
+		if (in16 && out16)
+			solveRowsFrom<N, uint16_t, uint16_t>(images, settings, rowBegin, rowEnd, stats);
+		else if (in16)
+			solveRowsFrom<N, uint16_t, float>(images, settings, rowBegin, rowEnd, stats);
+		else if (out16)
+			solveRowsFrom<N, float, uint16_t>(images, settings, rowBegin, rowEnd, stats);
+		else
+			solveRowsFrom<N, float, float>(images, settings, rowBegin, rowEnd, stats);
+	}
+
+	/** The signature shared by every solveRows specialisation. */
+	typedef void(*RowSolver)(const SolveImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats);
+
+	/** Returns the solveRows specialisation for n backdrops, or null if n is outside [kMinColours, kMaxColours]. */
+	RowSolver rowSolver(int n);
+
+#define GG_EXTERN_SOLVE_ROWS(N) extern template void solveRows<N>(const SolveImages&, const SolveSettings&, \
+	int, int, SolveStats&);
+	GG_EXTERN_SOLVE_ROWS(2) GG_EXTERN_SOLVE_ROWS(3) GG_EXTERN_SOLVE_ROWS(4) GG_EXTERN_SOLVE_ROWS(5)
+	GG_EXTERN_SOLVE_ROWS(6) GG_EXTERN_SOLVE_ROWS(7) GG_EXTERN_SOLVE_ROWS(8) GG_EXTERN_SOLVE_ROWS(9)
+	GG_EXTERN_SOLVE_ROWS(10) GG_EXTERN_SOLVE_ROWS(11) GG_EXTERN_SOLVE_ROWS(12)
+#undef GG_EXTERN_SOLVE_ROWS
+
+	/**
+	* The background factor of a pixel: everything the solve needs from the images of the backdrops. Since
+	* the deviations B_i - mean(B) sum to zero, solve() reduces to
+	*     1 - alpha = sum(w_i . C_i),  with w_i = (B_i - mean(B)) / sum(|B_i - mean(B)|^2)
+	*     AF = mean(C) - (1 - alpha) * mean(B)
+	* so once w_i and mean(B) are known, a pixel is a multiply-add over its foreground colours.
+	*
+	* Factors are stored as factorPlanes(n) float planes per row: w_i.x, w_i.y and w_i.z for every backdrop
+	* but the last, then mean(B).x, .y and .z. Nothing that can be derived is stored, so a factor takes as
+	* many values as the backdrops it replaces: since the w_i sum to zero, the last is minus the sum of the
+	* others, and since sum(|w_i|^2) = 1 / sum(|B_i - mean(B)|^2), the backdrop spread is
+	*     1 / (1 + n * |mean(B)|^2 * sum(|w_i|^2))
+	* All the w_i are 0 for pixels that cannot be solved, which gives them a spread of 0.
+	* */
+	inline int factorPlanes(int n)
+	{
+		return 3 * n;
+	}
+
+	/**
+	* Computes the background factors of one row in double precision.
+	* @param pb Row pointers to the n images of each backdrop.
+	* @param out Receives factorPlanes(n) planes of cols floats.
+	* */
+	template<class In>
+	void factorRow(const In* const* pb, int n, int cols, float* out)
+	{
+		for (int j = 0; j < cols; ++j)
+		{
+			Rgb<double> b[kMaxColours];
+			Rgb<double> mean = { 0.0, 0.0, 0.0 };
+			for (int i = 0; i < n; ++i)
+			{
+				load(pb[i] + j * 3, b[i]);
+				mean.x += b[i].x; mean.y += b[i].y; mean.z += b[i].z;
+			}
+			mean.x /= n; mean.y /= n; mean.z /= n;
+
+			double sbb = 0.0;
+			for (int i = 0; i < n; ++i)
+			{
+				b[i].x -= mean.x; b[i].y -= mean.y; b[i].z -= mean.z;
+				sbb += b[i].x*b[i].x + b[i].y*b[i].y + b[i].z*b[i].z;
+			}
+
+			const double scale = sbb > kDegenerateVariance ? 1.0 / sbb : 0.0;
+			for (int i = 0; i < n - 1; ++i)
+			{
+				out[(3 * i) * cols + j] = (float)(b[i].x * scale);
+				out[(3 * i + 1) * cols + j] = (float)(b[i].y * scale);
+				out[(3 * i + 2) * cols + j] = (float)(b[i].z * scale);
+			}
+			out[(3 * n - 3) * cols + j] = (float)mean.x;
+			out[(3 * n - 2) * cols + j] = (float)mean.y;
+			out[(3 * n - 1) * cols + j] = (float)mean.z;
+		}
+	}
+
+	/**
+	* Solves the pixels starting at column j of one row from their background factors.
+	* @param factor The factorPlanes(n) planes of the row, each cols floats long.
+	* */
+	template<class T, class In, class Out>
+	inline void applyFactorAt(const SolveRow<In, Out>& row, const float* factor, int n, int cols, int j)
+	{
+		T mcx = T(0.0), mcy = T(0.0), mcz = T(0.0);
+		T background = T(0.0);
+		Rgb<T> last = { T(0.0), T(0.0), T(0.0) };
+		T ww = T(0.0);
+		for (int i = 0; i < n; ++i)
+		{
+			Rgb<T> c;
+			Rgb<T> w;
+			load(row.c[i] + j * 3, c);
+			if (i < n - 1)
+			{
+				load(factor + (3 * i) * cols + j, w.x);
+				load(factor + (3 * i + 1) * cols + j, w.y);
+				load(factor + (3 * i + 2) * cols + j, w.z);
+				last.x += w.x; last.y += w.y; last.z += w.z;
+			}
+			else
+			{
+				w.x = T(0.0) - last.x; w.y = T(0.0) - last.y; w.z = T(0.0) - last.z;
+			}
+			background += w.x*c.x + w.y*c.y + w.z*c.z;
+			ww += w.x*w.x + w.y*w.y + w.z*w.z;
+			mcx += c.x; mcy += c.y; mcz += c.z;
+		}
+
+		const T invN = T(1.0 / n);
+		mcx *= invN; mcy *= invN; mcz *= invN;
+
+		Rgb<T> mb;
+		load(factor + (3 * n - 3) * cols + j, mb.x);
+		load(factor + (3 * n - 2) * cols + j, mb.y);
+		load(factor + (3 * n - 1) * cols + j, mb.z);
+		const T spread = zeroUnlessAbove(ww, 0.0,
+			T(1.0) / (T(1.0) + T((double)n) * (mb.x*mb.x + mb.y*mb.y + mb.z*mb.z) * ww));
+
+		const T alpha = zeroUnlessAbove(spread, 0.0, T(1.0) - background);
+		background = T(1.0) - alpha;
+		Rgb<T> af;
+		af.x = zeroUnlessAbove(spread, 0.0, mcx - background*mb.x);
+		af.y = zeroUnlessAbove(spread, 0.0, mcy - background*mb.y);
+		af.z = zeroUnlessAbove(spread, 0.0, mcz - background*mb.z);
+
+		storeResult(row, j, alpha, af, spread);
+	}
+
+	/** The images of a solve from background factors. */
+	struct FactorImages
+	{
+		//n images with each backdrop, as in SolveImages.
+		const cv::Mat* c;
+		int n;
+
+		//CV_32FC1, with each row holding the factorPlanes(n) planes of that row of the image.
+		const cv::Mat* factor;
+
+		//The outputs, as in SolveImages. The residual cannot be computed without the backdrops.
+		cv::Mat* A;
+		cv::Mat* F;
+		cv::Mat* AF;
+		cv::Mat* conditioning;
+	};
+
+	/** Solves rows [rowBegin, rowEnd) from their background factors with scalar type S (float or double). */
+	template<class S, class In, class Out>
+	void applyFactorRowsAs(const FactorImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats)
+	{
+		SolveRow<In, Out> r;
+		r.alphaRgb = images.A->channels() == 3;
+		r.residual = nullptr;
+		const int cols = images.A->cols;
+
+		for (int row = rowBegin; row < rowEnd; ++row)
+		{
+			for (int i = 0; i < images.n; ++i)
+				r.c[i] = (const In*)(images.c[i].data + row*images.c[i].step);
+			r.A = (Out*)(images.A->data + row*images.A->step);
+			r.F = (Out*)(images.F->data + row*images.F->step);
+			r.AF = (Out*)(images.AF->data + row*images.AF->step);
+			r.conditioning = images.conditioning ?
+				(float*)(images.conditioning->data + row*images.conditioning->step) : nullptr;
+			const float* factor = (const float*)(images.factor->data + row*images.factor->step);
+
+			int j = 0;
+#ifdef GG_SIMD
+			typedef typename simd::PackOf<S>::type P;
+			for (; j + P::kLanes <= cols; j += P::kLanes)
+				applyFactorAt<P>(r, factor, images.n, cols, j);
+#endif
+			for (; j < cols; j++)
+				applyFactorAt<S>(r, factor, images.n, cols, j);
+
+			gatherQuality(nullptr, r.conditioning, cols, settings, stats);
+		}
+
+		stats.pixels += (long long)(rowEnd - rowBegin) * cols;
+	}
+
+	/**
+	* Solves rows [rowBegin, rowEnd) from their background factors. Float32 applies them in float and the
+	* other precisions in double; either way the factors themselves were rounded to float when stored.
+	* */
+	template<class In, class Out>
+	void applyFactorRowsFrom(const FactorImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats)
+	{
+		if (settings.precision == Precision::Float32)
+			applyFactorRowsAs<float, In, Out>(images, settings, rowBegin, rowEnd, stats);
+		else
+			applyFactorRowsAs<double, In, Out>(images, settings, rowBegin, rowEnd, stats);
+	}
+
+	/** Solves rows [rowBegin, rowEnd) from their background factors, for any supported input and output types. */
+	inline void applyFactorRows(const FactorImages& images, const SolveSettings& settings, int rowBegin, int rowEnd,
+		SolveStats& stats)
+	{
+		const bool in16 = images.c[0].depth() == CV_16U;
+		const bool out16 = images.F->depth() == CV_16U;
+		if (in16 && out16)
+			applyFactorRowsFrom<uint16_t, uint16_t>(images, settings, rowBegin, rowEnd, stats);
+		else if (in16)
+			applyFactorRowsFrom<uint16_t, float>(images, settings, rowBegin, rowEnd, stats);
+		else if (out16)
+			applyFactorRowsFrom<float, uint16_t>(images, settings, rowBegin, rowEnd, stats);
+		else
+			applyFactorRowsFrom<float, float>(images, settings, rowBegin, rowEnd, stats);
+	}
+}
@@ -5,68 +5,1098 @@
 
 #include "io.h"
 #include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cctype>
 #include <opencv2/opencv.hpp>
 #include "rawrgbchar.h"
 #include "groundtruth.h"
+#include "workersocket.h"
+#include "sharedframes.h"
+#include "capturebundle.h"
+#include "pngwriter.h"
+#include "floatimage.h"
+#include "trace.h"
 
 /**
 * Arguments:
 * @arg The name of the program (default argument)
-* @arg Colour1Path The filename of the foreground image with colour 1
-* @arg Colour2Path The filename of the foreground image with colour 2
-* @arg Colour3Path The filename of the foreground image with colour 3
-* @arg Colour4Path The filename of the foreground image with colour 4
-* @arg Colour5Path The filename of the foreground image with colour 5
-* @arg Colourb1Path  The filename of the background image with colour 1
-* @arg Colourb2Path  The filename of the background image with colour 2
-* @arg Colourb3Path  The filename of the background image with colour 3
-* @arg Colourb4Path  The filename of the background image with colour 4
-* @arg Colourb5Path  The filename of the background image with colour 5
+* @arg Colour1Path ... ColourNPath The filenames of the foreground images with colours 1 to N
+* @arg Colourb1Path ... ColourbNPath The filenames of the background images with colours 1 to N
 * @arg APath The name of the output alpha file
 * @arg FPath The name of the output foreground file
 * @arg AFPath The name of the output alpha-applied foreground file
+* N is deduced from the number of paths, and must be between GG::kMinColours and GG::kMaxColours.
+*
+* Options may be given anywhere among the arguments:
+* --threads N  The number of threads to solve with. Defaults to 0, meaning every hardware thread.
+* --precision P  float32, float64 (default) or mixed. Mixed solves in float32 and repeats badly
+*                conditioned pixels in float64, reporting how many there were.
+* --refine-below S  In mixed precision, the backdrop spread below which a pixel is repeated. Default 1e-6.
+* --band-rows R  Streams the images R rows at a time instead of loading them whole, capping peak memory
+*                at about R * width * (18 * 2N + 36) bytes. The outputs are then always PNG files.
+*                Defaults to 0, which loads whole images.
+* --png-compression L  The compression level of PNG outputs, from 0 (uncompressed, fastest) to 9 (smallest).
+*                Each file is cut into chunks compressed on every thread. Default 1.
+*
+* Outputs whose paths end in .npy or .rawf are saved as uncompressed float32 files that can be mapped into
+* memory (see floatimage.h), and A, F and AF are then solved without quantising them to 16 bits. Any other
+* outputs of the set are quantised as usual. Float outputs cannot be streamed with --band-rows.
+* --background-noise T  Gives alpha = 0 without solving to pixels whose colours in front of every backdrop
+*                match the backdrop to within T of full scale (e.g. 0.001). Default 0, which solves every pixel.
+* --alpha-channels C  3 (default) saves the alpha as an RGB image, 1 as a greyscale image a third of the size.
+* --residual PATH, --conditioning PATH  Computes the residual and conditioning maps during the solve and
+*                saves them to these 16 bit greyscale images, scaled by 65535, printing a summary. Both
+*                must be given together.
+* --residual-limit R  The residual above which a pixel counts as bad. Default 0.01.
+* --conditioning-limit K  The conditioning below which a pixel counts as bad. Default 0.01.
+* --reject-above F  Fails, like any other generation error, if a larger share F of the pixels is bad.
+*                Default 1 (never).
+* --roi X,Y,W,H  Reads and solves only the W by H pixels at X,Y of the inputs. Alpha, F and AF are 0 elsewhere.
+* --auto-roi T  Solves only the bounding box, plus a margin, of the pixels where the first foreground differs
+*                from its background by more than T of full scale (e.g. 0.05), within --roi if given.
+* --frame X,Y,W,H  The inputs were cropped at X,Y from a W by H capture. The outputs are W by H, with alpha 0
+*                outside the crop.
+*
+* A quick look at the result can come before the full solve, so that a bad capture is seen at once:
+* --preview PATH  First solves the region at a fraction of its resolution and saves the alpha-premultiplied
+*                foreground over grey to the PNG file PATH, then solves at full resolution as usual. A worker
+*                reports it with a "status preview PATH" line (see workersocket.h).
+* --preview-scale S  The preview is 1/S of the resolution in each direction, from 2 to 16. Default 4.
+* --preview-skip T  Leaves transparent, without solving them, the 64 pixel tiles around which the preview
+*                alpha is nowhere above T (e.g. 0.02), so that only the tiles holding the object are solved
+*                at full resolution. Default 0, which solves every tile. Implies a preview even without PATH.
+*
+* Background caches let many objects be shot against the same backdrops without keeping their images:
+* --write-background-cache PATH  The arguments are instead the N background image paths. Computes their
+*                background factors and saves them to PATH, without generating any ground truth.
+* --background-cache PATH  The arguments are instead the N foreground paths followed by the A, F and AF
+*                output paths; the backgrounds come from the cache at PATH. Mixed precision and
+*                --background-noise need the backgrounds, so cannot be used with it.
+*
+* A worker keeps running between capture sets, so that they do not pay for starting the process:
+* --serve PATH  Listens on a Unix domain socket at PATH for jobs from CameraControl (see workersocket.h)
+*                until told to quit. The other options are the defaults for every job.
+*
+* CameraControl may hand over the images without writing them to files:
+* --shared-frames NAME  The arguments are instead only the A, F and AF output paths. The N foregrounds and
+*                N backgrounds are read in place from the shared memory segment NAME (see sharedframes.h),
+*                which holds the 2N frames in that order.
+*
+* A capture set may be kept in a single file, a capture bundle (see capturebundle.h):
+* --bundle PATH  The arguments are instead only the A, F and AF output paths. The N foregrounds and N
+*                backgrounds are read from the bundle at PATH, a tile at a time with --band-rows.
+* --write-bundle PATH  The arguments are instead the 2N .rawrgb input paths, foregrounds first. Packs them
+*                into a bundle at PATH, without generating any ground truth.
+*
+* Archives of many capture sets can be processed in one run:
+* --manifest PATH  No paths are given as arguments. Instead, each line of the file at PATH lists the 2N+3
+*                paths of one capture set, as they would be given as arguments, quoting paths with spaces.
+*                Blank lines and lines starting with # are skipped. While one set is solved, the next is
+*                loaded and the outputs of the previous one are saved, and the time taken by each stage is
+*                reported. The other options apply to every set; the exit code is that of the first set to
+*                fail, after the rest have been processed.
+*
+* Where the time of a capture goes can be recorded for a trace viewer (see trace.h):
+* --trace PATH  Appends spans for loading, solving and saving to the Chrome trace-event file PATH, which
+*                CameraControl passes on when its GROUND_TRUTH_TRACE environment variable names one. A
+*                worker records each job to the trace its own --trace names.
 */
 
-int main(int argc, char** argv)
+/** Paths given through options rather than as positional arguments. */
+struct OptionPaths
 {
-	Inform("Entered Ground Truth generator");
+	std::string residual;
+	std::string conditioning;
+	std::string writeBackgroundCache;
+	std::string backgroundCache;
+	std::string manifest;
+	std::string serve;
+	std::string sharedFrames;
+	std::string bundle;
+	std::string writeBundle;
+	std::string preview;
+	std::string trace;
+};
+
+/** Reads a rectangle given as X,Y,W,H, returning false if it is malformed. */
+static bool ParseRect(const std::string& value, cv::Rect& rect)
+{
+	std::istringstream ss(value);
+	char comma[3];
+	return (ss >> rect.x >> comma[0] >> rect.y >> comma[1] >> rect.width >> comma[2] >> rect.height) &&
+		comma[0] == ',' && comma[1] == ',' && comma[2] == ',' && rect.width > 0 && rect.height > 0 && ss.eof();
+}
 
-	if(argc != 14)
+/**
+* Separates the options from the positional arguments.
+* @return false if an option is unknown or malformed.
+* */
+static bool ParseArguments(const std::vector<std::string>& arguments, std::vector<std::string>& positional,
+	GroundTruthOptions& options, OptionPaths& paths)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
 	{
-		Error("Invalid number of arguments: Expected 14, received " + ToString(argc));
-		return 1;
+		const std::string& arg = arguments[i];
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			positional.push_back(arg);
+			continue;
+		}
+
+		if (i + 1 >= arguments.size())
+		{
+			Error("Missing value for " + arg);
+			return false;
+		}
+		const std::string& value = arguments[++i];
+
+		if (arg == "--threads")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.threads))
+			{
+				Error("Invalid thread count " + value);
+				return false;
+			}
+		}
+		else if (arg == "--precision")
+		{
+			if (value == "float32")
+				options.solver.precision = GG::Precision::Float32;
+			else if (value == "float64")
+				options.solver.precision = GG::Precision::Float64;
+			else if (value == "mixed")
+				options.solver.precision = GG::Precision::Mixed;
+			else
+			{
+				Error("Invalid precision " + value + ", expected float32, float64 or mixed");
+				return false;
+			}
+		}
+		else if (arg == "--refine-below")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.solver.refineBelow))
+			{
+				Error("Invalid spread " + value);
+				return false;
+			}
+		}
+		else if (arg == "--band-rows")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.bandRows) || options.bandRows < 0)
+			{
+				Error("Invalid band height " + value);
+				return false;
+			}
+		}
+		else if (arg == "--png-compression")
+		{
+			if (value.size() == 1 && value[0] >= '0' && value[0] <= '9')
+				options.pngCompression = value[0] - '0';
+			else
+			{
+				Error("Invalid PNG compression level " + value + ", expected 0 to 9");
+				return false;
+			}
+		}
+		else if (arg == "--alpha-channels")
+		{
+			if (value == "1" || value == "3")
+				options.alphaChannels = value[0] - '0';
+			else
+			{
+				Error("Invalid alpha channel count " + value + ", expected 1 or 3");
+				return false;
+			}
+		}
+		else if (arg == "--roi" || arg == "--frame")
+		{
+			if (!ParseRect(value, arg == "--roi" ? options.roi : options.frame))
+			{
+				Error("Invalid rectangle " + value + " for " + arg + ", expected X,Y,W,H");
+				return false;
+			}
+		}
+		else if (arg == "--residual")
+			paths.residual = value;
+		else if (arg == "--conditioning")
+			paths.conditioning = value;
+		else if (arg == "--write-background-cache")
+			paths.writeBackgroundCache = value;
+		else if (arg == "--background-cache")
+			paths.backgroundCache = value;
+		else if (arg == "--manifest")
+			paths.manifest = value;
+		else if (arg == "--serve")
+			paths.serve = value;
+		else if (arg == "--shared-frames")
+			paths.sharedFrames = value;
+		else if (arg == "--bundle")
+			paths.bundle = value;
+		else if (arg == "--write-bundle")
+			paths.writeBundle = value;
+		else if (arg == "--preview")
+			paths.preview = value;
+		else if (arg == "--trace")
+			paths.trace = value;
+		else if (arg == "--preview-scale")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.previewScale) || options.previewScale < 2 || options.previewScale > 16)
+			{
+				Error("Invalid preview scale " + value + ", expected 2 to 16");
+				return false;
+			}
+		}
+		else if (arg == "--residual-limit" || arg == "--conditioning-limit" || arg == "--reject-above" ||
+			arg == "--background-noise" || arg == "--auto-roi" || arg == "--preview-skip")
+		{
+			double& limit = arg == "--residual-limit" ? options.solver.residualLimit :
+				arg == "--conditioning-limit" ? options.solver.conditioningLimit :
+				arg == "--background-noise" ? options.solver.backgroundNoise :
+				arg == "--auto-roi" ? options.autoRoi :
+				arg == "--preview-skip" ? options.previewSkipBelow : options.rejectAbove;
+			std::istringstream ss(value);
+			if (!(ss >> limit))
+			{
+				Error("Invalid limit " + value + " for " + arg);
+				return false;
+			}
+		}
+		else
+		{
+			Error("Unknown option " + arg);
+			return false;
+		}
 	}
 
-	//first five images are foregrounds, and the next five backgrounds
-	Inform("Loading temporaries");
-	RawRgbChar images[10];
+	return true;
+}
+
+/**
+* Returns the number of colours N given 2N+3 paths of a capture set.
+* @return 0 if the number of paths does not fit.
+* */
+static int ColoursFromPaths(size_t count)
+{
+	const int colours = ((int)count - 3) / 2;
+	if (count % 2 == 0 || colours < GG::kMinColours || colours > GG::kMaxColours)
+	{
+		Error("Invalid number of arguments: Expected 2N+3 paths for N between " + ToString(GG::kMinColours) +
+			" and " + ToString(GG::kMaxColours) + ", received " + ToString(count));
+		return 0;
+	}
+	return colours;
+}
 
-	for (int i = 0; i < 10; ++i)
+/**
+* Maps the foregrounds and backgrounds of a capture set into memory, wrapping each in a read-only Mat
+* without reading or copying it.
+* @param paths The 2N input paths, foregrounds first.
+* @param mappings Receives the mapped files, which must outlive the images.
+* @param pool The pool to decode version 2 files on, or nullptr to decode them on the calling thread.
+* @return 0, or the exit code 2 if an image could not be loaded.
+* */
+static int LoadImages(const std::string* paths, int colours, std::vector<RawRgbMapping>& mappings,
+	std::vector<cv::Mat>& images, ThreadPool* pool)
+{
+	TraceSpan span("load", paths[0]);
+	mappings.resize(2 * colours);
+	images.resize(2 * colours);
+	for (int i = 0; i < 2 * colours; ++i)
 	{
-		bool result = LoadRawRgb(argv[1 + i], images[i]);
-		if (!result)
+		if (!mappings[i].open(paths[i], pool))
 		{
-			Error("Could not load " + ToString(argv[1 + i]));
+			Error("Could not load " + paths[i]);
 			return 2;
 		}
+		images[i] = cv::Mat(mappings[i].height(), mappings[i].width(), CV_16UC3, (void*)mappings[i].pixels());
+	}
+	return 0;
+}
+
+/** Returns whether a path names a PNG file. */
+static bool IsPngPath(const std::string& path)
+{
+	if (path.size() < 4)
+		return false;
+	std::string extension = path.substr(path.size() - 4);
+	for (size_t i = 0; i < extension.size(); ++i)
+		extension[i] = (char)tolower((unsigned char)extension[i]);
+	return extension == ".png";
+}
+
+/** Returns whether any of count paths is of a float output (see floatimage.h). */
+static bool HasFloatOutputs(const std::string* paths, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		if (IsFloatImagePath(paths[i]))
+			return true;
+	return false;
+}
+
+/**
+* Saves the outputs of GenerateGroundTruth. Outputs saved as floats are scaled to [0;1] if they are 16 bit,
+* and float outputs saved in other formats are scaled to 16 bits. PNG files are cut into chunks that every
+* thread compresses (see PngWriter), one file after another, while any other formats are saved by OpenCV or
+* SaveFloatImage at the same time, each on its own thread.
+* @param paths As many paths as there are outputs.
+* @param pool The pool to compress on, or nullptr to create one of options.threads threads.
+* @return 0, or the exit code 4 if any output could not be saved.
+* */
+static int SaveOutputs(std::vector<cv::Mat>& groundTruth, const std::string* paths,
+	const GroundTruthOptions& options, ThreadPool* pool)
+{
+	TraceSpan span("save outputs");
+	std::vector<std::future<bool>> saved(groundTruth.size());
+	std::vector<size_t> pngs;
+	for (size_t i = 0; i < groundTruth.size(); ++i)
+	{
+		Inform("Saving " + paths[i]);
+		cv::Mat& image = groundTruth[i];
+		if (IsFloatImagePath(paths[i]))
+		{
+			if (image.depth() != CV_32F)
+				image.convertTo(image, CV_32F, 1.0 / 65535);
+			saved[i] = std::async(std::launch::async, [&image, paths, i] {
+				TraceSpan encode("save float", paths[i]);
+				return SaveFloatImage(paths[i], image);
+			});
+			continue;
+		}
+
+		if (image.depth() == CV_32F)
+			image.convertTo(image, CV_16U, 65535);
+		if (IsPngPath(paths[i]) && image.depth() == CV_16U && (image.channels() == 1 || image.channels() == 3))
+			pngs.push_back(i);
+		else
+			saved[i] = std::async(std::launch::async, [&image, paths, i, &options] {
+				TraceSpan encode("imwrite", paths[i]);
+				return cv::imwrite(paths[i], image, { cv::IMWRITE_PNG_COMPRESSION, options.pngCompression });
+			});
+	}
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool && !pngs.empty())
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
 	}
-	auto groundTruth = GenerateGroundTruth(&images[0], &images[5]);
 
-	if (groundTruth.size() != 3)
-		return 3;
-	
 	bool succeeded = true;
-	for (size_t i = 0; i < 3; ++i)
+	for (size_t i = 0; i < groundTruth.size(); ++i)
 	{
-		const std::string path = (argv[11 + i]);
-		Inform("Saving " + path);
-		if (!cv::imwrite(path, groundTruth[i]))
+		bool written;
+		if (saved[i].valid())
+			written = saved[i].get();
+		else
+		{
+			TraceSpan encode("encode png", paths[i]);
+			PngWriter writer;
+			const cv::Mat& image = groundTruth[i];
+			written = writer.open(paths[i], image.cols, image.rows, image.channels(), options.pngCompression) &&
+				writer.writeRows(image, pool) && writer.close();
+		}
+
+		if (!written)
 		{
-			Error("Could not save " + ToString(argv[11 + i]));
+			Error("Could not save " + paths[i]);
 			succeeded = false;
 		}
 	}
+	return succeeded ? 0 : 4;
+}
 
-	Inform("Exiting ground truth algorithm");
-	return succeeded ? 0:4;
+/**
+* Reads the capture sets listed in a manifest (see --manifest).
+* @return false if the file cannot be read or a line does not list a valid capture set.
+* */
+static bool ReadManifest(const std::string& path, std::vector<std::vector<std::string>>& jobs)
+{
+	std::ifstream in(path);
+	if (in.fail())
+	{
+		Error("Could not open manifest " + path);
+		return false;
+	}
+
+	std::string line;
+	for (int number = 1; std::getline(in, line); ++number)
+	{
+		const size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		std::vector<std::string> paths;
+		if (!SplitArguments(line, paths))
+		{
+			Error("Unterminated quote on line " + ToString(number) + " of " + path);
+			return false;
+		}
+
+		if (ColoursFromPaths(paths.size()) == 0)
+		{
+			Error("On line " + ToString(number) + " of " + path);
+			return false;
+		}
+		jobs.push_back(paths);
+	}
+
+	if (jobs.empty())
+	{
+		Error("The manifest " + path + " lists no capture sets");
+		return false;
+	}
+	return true;
+}
+
+/** Returns the seconds elapsed since start. */
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
+
+/** A capture set moving through the stages of a batch. */
+struct BatchJob
+{
+	std::vector<std::string> paths;
+	int colours = 0;
+	std::vector<RawRgbMapping> mappings;
+	std::vector<cv::Mat> images;
+	std::vector<cv::Mat> groundTruth;
+
+	//The exit code of the stage that failed, or 0.
+	int code = 0;
+
+	double loadSeconds = 0;
+	double solveSeconds = 0;
+	double saveSeconds = 0;
+};
+
+//Loading and saving in a batch each get this share of the threads, at least one, since they take far less
+//time than the solve they overlap. The solve gets the rest.
+static const unsigned kBatchStageShare = 8;
+
+/**
+* Generates the ground truth of every capture set in a manifest as a pipeline: while set i is solved on the
+* pool, set i + 1 is loaded and the outputs of set i - 1 are saved, each on a small pool kept for the whole
+* batch. At most three sets are held in memory at a time. With options.bandRows, the sets are instead
+* streamed one after another, since streaming already interleaves reading and writing with the solve.
+* @param pool The pool to solve on, whose size the loading and saving pools are sized from, or nullptr to share
+*             options.threads threads between a solve pool and them.
+* @return 0 if every set succeeded, otherwise the exit code of the first set to fail.
+* */
+static int RunBatch(const std::vector<std::vector<std::string>>& paths, const GroundTruthOptions& options,
+	ThreadPool* pool)
+{
+	const bool streamed = options.bandRows > 0;
+	std::vector<BatchJob> jobs(paths.size());
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		jobs[i].paths = paths[i];
+		jobs[i].colours = ColoursFromPaths(paths[i].size());
+		if (streamed && HasFloatOutputs(&paths[i][2 * jobs[i].colours], 3))
+		{
+			Error("Float outputs cannot be used with --band-rows, as in capture set " + ToString(i + 1));
+			return 1;
+		}
+	}
+
+	//Loading and saving overlap the solve, so they run on pools of their own, sized so that the three together
+	//have about as many threads as the solve alone would. A pool given keeps its size for the solve.
+	const unsigned threads = pool ? pool->size() :
+		options.threads > 0 ? (unsigned)options.threads : std::max(1u, std::thread::hardware_concurrency());
+	const unsigned stageThreads = streamed ? 0 : std::max(1u, threads / kBatchStageShare);
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(threads > 2 * stageThreads ? threads - 2 * stageThreads : 1));
+		pool = ownPool.get();
+	}
+	std::unique_ptr<ThreadPool> loadPool(streamed ? nullptr : new ThreadPool(stageThreads));
+	std::unique_ptr<ThreadPool> savePool(streamed ? nullptr : new ThreadPool(stageThreads));
+
+	auto load = [streamed, &loadPool](BatchJob* job) {
+		if (streamed)
+			return;
+		const auto start = std::chrono::steady_clock::now();
+		job->code = LoadImages(job->paths.data(), job->colours, job->mappings, job->images, loadPool.get());
+		job->loadSeconds = SecondsSince(start);
+	};
+	auto save = [&options, &savePool](BatchJob* job) {
+		if (job->code == 0 && !job->groundTruth.empty())
+		{
+			const auto start = std::chrono::steady_clock::now();
+			job->code = SaveOutputs(job->groundTruth, &job->paths[2 * job->colours], options, savePool.get());
+			job->saveSeconds = SecondsSince(start);
+		}
+		job->groundTruth.clear();
+	};
+	auto report = [&jobs](size_t i) {
+		const BatchJob& job = jobs[i];
+		Inform("Set " + ToString(i + 1) + " of " + ToString(jobs.size()) + (job.code ? " failed" : " done") +
+			": loaded in " + ToString(job.loadSeconds) + " s, solved in " + ToString(job.solveSeconds) +
+			" s, saved in " + ToString(job.saveSeconds) + " s");
+	};
+
+	if (streamed)
+		Inform("Processing " + ToString(jobs.size()) + " capture sets on " + ToString(pool->size()) + " threads");
+	else
+		Inform("Processing " + ToString(jobs.size()) + " capture sets on " + ToString(pool->size()) +
+			" threads, loading on " + ToString(loadPool->size()) + " and saving on " + ToString(savePool->size()));
+	const auto start = std::chrono::steady_clock::now();
+
+	std::future<void> loading = std::async(std::launch::async, load, &jobs[0]);
+	std::future<void> saving;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		BatchJob& job = jobs[i];
+		loading.get();
+		if (i + 1 < jobs.size())
+			loading = std::async(std::launch::async, load, &jobs[i + 1]);
+
+		const auto solveStart = std::chrono::steady_clock::now();
+		TraceSpan solve("solve set", job.paths[0]);
+		if (streamed)
+		{
+			if (!GenerateGroundTruthStreamed(&job.paths[0], &job.paths[job.colours], job.colours,
+				&job.paths[2 * job.colours], options, pool))
+				job.code = 4;
+		}
+		else if (job.code == 0)
+		{
+			GroundTruthOptions jobOptions = options;
+			jobOptions.floatOutputs = HasFloatOutputs(&job.paths[2 * job.colours], 3);
+			job.groundTruth = GenerateGroundTruth(&job.images[0], &job.images[job.colours], job.colours, jobOptions, pool);
+			if (job.groundTruth.size() != 3)
+				job.code = 3;
+		}
+		job.solveSeconds = SecondsSince(solveStart);
+		solve.end();
+		job.images.clear();
+		job.mappings.clear();
+
+		if (saving.valid())
+		{
+			saving.get();
+			report(i - 1);
+		}
+		saving = std::async(std::launch::async, save, &job);
+	}
+	saving.get();
+	report(jobs.size() - 1);
+
+	//With the stages overlapping, the wall time is less than the sum of their times.
+	double stageSeconds = 0;
+	int code = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		stageSeconds += jobs[i].loadSeconds + jobs[i].solveSeconds + jobs[i].saveSeconds;
+		if (jobs[i].code)
+		{
+			++failed;
+			if (!code)
+				code = jobs[i].code;
+		}
+	}
+	const double seconds = SecondsSince(start);
+	Inform("Processed " + ToString(jobs.size()) + " capture sets in " + ToString(seconds) + " s (" +
+		ToString(seconds / jobs.size()) + " s per set, " + ToString(stageSeconds) + " s of stages), " +
+		ToString(failed) + " failed");
+
+	return code;
+}
+
+/** Reports the stage a job has reached, for a worker to pass on to its client. */
+typedef std::function<void(const std::string&)> StatusCallback;
+
+//The preview scale when a preview is asked for without --preview-scale.
+static const int kDefaultPreviewScale = 4;
+
+/**
+* Packs .rawrgb images into a capture bundle, a tile at a time (see --write-bundle).
+* @param pool The pool to compress the tiles on, or nullptr to create one of options.threads threads.
+* @return The exit code of the run.
+* */
+static int WriteBundle(const std::vector<std::string>& inputs, const std::string& path, const GroundTruthOptions& options,
+	ThreadPool* pool)
+{
+	if (inputs.size() < 2 * GG::kMinColours || inputs.size() > 2 * GG::kMaxColours || inputs.size() % 2 != 0)
+	{
+		Error("Expected 2N input paths with --write-bundle for N between " + ToString(GG::kMinColours) + " and " +
+			ToString(GG::kMaxColours) + ", received " + ToString(inputs.size()));
+		return 1;
+	}
+
+	std::vector<RawRgbReader> readers(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		if (!readers[i].open(inputs[i]))
+		{
+			Error("Could not load " + inputs[i]);
+			return 2;
+		}
+		if (readers[i].width() != readers[0].width() || readers[i].height() != readers[0].height())
+		{
+			Error("Mismatched image sizes in " + inputs[i]);
+			return 2;
+		}
+	}
+
+	const int width = readers[0].width();
+	const int height = readers[0].height();
+	CaptureBundleWriter writer;
+	if (!writer.open(path, width, height, (int)inputs.size()))
+	{
+		Error("Could not create " + path);
+		return 4;
+	}
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+
+	Inform("Writing capture bundle " + path);
+	std::vector<std::vector<uint16_t>> tiles(inputs.size(), std::vector<uint16_t>((size_t)kCaptureBundleTileRows * width * 3));
+	std::vector<const uint16_t*> rows(inputs.size());
+	for (int row = 0; row < height; row += kCaptureBundleTileRows)
+	{
+		for (size_t i = 0; i < inputs.size(); ++i)
+		{
+			if (!readers[i].readRows(row, writer.tileRows(), &tiles[i][0]))
+			{
+				Error("Could not read rows " + ToString(row) + " to " + ToString(row + writer.tileRows()) + " of " + inputs[i]);
+				return 2;
+			}
+			rows[i] = &tiles[i][0];
+		}
+
+		if (!writer.writeTile(&rows[0], pool))
+		{
+			Error("Could not write " + path);
+			return 4;
+		}
+	}
+
+	if (!writer.close())
+	{
+		Error("Could not write " + path);
+		return 4;
+	}
+	return 0;
+}
+
+/**
+* Generates the ground truth of a capture set held in a capture bundle (see --bundle).
+* @param args The 3 output paths.
+* @return The exit code of the run.
+* */
+static int RunBundle(std::vector<std::string>& args, const GroundTruthOptions& options, const OptionPaths& paths,
+	ThreadPool* pool, const StatusCallback& status)
+{
+	if (args.size() != 3)
+	{
+		Error("Expected the A, F and AF output paths with --bundle, received " + ToString(args.size()) + " paths");
+		return 1;
+	}
+
+	if (options.qualityMaps)
+	{
+		args.push_back(paths.residual);
+		args.push_back(paths.conditioning);
+	}
+
+	if (options.bandRows > 0)
+	{
+		if (status)
+			status("solving");
+		return GenerateGroundTruthStreamed(paths.bundle, &args[0], options, pool) ? 0 : 4;
+	}
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+
+	Inform("Loading " + paths.bundle);
+	if (status)
+		status("loading");
+	TraceSpan load("load", paths.bundle);
+	CaptureBundleReader reader;
+	const int colours = reader.open(paths.bundle) ? reader.plates() / 2 : 0;
+	if (colours < GG::kMinColours || colours > GG::kMaxColours || reader.plates() % 2 != 0)
+	{
+		Error("Could not load " + paths.bundle + " as a capture bundle of 2N plates for N between " +
+			ToString(GG::kMinColours) + " and " + ToString(GG::kMaxColours));
+		return 2;
+	}
+
+	std::vector<cv::Mat> images(2 * colours);
+	std::vector<uint16_t*> out(2 * colours);
+	for (int i = 0; i < 2 * colours; ++i)
+	{
+		images[i].create(reader.height(), reader.width(), CV_16UC3);
+		out[i] = (uint16_t*)images[i].data;
+	}
+	if (!reader.readRegion(0, reader.height(), 0, reader.width(), &out[0], pool))
+	{
+		Error("Could not read " + paths.bundle);
+		return 2;
+	}
+	load.end();
+
+	if (status)
+		status("solving");
+	auto groundTruth = GenerateGroundTruth(&images[0], &images[colours], colours, options, pool);
+	images.clear();
+
+	if (groundTruth.size() != args.size())
+		return 3;
+
+	if (status)
+		status("saving");
+	return SaveOutputs(groundTruth, &args[0], options, pool);
+}
+
+/**
+* Generates the ground truth of a capture set whose frames are in shared memory (see --shared-frames). The
+* frames are solved where they lie, without being copied.
+* @param args The 3 output paths.
+* @return The exit code of the run.
+* */
+static int RunSharedFrames(std::vector<std::string>& args, const GroundTruthOptions& options,
+	const OptionPaths& paths, ThreadPool* pool, const StatusCallback& status)
+{
+	if (args.size() != 3)
+	{
+		Error("Expected the A, F and AF output paths with --shared-frames, received " + ToString(args.size()) + " paths");
+		return 1;
+	}
+
+	if (status)
+		status("loading");
+	TraceSpan load("open shared frames", paths.sharedFrames);
+	SharedFrames frames;
+	if (!frames.open(paths.sharedFrames))
+	{
+		Error("Could not open shared frames " + paths.sharedFrames);
+		return 2;
+	}
+	load.end();
+
+	const int colours = frames.count() / 2;
+	if (frames.count() % 2 != 0 || colours < GG::kMinColours || colours > GG::kMaxColours)
+	{
+		Error("Invalid number of shared frames: Expected 2N for N between " + ToString(GG::kMinColours) +
+			" and " + ToString(GG::kMaxColours) + ", received " + ToString(frames.count()));
+		return 2;
+	}
+
+	std::vector<cv::Mat> images(2 * colours);
+	for (int i = 0; i < 2 * colours; ++i)
+		images[i] = cv::Mat(frames.height(), frames.width(), CV_16UC3, frames.frame(i));
+
+	if (options.qualityMaps)
+	{
+		args.push_back(paths.residual);
+		args.push_back(paths.conditioning);
+	}
+
+	if (status)
+		status("solving");
+	auto groundTruth = GenerateGroundTruth(&images[0], &images[colours], colours, options, pool);
+	frames.close();
+
+	if (groundTruth.size() != args.size())
+		return 3;
+
+	if (status)
+		status("saving");
+	return SaveOutputs(groundTruth, &args[0], options, pool);
+}
+
+/**
+* Runs GroundTruth with parsed arguments, in whichever mode they select.
+* @param pool If given, the pool to solve on in every mode, so that a worker can keep it between jobs.
+* @param status If given, is told when a single capture set is loaded, solved and saved.
+* @return The exit code of the run.
+* */
+static int Run(std::vector<std::string>& args, GroundTruthOptions& options, const OptionPaths& paths,
+	ThreadPool* pool = nullptr, const StatusCallback& status = StatusCallback())
+{
+	if (paths.residual.empty() != paths.conditioning.empty())
+	{
+		Error("--residual and --conditioning must be given together");
+		return 1;
+	}
+	options.qualityMaps = !paths.residual.empty();
+
+	const bool cropped = options.roi.area() > 0 || options.autoRoi > 0 || options.frame.area() > 0;
+	if (cropped && (!paths.writeBackgroundCache.empty() || !paths.backgroundCache.empty()))
+	{
+		Error("--roi, --auto-roi and --frame cannot be used with background caches");
+		return 1;
+	}
+
+	const int sources = !paths.sharedFrames.empty() + !paths.bundle.empty() + !paths.writeBundle.empty() +
+		!paths.manifest.empty() + !paths.writeBackgroundCache.empty() + !paths.backgroundCache.empty();
+	if (sources > 1)
+	{
+		Error("Only one of --shared-frames, --bundle, --write-bundle, --manifest and the background cache options may be given");
+		return 1;
+	}
+
+	if (!paths.sharedFrames.empty() && options.bandRows > 0)
+	{
+		Error("--shared-frames cannot be used with --band-rows");
+		return 1;
+	}
+
+	const bool preview = !paths.preview.empty() || options.previewScale > 0 || options.previewSkipBelow > 0;
+	if (preview && (options.bandRows > 0 || !paths.manifest.empty() || !paths.writeBackgroundCache.empty() ||
+		!paths.backgroundCache.empty() || !paths.writeBundle.empty()))
+	{
+		Error("--preview, --preview-scale and --preview-skip cannot be used with --band-rows, --manifest, "
+			"--write-bundle or background caches");
+		return 1;
+	}
+	if (preview && options.previewScale == 0)
+		options.previewScale = kDefaultPreviewScale;
+	if (!paths.preview.empty())
+	{
+		const std::string previewPath = paths.preview;
+		options.onPreview = [previewPath, status](const cv::Mat& image) {
+			Inform("Saving preview " + previewPath);
+			PngWriter writer;
+			if (!writer.open(previewPath, image.cols, image.rows, 3, 1) || !writer.writeRows(image) || !writer.close())
+				Warning("Could not save the preview " + previewPath);
+			else if (status)
+				status("preview " + previewPath);
+		};
+	}
+
+	//Inputs are never float images, so any float path is an output.
+	options.floatOutputs = HasFloatOutputs(args.data(), args.size());
+	if (options.floatOutputs && options.bandRows > 0)
+	{
+		Error("Float outputs cannot be used with --band-rows");
+		return 1;
+	}
+
+	if (!paths.writeBundle.empty())
+		return WriteBundle(args, paths.writeBundle, options, pool);
+
+	if (!paths.manifest.empty())
+	{
+		if (!args.empty() || options.qualityMaps || !paths.writeBackgroundCache.empty() ||
+			!paths.backgroundCache.empty())
+		{
+			Error("--manifest takes no paths as arguments, and cannot be used with quality maps or background caches");
+			return 1;
+		}
+
+		std::vector<std::vector<std::string>> jobs;
+		if (!ReadManifest(paths.manifest, jobs))
+			return 1;
+
+		return RunBatch(jobs, options, pool);
+	}
+
+	if (!paths.writeBackgroundCache.empty())
+	{
+		const bool written = WriteBackgroundCache(args.data(), (int)args.size(), paths.writeBackgroundCache, options, pool);
+		return written ? 0 : 4;
+	}
+
+	if (!paths.backgroundCache.empty())
+	{
+		if (args.size() < 3 + GG::kMinColours)
+		{
+			Error("Expected N foreground paths and 3 output paths with --background-cache");
+			return 1;
+		}
+
+		const int colours = (int)args.size() - 3;
+		auto groundTruth = GenerateGroundTruthFromCache(args.data(), colours, paths.backgroundCache, options, pool);
+		if (groundTruth.size() != 3)
+			return 3;
+
+		return SaveOutputs(groundTruth, &args[colours], options, pool);
+	}
+
+	if (!paths.sharedFrames.empty())
+		return RunSharedFrames(args, options, paths, pool, status);
+
+	if (!paths.bundle.empty())
+		return RunBundle(args, options, paths, pool, status);
+
+	const int colours = ColoursFromPaths(args.size());
+	if (colours == 0)
+		return 1;
+
+	//first N images are foregrounds, the next N backgrounds, then the outputs
+	const size_t outputCount = options.qualityMaps ? 5 : 3;
+	if (options.qualityMaps)
+	{
+		args.push_back(paths.residual);
+		args.push_back(paths.conditioning);
+	}
+
+	if (options.bandRows > 0)
+	{
+		const bool streamed = GenerateGroundTruthStreamed(&args[0], &args[colours], colours, &args[2 * colours], options, pool);
+		return streamed ? 0 : 4;
+	}
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (!pool)
+	{
+		ownPool.reset(new ThreadPool(options.threads));
+		pool = ownPool.get();
+	}
+
+	Inform("Loading temporaries");
+	if (status)
+		status("loading");
+	std::vector<RawRgbMapping> mappings;
+	std::vector<cv::Mat> images;
+	if (LoadImages(&args[0], colours, mappings, images, pool) != 0)
+		return 2;
+
+	if (status)
+		status("solving");
+	auto groundTruth = GenerateGroundTruth(&images[0], &images[colours], colours, options, pool);
+	images.clear();
+	mappings.clear();
+
+	if (groundTruth.size() != outputCount)
+		return 3;
+
+	if (status)
+		status("saving");
+	return SaveOutputs(groundTruth, &args[2 * colours], options, pool);
+}
+
+/**
+* Runs as a worker, taking jobs from CameraControl over a Unix domain socket (see workersocket.h) until told
+* to quit. Jobs run one at a time on a thread pool kept for the life of the worker, so that only the first
+* pays for starting the process, loading the libraries and creating the threads. The options given to the
+* worker are the defaults for every job, which may override them except for the number of threads.
+* @return The exit code of the worker.
+* */
+static int Serve(const std::string& path, const GroundTruthOptions& defaults)
+{
+	WorkerSocket server;
+	if (!WorkerSocket::startup() || !server.listen(path))
+	{
+		Error("Could not listen on " + path);
+		return 1;
+	}
+
+	ThreadPool pool(defaults.threads);
+	Inform("Serving ground truth jobs on " + path + " with " + ToString(pool.size()) + " threads");
+
+	for (;;)
+	{
+		WorkerSocket client = server.accept();
+		if (!client.valid())
+			continue;
+
+		std::string line;
+		while (client.readLine(line))
+		{
+			if (line == "quit")
+			{
+				client.writeLine("done 0 0");
+				server.close();
+				std::remove(path.c_str());
+				return 0;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			std::vector<std::string> arguments;
+			std::vector<std::string> args;
+			GroundTruthOptions options = defaults;
+			OptionPaths paths;
+			int code = 1;
+			if (!SplitArguments(line, arguments))
+				Error("Unterminated quote in job " + line);
+			else if (ParseArguments(arguments, args, options, paths))
+			{
+				if (!paths.serve.empty())
+					Error("A job cannot start another worker");
+				else
+				{
+					//Each job records to the trace of the session that sent it, if any.
+					if (!paths.trace.empty() && paths.trace != TracePath())
+						OpenTrace(paths.trace, "GroundTruth worker", false);
+
+					Inform("Starting job " + line);
+					if (options.threads != defaults.threads)
+						Warning("Ignoring --threads " + ToString(options.threads) + " of the job: the worker solves on its " +
+							ToString(pool.size()) + " threads");
+					client.writeLine("status running");
+					TraceSpan span("job", line);
+					code = Run(args, options, paths, &pool, [&client](const std::string& stage){
+						client.writeLine("status " + stage);
+					});
+					span.end();
+					FlushTrace();
+				}
+			}
+
+			Inform("Job finished with code " + ToString(code));
+			if (!client.writeLine("done " + ToString(code) + " " + ToString(SecondsSince(start))))
+				break;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Inform("Entered Ground Truth generator");
+
+	std::vector<std::string> args;
+	GroundTruthOptions options;
+	OptionPaths paths;
+	if (!ParseArguments(std::vector<std::string>(argv + 1, argv + argc), args, options, paths))
+		return 1;
+
+	if (!paths.trace.empty())
+		OpenTrace(paths.trace, paths.serve.empty() ? "GroundTruth" : "GroundTruth worker", false);
+
+	int code;
+	TraceSpan span("main");
+	if (!paths.serve.empty())
+	{
+		if (!args.empty())
+		{
+			Error("--serve takes no paths as arguments");
+			return 1;
+		}
+		code = Serve(paths.serve, options);
+	}
+	else
+		code = Run(args, options, paths);
+
+	span.end();
+	CloseTrace();
+
+	Inform("Exiting ground truth algorithm");
+	return code;
+}
\ No newline at end of file
@@ -1,13 +1,11 @@
 #include "image.h"
 #include <fstream>
+#include <algorithm>
 #include "io.h"
 #include "camera.h"
 #include <EDSDK.h>
 #include <opencv2/opencv.hpp>
 
-//If defined, the ground truth image will be halved.
-#define HALVE_GT_IMAGE
-
 ImageRaw::ImageRaw(){}
 
 ImageRaw::~ImageRaw()
@@ -149,7 +147,28 @@ bool ImageRaw::saveToFile(const std::string& path)
 	return true;
 }
 
+EdsSize ImageRaw::rgbSize()
+{
+	EdsSize size = { 0, 0 };
+	if (failed())
+		return size;
+
+	EdsImageInfo imageInfo;
+	CHECK_EDS_ERROR(EdsGetImageInfo(mImageRef.mRef, kEdsImageSrc_RAWFullView, &imageInfo),
+		"Could not retrieve image info", size);
+
+	size.width = imageInfo.width;
+	size.height = imageInfo.height;
+	return size;
+}
+
 RawRgbEds ImageRaw::findRgb()
+{
+	EdsRect whole = { { 0, 0 }, rgbSize() };
+	return findRgb(whole);
+}
+
+RawRgbEds ImageRaw::findRgb(const EdsRect& crop, int shrink)
 {
 	if (failed())
 		return{};
@@ -164,22 +183,57 @@ RawRgbEds ImageRaw::findRgb()
 		return{};
 	}
 
+	if (crop.size.width <= 0 || crop.size.height <= 0 || crop.point.x < 0 || crop.point.y < 0 ||
+		crop.point.x + crop.size.width > (EdsInt32)imageInfo.width ||
+		crop.point.y + crop.size.height > (EdsInt32)imageInfo.height)
+	{
+		Warning("Cannot process a region outside the image");
+		return{};
+	}
+
+	//The crop is in pixels of the whole image, which is decoded from the effective area of the sensor.
+	const EdsRect& effective = imageInfo.effectiveRect;
+	EdsRect source;
+	source.point.x = effective.point.x + crop.point.x * effective.size.width / imageInfo.width;
+	source.point.y = effective.point.y + crop.point.y * effective.size.height / imageInfo.height;
+	source.size.width = crop.size.width * effective.size.width / imageInfo.width;
+	source.size.height = crop.size.height * effective.size.height / imageInfo.height;
+
+	EdsSize size;
+	size.width = std::max<EdsInt32>(1, crop.size.width / shrink);
+	size.height = std::max<EdsInt32>(1, crop.size.height / shrink);
+
 	//Create stream
 	EdsStreamContainer rgbStream;
 	rgbStream.setDepends(mImageRef.mRef);
-	CHECK_EDS_ERROR(EdsCreateMemoryStream(3 * imageInfo.width*imageInfo.height, &rgbStream.mRef),
+	CHECK_EDS_ERROR(EdsCreateMemoryStream(3 * size.width*size.height, &rgbStream.mRef),
 		"Failed to create memory stream", {});
 
 	//Get image in rgb format into memory
-	EdsSize size;
-	size.height = imageInfo.height;
-	size.width = imageInfo.width;
 	CHECK_EDS_ERROR(EdsGetImage(mImageRef.mRef, kEdsImageSrc_RAWFullView, kEdsTargetImageType_RGB16,
-		imageInfo.effectiveRect, size, rgbStream.mRef), "Could not retrieve the image", {});
+		source, size, rgbStream.mRef), "Could not retrieve the image", {});
 
 	//Convert to GBR
 	cv::Mat m(size.height, size.width, CV_16UC3, rgbStream.pointer());
 	cv::cvtColor(m, m, CV_RGB2BGR);
 
 	return std::make_tuple(size.width, size.height, rgbStream);
+}
+
+RawRgbEds ImageRaw::cropRgb(const RawRgbEds& rgb, const EdsRect& crop)
+{
+	const EdsStreamContainer& container = std::get<2>(rgb);
+	if (container.size() == 0)
+		return{};
+
+	EdsStreamContainer rgbStream;
+	rgbStream.setDepends(mImageRef.mRef);
+	CHECK_EDS_ERROR(EdsCreateMemoryStream(6 * crop.size.width*crop.size.height, &rgbStream.mRef),
+		"Failed to create memory stream", {});
+
+	cv::Mat whole(std::get<1>(rgb), std::get<0>(rgb), CV_16UC3, container.pointer());
+	cv::Mat part(crop.size.height, crop.size.width, CV_16UC3, rgbStream.pointer());
+	whole(cv::Rect(crop.point.x, crop.point.y, crop.size.width, crop.size.height)).copyTo(part);
+
+	return std::make_tuple(crop.size.width, crop.size.height, rgbStream);
 }
\ No newline at end of file
@@ -84,6 +84,22 @@ public:
 	/** Returns the width. */
 	int width();
 
+	/** Returns the size of the rgb data generated by findRgb(), or 0x0 upon failure. */
+	EdsSize rgbSize();
+
 	/** Generates the rgb data of the image. */
 	RawRgbEds findRgb();
+
+	/**
+	* Generates the rgb data of part of the image, decoding nothing outside it.
+	* @param crop The region to decode, in pixels of the image generated by findRgb().
+	* @param shrink Decodes at 1/shrink of the resolution, for quick previews.
+	* */
+	RawRgbEds findRgb(const EdsRect& crop, int shrink = 1);
+
+	/**
+	* Copies part of rgb data already generated by findRgb().
+	* @param crop The region to copy, in pixels of rgb.
+	* */
+	RawRgbEds cropRgb(const RawRgbEds& rgb, const EdsRect& crop);
 };
\ No newline at end of file
@@ -6,17 +6,18 @@
 
 void Error(const std::string& msg)
 {
-	std::cerr << "ERROR: " << msg << "\n";
+	//Each message is written in one go, so that messages from several threads do not interleave.
+	std::cerr << ("ERROR: " + msg + "\n");
 }
 
 void Warning(const std::string& msg)
 {
-	std::cout << "Warning: " << msg << "\n";
+	std::cout << ("Warning: " + msg + "\n");
 }
 
 void Inform(const std::string& msg)
 {
-	std::cout << ":- " << msg << "\n";
+	std::cout << (":- " + msg + "\n");
 }
 
 std::string appendNameToPath(const std::string& name, const std::string& path)
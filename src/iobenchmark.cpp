@@ -0,0 +1,533 @@
+/**
+* This application measures the stages around the solver that move and convert whole images: loading and
+* mapping .rawrgb files, saving them as CameraControl does, the channel swap of ImageRaw::findRgb, the
+* conversions between 16 bit and float images, and the encoding of the outputs. Each stage is timed on its
+* own on generated plates at several sizes, so that the stage limiting throughput on a machine can be found.
+*
+* Stages that read or write files are timed both warm and cold. A warm read finds the file in the page
+* cache, and a cold one has had it evicted first, so that it reads from the disk. A warm write returns once
+* the data is in the page cache, and a cold one also waits for it to reach the disk, as a machine writing
+* faster than its disk eventually must. The other stages work in memory and are timed once.
+*
+* Throughput is given in GB/s of 16 bit RGB image data, width*height*6 bytes, whatever the stage reads or
+* writes, so that every stage is measured against the same yardstick. The size of the file is also given.
+*
+* Options:
+* --sizes WxH,...  The image sizes. Default 1024x768,2880x1920,5760x3840.
+* --repeats R  The timed runs of each case. The fastest is reported. Default 3.
+* --stages NAME,...  Runs only the named stages (see kStages). Default all of them.
+* --dir PATH  The directory for the files written and read. Default the current directory.
+* --threads N  The number of threads of the stages that use a pool. Defaults to 0, meaning every hardware thread.
+* --json PATH  Also writes the results to this JSON file.
+*/
+
+#include "io.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "rawrgbchar.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+
+/** How a stage uses the page cache. */
+enum class StageKind { Read, Write, Memory };
+
+/** A stage that can be timed, run by RunStage. */
+struct Stage
+{
+	const char* name;
+	StageKind kind;
+
+	//The extension of the file the stage reads or writes.
+	const char* extension;
+};
+
+static const Stage kStages[] = {
+	{ "load-v1", StageKind::Read, ".rawrgb" },
+	{ "load-v2", StageKind::Read, ".rawrgb" },
+	{ "map-v1", StageKind::Read, ".rawrgb" },
+	{ "save-v1", StageKind::Write, ".rawrgb" },
+	{ "save-v2", StageKind::Write, ".rawrgb" },
+	{ "rgb-to-bgr", StageKind::Memory, "" },
+	{ "to-float", StageKind::Memory, "" },
+	{ "to-16u", StageKind::Memory, "" },
+	{ "png-writer", StageKind::Write, ".png" },
+	{ "imwrite-png", StageKind::Write, ".png" },
+	{ "imwrite-tiff", StageKind::Write, ".tiff" }
+};
+
+static const int kStageCount = sizeof(kStages) / sizeof(kStages[0]);
+
+//The PNG compression level the outputs of GroundTruth are saved with by default.
+static const int kBenchmarkPngLevel = 1;
+
+/** The settings of a benchmark run. */
+struct BenchmarkOptions
+{
+	std::vector<cv::Size> sizes;
+	std::vector<std::string> stages;
+	int repeats = 3;
+	std::string dir;
+	unsigned threads = 0;
+	std::string json;
+};
+
+/** The timing of one stage at one size. */
+struct StageResult
+{
+	const Stage* stage;
+	cv::Size size;
+
+	//"warm", "cold" or "memory".
+	std::string cache;
+
+	//false if the file could not be evicted from the page cache, so a cold run was really warm.
+	bool evicted;
+
+	double bestSeconds;
+	double meanSeconds;
+	uint64_t fileBytes;
+};
+
+/** The data the stages work on. */
+struct BenchmarkData
+{
+	//A CV_16UC3 plate and the same plate as CV_32FC3 normalised to [0;1].
+	cv::Mat plate;
+	cv::Mat plateFloat;
+
+	//The outputs of the stages that work in memory, kept between runs so that only the first allocates them.
+	cv::Mat swapped;
+	cv::Mat converted;
+
+	//The plate saved in each version of the .rawrgb format, for the stages that read.
+	std::string v1Path;
+	std::string v2Path;
+};
+
+/** Returns the seconds elapsed since start. */
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** Returns the size of a file, or 0 if it cannot be opened. */
+static uint64_t FileSize(const std::string& path)
+{
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	return in.fail() ? 0 : (uint64_t)in.tellg();
+}
+
+/**
+* Evicts a file from the page cache, so that the next read of it comes from the disk.
+* @return false if the operating system did not allow it.
+* */
+static bool EvictFromCache(const std::string& path)
+{
+#ifdef _WIN32
+	//Opening a file without buffering makes the cache manager flush and drop the pages it holds of it.
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+		FILE_FLAG_NO_BUFFERING, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	CloseHandle(file);
+	return true;
+#else
+	const int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	//Dirty pages cannot be dropped, so they are written first.
+	fdatasync(file);
+	const bool evicted = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	::close(file);
+	return evicted;
+#endif
+}
+
+/** Waits until a file that has been written reaches the disk. */
+static bool SyncFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	const bool synced = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return synced;
+#else
+	const int file = ::open(path.c_str(), O_WRONLY);
+	if (file < 0)
+		return false;
+	const bool synced = fsync(file) == 0;
+	::close(file);
+	return synced;
+#endif
+}
+
+/**
+* Fills a plate with a smooth image with sensor noise, which compresses about as well as a capture does.
+* The samples are in the order the camera delivers them, RGB.
+* */
+static void MakePlate(cv::Size size, cv::Mat& plate)
+{
+	plate.create(size.height, size.width, CV_16UC3);
+	uint32_t random = 12345;
+	for (int y = 0; y < size.height; ++y)
+	{
+		uint16_t* row = plate.ptr<uint16_t>(y);
+		for (int x = 0; x < size.width; ++x)
+			for (int k = 0; k < 3; ++k)
+			{
+				random = random * 1664525u + 1013904223u;
+				const double level = 0.2 + 0.3 * x / size.width + 0.2 * y / size.height + 0.1 * k;
+				row[x * 3 + k] = (uint16_t)std::min(65535.0, level * 65535 + (int)(random >> 26) - 32);
+			}
+	}
+}
+
+/** Writes a plate as a version 1 .rawrgb file: the width and height followed by the samples. */
+static bool SaveRawRgbV1(const std::string& path, const cv::Mat& plate)
+{
+	std::fstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	out.write((const char*)&plate.cols, sizeof(int));
+	out.write((const char*)&plate.rows, sizeof(int));
+	for (int y = 0; y < plate.rows; ++y)
+		out.write((const char*)plate.ptr<uint16_t>(y), plate.cols * 3 * sizeof(uint16_t));
+	out.close();
+	return !out.fail();
+}
+
+/**
+* Runs a stage once.
+* @param path The file the stage reads or writes.
+* @return false upon failure.
+* */
+static bool RunStage(const Stage& stage, BenchmarkData& data, const std::string& path, ThreadPool& pool)
+{
+	const std::string name = stage.name;
+	if (name == "load-v1" || name == "load-v2")
+	{
+		RawRgbChar image;
+		return LoadRawRgb(path, image, &pool);
+	}
+	if (name == "map-v1")
+	{
+		//Mapping reads nothing until the pixels are touched, so every page is touched as the solve would.
+		RawRgbMapping mapping;
+		if (!mapping.open(path))
+			return false;
+		const size_t samples = (size_t)mapping.width() * mapping.height() * 3;
+		const uint16_t* pixels = mapping.pixels();
+		volatile uint16_t sum = 0;
+		for (size_t i = 0; i < samples; i += 2048)
+			sum += pixels[i];
+		return true;
+	}
+	if (name == "save-v1")
+		return SaveRawRgbV1(path, data.plate);
+	if (name == "save-v2")
+		return SaveRawRgb(path, data.plate.cols, data.plate.rows, data.plate.ptr<uint16_t>(0), &pool);
+	if (name == "rgb-to-bgr")
+	{
+		//In place, as ImageRaw::findRgb does on the stream the camera delivers.
+		if (data.swapped.empty())
+			data.swapped = data.plate.clone();
+		cv::cvtColor(data.swapped, data.swapped, CV_RGB2BGR);
+		return true;
+	}
+	if (name == "to-float")
+	{
+		data.plate.convertTo(data.converted, CV_32F, 1.0 / 65535);
+		return true;
+	}
+	if (name == "to-16u")
+	{
+		data.plateFloat.convertTo(data.converted, CV_16U, 65535);
+		return true;
+	}
+	if (name == "png-writer")
+	{
+		PngWriter writer;
+		return writer.open(path, data.plate.cols, data.plate.rows, 3, kBenchmarkPngLevel) &&
+			writer.writeRows(data.plate, &pool) && writer.close();
+	}
+	if (name == "imwrite-png")
+		return cv::imwrite(path, data.plate, { cv::IMWRITE_PNG_COMPRESSION, kBenchmarkPngLevel });
+	if (name == "imwrite-tiff")
+		return cv::imwrite(path, data.plate);
+	return false;
+}
+
+/**
+* Times a stage at one size in one cache state.
+* @param cold For reads, whether the file is evicted before each run. For writes, whether each run waits
+*             for the file to reach the disk.
+* @return false upon failure, which is reported.
+* */
+static bool TimeStage(const Stage& stage, BenchmarkData& data, const BenchmarkOptions& options, bool cold,
+	ThreadPool& pool, StageResult& result)
+{
+	const std::string name = stage.name;
+	const std::string path = stage.kind == StageKind::Write ?
+		appendNameToPath(std::string("iobenchmark_") + stage.name + stage.extension, options.dir) :
+		name == "load-v2" ? data.v2Path : data.v1Path;
+
+	result.stage = &stage;
+	result.size = data.plate.size();
+	result.cache = stage.kind == StageKind::Memory ? "memory" : cold ? "cold" : "warm";
+	result.evicted = true;
+
+	//An untimed run fills the caches for warm runs, and for writes creates the file.
+	if (!cold && !RunStage(stage, data, path, pool))
+	{
+		Error(name + " failed on " + path);
+		return false;
+	}
+
+	double total = 0;
+	for (int r = 0; r < options.repeats; ++r)
+	{
+		if (cold && stage.kind == StageKind::Read)
+			result.evicted = EvictFromCache(path) && result.evicted;
+
+		const auto start = std::chrono::steady_clock::now();
+		bool ok = RunStage(stage, data, path, pool);
+		if (cold && stage.kind == StageKind::Write)
+			ok = SyncFile(path) && ok;
+		const double seconds = SecondsSince(start);
+		if (!ok)
+		{
+			Error(name + " failed on " + path);
+			return false;
+		}
+
+		total += seconds;
+		result.bestSeconds = r == 0 ? seconds : std::min(result.bestSeconds, seconds);
+	}
+	result.meanSeconds = total / options.repeats;
+	result.fileBytes = stage.kind == StageKind::Memory ? 0 : FileSize(path);
+	return true;
+}
+
+/** Returns the throughput of a result in GB/s of 16 bit RGB image data. */
+static double GigabytesPerSecond(const StageResult& r)
+{
+	return (double)r.size.width * r.size.height * 3 * sizeof(uint16_t) / r.bestSeconds / 1e9;
+}
+
+/** Writes a number to JSON, as null if it is not finite, which JSON cannot represent. */
+static std::string JsonNumber(double value)
+{
+	if (!std::isfinite(value))
+		return "null";
+	std::ostringstream ss;
+	ss << std::setprecision(9) << value;
+	return ss.str();
+}
+
+/**
+* Writes the results as JSON.
+* @return false upon failure, which is reported.
+* */
+static bool WriteJson(const std::string& path, const BenchmarkOptions& options, const std::vector<StageResult>& results)
+{
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (out.fail())
+	{
+		Error("Could not create " + path);
+		return false;
+	}
+
+	out << "{\n";
+	out << "  \"settings\": { \"repeats\": " << options.repeats << ", \"threads\": " << options.threads <<
+		", \"pngCompression\": " << kBenchmarkPngLevel << " },\n";
+	out << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const StageResult& r = results[i];
+		out << (i ? ",\n" : "\n");
+		out << "    { \"stage\": \"" << r.stage->name << "\", \"width\": " << r.size.width << ", \"height\": " <<
+			r.size.height << ", \"cache\": \"" << r.cache << "\", \"evicted\": " << (r.evicted ? "true" : "false") <<
+			", \"bestSeconds\": " << JsonNumber(r.bestSeconds) << ", \"meanSeconds\": " << JsonNumber(r.meanSeconds) <<
+			", \"gbPerSecond\": " << JsonNumber(GigabytesPerSecond(r)) << ", \"fileBytes\": " << r.fileBytes << " }";
+	}
+	out << "\n  ]\n}\n";
+
+	out.close();
+	if (out.fail())
+	{
+		Error("Could not write " + path);
+		return false;
+	}
+	return true;
+}
+
+/** Reports a result as it finishes. */
+static void ReportResult(const StageResult& r)
+{
+	Inform(std::string(r.stage->name) + " " + ToString(r.size.width) + "x" + ToString(r.size.height) + " " + r.cache +
+		(r.evicted ? "" : " (not evicted)") + ": " + ToString(GigabytesPerSecond(r)) + " GB/s, " +
+		ToString(r.bestSeconds * 1000) + " ms" + (r.fileBytes ? ", " + ToString(r.fileBytes) + " bytes" : ""));
+}
+
+/** Splits a comma separated list. */
+static std::vector<std::string> SplitList(const std::string& value)
+{
+	std::vector<std::string> items;
+	std::istringstream ss(value);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		items.push_back(item);
+	return items;
+}
+
+/**
+* Reads the options.
+* @return false if an option is unknown or malformed.
+* */
+static bool ParseArguments(const std::vector<std::string>& arguments, BenchmarkOptions& options)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		const std::string& arg = arguments[i];
+		if (i + 1 >= arguments.size())
+		{
+			Error("Missing value for " + arg);
+			return false;
+		}
+		const std::string& value = arguments[++i];
+		std::istringstream ss(value);
+
+		if (arg == "--sizes")
+		{
+			options.sizes.clear();
+			for (const std::string& item : SplitList(value))
+			{
+				std::istringstream size(item);
+				cv::Size s;
+				char x;
+				if (!(size >> s.width >> x >> s.height) || x != 'x' || !size.eof() || s.width <= 0 || s.height <= 0)
+				{
+					Error("Invalid size " + item + ", expected WxH");
+					return false;
+				}
+				options.sizes.push_back(s);
+			}
+		}
+		else if (arg == "--repeats")
+		{
+			if (!(ss >> options.repeats) || options.repeats < 1)
+			{
+				Error("Invalid repeat count " + value);
+				return false;
+			}
+		}
+		else if (arg == "--stages")
+		{
+			options.stages = SplitList(value);
+			for (const std::string& name : options.stages)
+			{
+				bool known = false;
+				for (int s = 0; s < kStageCount; ++s)
+					known = known || name == kStages[s].name;
+				if (!known)
+				{
+					Error("Unknown stage " + name);
+					return false;
+				}
+			}
+		}
+		else if (arg == "--threads")
+		{
+			if (!(ss >> options.threads))
+			{
+				Error("Invalid thread count " + value);
+				return false;
+			}
+		}
+		else if (arg == "--dir")
+			options.dir = value;
+		else if (arg == "--json")
+			options.json = value;
+		else
+		{
+			Error("Unknown option " + arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Returns whether the stage is to be run. */
+static bool Selected(const BenchmarkOptions& options, const Stage& stage)
+{
+	if (options.stages.empty())
+		return true;
+	return std::find(options.stages.begin(), options.stages.end(), stage.name) != options.stages.end();
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseArguments(std::vector<std::string>(argv + 1, argv + argc), options))
+		return 1;
+	if (options.sizes.empty())
+		options.sizes = { cv::Size(1024, 768), cv::Size(2880, 1920), cv::Size(5760, 3840) };
+
+	ThreadPool pool(options.threads);
+	std::vector<StageResult> results;
+	bool ok = true;
+	for (const cv::Size& size : options.sizes)
+	{
+		BenchmarkData data;
+		MakePlate(size, data.plate);
+		data.plate.convertTo(data.plateFloat, CV_32F, 1.0 / 65535);
+		data.v1Path = appendNameToPath("iobenchmark_input_v1.rawrgb", options.dir);
+		data.v2Path = appendNameToPath("iobenchmark_input_v2.rawrgb", options.dir);
+		if (!SaveRawRgbV1(data.v1Path, data.plate) ||
+			!SaveRawRgb(data.v2Path, size.width, size.height, data.plate.ptr<uint16_t>(0), &pool))
+		{
+			Error("Could not write the inputs to " + (options.dir.empty() ? std::string(".") : options.dir));
+			return 1;
+		}
+
+		for (int s = 0; s < kStageCount && ok; ++s)
+		{
+			if (!Selected(options, kStages[s]))
+				continue;
+			const int passes = kStages[s].kind == StageKind::Memory ? 1 : 2;
+			for (int pass = 0; pass < passes && ok; ++pass)
+			{
+				StageResult result = StageResult();
+				ok = TimeStage(kStages[s], data, options, pass == 1, pool, result);
+				if (ok)
+				{
+					results.push_back(result);
+					ReportResult(result);
+				}
+			}
+			if (kStages[s].kind == StageKind::Write)
+				std::remove(appendNameToPath(std::string("iobenchmark_") + kStages[s].name + kStages[s].extension,
+					options.dir).c_str());
+		}
+
+		std::remove(data.v1Path.c_str());
+		std::remove(data.v2Path.c_str());
+		if (!ok)
+			return 1;
+	}
+
+	if (!options.json.empty() && !WriteJson(options.json, options, results))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+/** Finds the part of a capture that holds the object, so that ground truth runs can be cropped to it.
+ * Shared by CameraControl, which crops before decoding, and GroundTruth, which crops before solving.
+ * */
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+/**
+* Returns the bounding box of the pixels where the foreground differs from its background by more than
+* threshold of full scale in any channel, grown by margin pixels on every side and clipped to the image.
+* @param foreground A CV_16UC3 image shot in front of a backdrop.
+* @param background A CV_16UC3 image of the same backdrop and size without the object.
+* @return an empty rectangle if no pixel differs by enough.
+* */
+static cv::Rect FindObjectBounds(const cv::Mat& foreground, const cv::Mat& background, double threshold, int margin)
+{
+	const int limit = (int)(threshold * 65535);
+	const int samples = foreground.cols * 3;
+	int left = foreground.cols, right = -1, top = -1, bottom = -1;
+
+	for (int i = 0; i < foreground.rows; ++i)
+	{
+		const uint16_t* pf = (const uint16_t*)(foreground.data + i*foreground.step);
+		const uint16_t* pb = (const uint16_t*)(background.data + i*background.step);
+
+		//Only the outermost differing samples of each row matter, so search inwards from both ends.
+		int first = 0;
+		while (first < samples && std::abs((int)pf[first] - (int)pb[first]) <= limit)
+			++first;
+		if (first == samples)
+			continue;
+
+		int last = samples - 1;
+		while (std::abs((int)pf[last] - (int)pb[last]) <= limit)
+			--last;
+
+		left = std::min(left, first / 3);
+		right = std::max(right, last / 3);
+		if (top < 0)
+			top = i;
+		bottom = i;
+	}
+
+	if (bottom < 0)
+		return cv::Rect();
+
+	const cv::Rect box(left - margin, top - margin, right - left + 1 + 2 * margin, bottom - top + 1 + 2 * margin);
+	return box & cv::Rect(0, 0, foreground.cols, foreground.rows);
+}
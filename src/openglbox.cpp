@@ -4,10 +4,15 @@
 #include "imageshader.h"
 #include "colourshader.h"
 #include "io.h"
+#include <qevent.h>
+#include <algorithm>
 
 OpenGlBox* OpenGlBox::mInstance = nullptr;
 static unsigned zeroHist[256];
 
+//Regions narrower or shorter than this fraction of the image are taken as clicks and discarded.
+static const float kMinRegionSize = 0.01f;
+
 void OpenGlBox::initialiseQuads()
 {
 	//Screen quad
@@ -189,6 +194,86 @@ void OpenGlBox::paintGL()
 		mHistShader->setPos(histX + i * lineWidth, histY);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
+
+	drawRegion();
+}
+
+void OpenGlBox::drawRegion()
+{
+	if (mRegion.isEmpty() || !mVideoTexture)
+		return;
+
+	//The image fills the width of the box and is centred vertically (see the viewport shader), while the
+	//colour shader places quads in fractions of the box from the bottom left.
+	float aspect = (float)mVideoTexture->height() / mVideoTexture->width() * width() / height();
+	float x = (float)mRegion.x();
+	float y = (1.f + aspect * (1.f - 2.f * (float)mRegion.bottom())) / 2.f;
+	float w = (float)mRegion.width();
+	float h = aspect * (float)mRegion.height();
+
+	//Shade the region, then outline it two pixels wide.
+	mHistShader->setColour(1.f, 1.f, 1.f, 0.1f);
+	mHistShader->setScale(w, h);
+	mHistShader->setPos(x, y);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	float lineX = 2.f / width();
+	float lineY = 2.f / height();
+	mHistShader->setColour(1.f, 1.f, 1.f, 0.8f);
+	const float lines[4][4] = {
+		{ x, y, w, lineY }, { x, y + h - lineY, w, lineY }, { x, y, lineX, h }, { x + w - lineX, y, lineX, h } };
+	for (int i = 0; i < 4; ++i)
+	{
+		mHistShader->setScale(lines[i][2], lines[i][3]);
+		mHistShader->setPos(lines[i][0], lines[i][1]);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+}
+
+QPointF OpenGlBox::toImage(const QPoint& position)
+{
+	float aspect = (float)mVideoTexture->height() / mVideoTexture->width() * width() / height();
+	float x = (float)position.x() / width();
+	float y = ((2.f * position.y() / height() - 1.f) / aspect + 1.f) / 2.f;
+	return QPointF(std::min(1.f, std::max(0.f, x)), std::min(1.f, std::max(0.f, y)));
+}
+
+QRectF OpenGlBox::region() const
+{
+	return mRegion;
+}
+
+void OpenGlBox::mousePressEvent(QMouseEvent* event)
+{
+	if (event->button() == Qt::RightButton)
+	{
+		mRegion = QRectF();
+		mDragging = false;
+	}
+	else if (event->button() == Qt::LeftButton && mVideoTexture)
+	{
+		mDragStart = toImage(event->pos());
+		mRegion = QRectF();
+		mDragging = true;
+	}
+}
+
+void OpenGlBox::mouseMoveEvent(QMouseEvent* event)
+{
+	if (mDragging && mVideoTexture)
+		mRegion = QRectF(mDragStart, toImage(event->pos())).normalized();
+}
+
+void OpenGlBox::mouseReleaseEvent(QMouseEvent* event)
+{
+	if (event->button() != Qt::LeftButton || !mDragging)
+		return;
+
+	mDragging = false;
+	if (mRegion.width() < kMinRegionSize || mRegion.height() < kMinRegionSize)
+		mRegion = QRectF();
+	else
+		Inform("Ground truth limited to the drawn region; right click the live view to clear it");
 }
 
 OpenGlBox::OpenGlBox(QWidget* parent) : QOpenGLWidget(parent)
@@ -2,6 +2,7 @@
 #include <qopenglwidget.h>
 #include <QOpenGLFunctions>
 #include <qtimer.h>
+#include <qrect.h>
 #include <future>
 #include "vertex.h"
 
@@ -67,9 +68,22 @@ private:
 		GLuint VBO;
 	} mHistQuad;
 
+	//The region drawn by the user, as fractions of the image, or empty if none is drawn.
+	QRectF mRegion;
+
+	//Where the current drag started, as a fraction of the image.
+	QPointF mDragStart;
+	bool mDragging = false;
+
     /** Initialises the screen quad to fill the screen. */
     void initialiseQuads();
 
+	/** Converts a position on the widget to fractions of the displayed image, clamped to the image. */
+	QPointF toImage(const QPoint& position);
+
+	/** Draws the region over the live view. */
+	void drawRegion();
+
     //The current instance of the class.
     static OpenGlBox* mInstance;
 
@@ -98,4 +112,18 @@ public:
 
     /** Called on every timer tick: updates the frame. */
     void timerEvent(QTimerEvent *event);
+
+	/** Returns the region drawn on the live view, as fractions of the image, or an empty rectangle if none. */
+	QRectF region() const;
+
+protected:
+
+	/** Starts drawing a region with the left button, or clears it with the right button. */
+	void mousePressEvent(QMouseEvent* event) override;
+
+	/** Resizes the region being drawn. */
+	void mouseMoveEvent(QMouseEvent* event) override;
+
+	/** Finishes the region, discarding it if it is too small to be intended. */
+	void mouseReleaseEvent(QMouseEvent* event) override;
 };
\ No newline at end of file
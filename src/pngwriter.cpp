@@ -0,0 +1,293 @@
+#include "pngwriter.h"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <cstring>
+#include <cstdlib>
+#include <opencv2/opencv.hpp>
+#include "io.h"
+#include "deflate.h"
+#include "threadpool.h"
+
+//The unfiltered bytes in each independently compressed chunk. Large enough that cutting the image
+//costs little compression, small enough that an image has many chunks to share between threads.
+static const size_t kChunkBytes = 1 << 20;
+
+/** Returns the CRC-32 lookup table used by PNG chunks, built on first use by whichever thread gets there first. */
+static const uint32_t* CrcTable()
+{
+	static const std::array<uint32_t, 256> table = [] {
+		std::array<uint32_t, 256> crcs;
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			crcs[n] = c;
+		}
+		return crcs;
+	}();
+	return table.data();
+}
+
+static void PutBigEndian(unsigned char* out, uint32_t value)
+{
+	out[0] = (unsigned char)(value >> 24);
+	out[1] = (unsigned char)(value >> 16);
+	out[2] = (unsigned char)(value >> 8);
+	out[3] = (unsigned char)value;
+}
+
+void PngWriter::writeChunk(const char* type, const unsigned char* data, size_t length)
+{
+	const uint32_t* table = CrcTable();
+	uint32_t crc = 0xffffffffu;
+	for (int i = 0; i < 4; ++i)
+		crc = table[(crc ^ (unsigned char)type[i]) & 0xff] ^ (crc >> 8);
+	for (size_t i = 0; i < length; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	unsigned char word[4];
+	PutBigEndian(word, (uint32_t)length);
+	mOut.write((const char*)word, 4);
+	mOut.write(type, 4);
+	if (length)
+		mOut.write((const char*)data, length);
+	PutBigEndian(word, crc ^ 0xffffffffu);
+	mOut.write((const char*)word, 4);
+}
+
+PngWriter::~PngWriter()
+{
+	if (mOut.is_open())
+		mOut.close();
+}
+
+/** Returns the Paeth predictor of a sample from its left, upper and upper left neighbours. */
+static unsigned char Paeth(int a, int b, int c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a);
+	const int pb = abs(p - b);
+	const int pc = abs(p - c);
+	return (unsigned char)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+/**
+* Filters a row with whichever PNG filter gives the smallest sum of absolute differences, the usual
+* estimate of which will compress best, writing the filter type and the filtered bytes to out.
+* @param bpp The bytes per pixel, the distance to the left neighbour.
+* @param candidate Scratch space for the filter being tried.
+* */
+static void FilterRow(const unsigned char* row, const unsigned char* previous, size_t length, int bpp,
+	std::vector<unsigned char>& candidate, unsigned char* out)
+{
+	candidate.resize(length);
+	unsigned char* filtered = &candidate[0];
+	uint64_t bestSum = ~(uint64_t)0;
+	for (int type = 0; type < 5; ++type)
+	{
+		//The first pixel has no left neighbour, which counts as zero.
+		for (size_t i = 0; i < (size_t)bpp; ++i)
+		{
+			const int predicted = type == 2 || type == 4 ? previous[i] : type == 3 ? previous[i] >> 1 : 0;
+			filtered[i] = (unsigned char)(row[i] - predicted);
+		}
+
+		switch (type)
+		{
+		case 0:
+			memcpy(filtered, row, length);
+			break;
+		case 1:
+			for (size_t i = bpp; i < length; ++i)
+				filtered[i] = (unsigned char)(row[i] - row[i - bpp]);
+			break;
+		case 2:
+			for (size_t i = bpp; i < length; ++i)
+				filtered[i] = (unsigned char)(row[i] - previous[i]);
+			break;
+		case 3:
+			for (size_t i = bpp; i < length; ++i)
+				filtered[i] = (unsigned char)(row[i] - ((row[i - bpp] + previous[i]) >> 1));
+			break;
+		default:
+			for (size_t i = bpp; i < length; ++i)
+				filtered[i] = (unsigned char)(row[i] - Paeth(row[i - bpp], previous[i], previous[i - bpp]));
+			break;
+		}
+
+		uint64_t sum = 0;
+		for (size_t i = 0; i < length; ++i)
+			sum += (unsigned)abs((signed char)filtered[i]);
+		if (sum < bestSum)
+		{
+			bestSum = sum;
+			out[0] = (unsigned char)type;
+			memcpy(out + 1, filtered, length);
+		}
+	}
+}
+
+bool PngWriter::open(const std::string& path, int width, int height, int channels, int level)
+{
+	if (channels != 1 && channels != 3)
+	{
+		Error("PNG streaming supports 1 or 3 channels, not " + ToString(channels));
+		return false;
+	}
+
+	mOut.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (mOut.fail())
+	{
+		Error("Could not create " + path);
+		return false;
+	}
+
+	mWidth = width;
+	mHeight = height;
+	mChannels = channels;
+	mLevel = std::max(0, std::min(level, 9));
+	mRowsWritten = 0;
+	mFirstData = true;
+	mAdler = 1;
+
+	//The row above the first is taken to be zeros.
+	mPrevious.assign((size_t)width * channels * 2, 0);
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	mOut.write((const char*)signature, 8);
+
+	unsigned char header[13];
+	PutBigEndian(header, (uint32_t)width);
+	PutBigEndian(header + 4, (uint32_t)height);
+	header[8] = 16; //bit depth
+	header[9] = channels == 1 ? 0 : 2; //greyscale or truecolour
+	header[10] = 0; //deflate
+	header[11] = 0; //adaptive filtering
+	header[12] = 0; //no interlace
+	writeChunk("IHDR", header, sizeof(header));
+
+	return !mOut.fail();
+}
+
+bool PngWriter::writeRows(const cv::Mat& rows, ThreadPool* pool)
+{
+	if (rows.cols != mWidth || rows.channels() != mChannels || rows.depth() != CV_16U ||
+		mRowsWritten + rows.rows > mHeight)
+	{
+		Error("Rows do not match the PNG being written");
+		return false;
+	}
+	if (rows.rows == 0)
+		return true;
+
+	const size_t samples = (size_t)mWidth * mChannels;
+	const size_t rowBytes = samples * 2;
+	const int chunkRows = (int)std::max<size_t>(1, kChunkBytes / (rowBytes + 1));
+	const int chunks = (rows.rows + chunkRows - 1) / chunkRows;
+	auto run = [pool](int count, const std::function<void(int)>& task) {
+		if (pool)
+			pool->run(count, task);
+		else
+			for (int i = 0; i < count; ++i)
+				task(i);
+	};
+
+	//Serialise the rows: big endian samples in RGB order.
+	mRaw.resize(rowBytes * rows.rows);
+	run(chunks, [&](int c) {
+		for (int r = c * chunkRows; r < std::min(rows.rows, (c + 1) * chunkRows); ++r)
+		{
+			const uint16_t* in = (const uint16_t*)(rows.data + r*rows.step);
+			unsigned char* out = &mRaw[r * rowBytes];
+			if (mChannels == 1)
+				for (size_t i = 0; i < samples; ++i, out += 2)
+				{
+					out[0] = (unsigned char)(in[i] >> 8);
+					out[1] = (unsigned char)in[i];
+				}
+			else
+				for (size_t i = 0; i < samples; i += 3, out += 6)
+					for (int k = 0; k < 3; ++k)
+					{
+						const uint16_t v = in[i + 2 - k];
+						out[k * 2] = (unsigned char)(v >> 8);
+						out[k * 2 + 1] = (unsigned char)v;
+					}
+		}
+	});
+
+	//Filter and compress each chunk on its own. The chunks are deflate blocks that join into the one
+	//stream PNG requires, the first starting with the stream header. Stored chunks keep filter type 0.
+	mChunks.resize(chunks);
+	mChunkAdler.resize(chunks);
+	mChunkSize.resize(chunks);
+	const bool first = mFirstData;
+	run(chunks, [&](int c) {
+		const int begin = c * chunkRows;
+		const int end = std::min(rows.rows, begin + chunkRows);
+		std::vector<unsigned char> filtered((size_t)(end - begin) * (rowBytes + 1));
+		std::vector<unsigned char> candidate;
+		for (int r = begin; r < end; ++r)
+		{
+			unsigned char* out = &filtered[(r - begin) * (rowBytes + 1)];
+			const unsigned char* row = &mRaw[r * rowBytes];
+			if (mLevel == 0)
+			{
+				out[0] = 0;
+				memcpy(out + 1, row, rowBytes);
+			}
+			else
+				FilterRow(row, r == 0 ? &mPrevious[0] : row - rowBytes, rowBytes, mChannels * 2, candidate, out);
+		}
+
+		std::vector<unsigned char>& chunk = mChunks[c];
+		chunk.clear();
+		if (first && c == 0)
+		{
+			chunk.push_back(0x78);
+			chunk.push_back(0x01);
+		}
+		DeflateBlocks(filtered.data(), filtered.size(), mLevel, chunk);
+		mChunkAdler[c] = Adler32(filtered.data(), filtered.size());
+		mChunkSize[c] = filtered.size();
+	});
+	mFirstData = false;
+
+	for (int c = 0; c < chunks; ++c)
+	{
+		writeChunk("IDAT", mChunks[c].data(), mChunks[c].size());
+		mAdler = CombineAdler32(mAdler, mChunkAdler[c], mChunkSize[c]);
+	}
+	memcpy(&mPrevious[0], &mRaw[(rows.rows - 1) * rowBytes], rowBytes);
+
+	mRowsWritten += rows.rows;
+	return !mOut.fail();
+}
+
+bool PngWriter::close()
+{
+	if (!mOut.is_open())
+		return false;
+
+	if (mRowsWritten != mHeight)
+	{
+		Error("PNG closed after " + ToString(mRowsWritten) + " of " + ToString(mHeight) + " rows");
+		mOut.close();
+		return false;
+	}
+
+	//An empty final block, followed by the checksum of the uncompressed data. The stream header is
+	//only needed here if no rows were written at all.
+	unsigned char tail[11] = { 0x78, 0x01 };
+	unsigned char* p = mFirstData ? tail + 2 : tail;
+	p[0] = 1; p[1] = 0; p[2] = 0; p[3] = 0xff; p[4] = 0xff;
+	PutBigEndian(p + 5, mAdler);
+	writeChunk("IDAT", tail, (p + 9) - tail);
+	writeChunk("IEND", nullptr, 0);
+
+	const bool succeeded = !mOut.fail();
+	mOut.close();
+	return succeeded;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+namespace cv { class Mat; }
+class ThreadPool;
+
+/**
+* Writes a 16 bit greyscale or RGB PNG a band of rows at a time, so that the whole image never has to
+* be held in memory. Each band is cut into chunks of about a megabyte, which are filtered and compressed
+* independently (see DeflateBlocks), in parallel if given a thread pool, and written as separate IDAT
+* chunks. At level 0 the pixel data is instead stored in uncompressed deflate blocks, which is fastest
+* but makes files about as large as the raw samples.
+* */
+class PngWriter
+{
+	std::fstream mOut;
+	int mWidth = 0;
+	int mHeight = 0;
+	int mChannels = 0;
+	int mRowsWritten = 0;
+	int mLevel = 0;
+	bool mFirstData = true;
+
+	//Running Adler-32 of the uncompressed stream.
+	uint32_t mAdler = 1;
+
+	//The last row of the previous band, unfiltered, which the first row of the next is filtered against.
+	std::vector<unsigned char> mPrevious;
+
+	//Reused between bands: the unfiltered rows, and each chunk compressed with its Adler-32 and size.
+	std::vector<unsigned char> mRaw;
+	std::vector<std::vector<unsigned char> > mChunks;
+	std::vector<uint32_t> mChunkAdler;
+	std::vector<size_t> mChunkSize;
+
+	/** Writes one chunk with its length and CRC. */
+	void writeChunk(const char* type, const unsigned char* data, size_t length);
+
+public:
+
+	/** Closes the file if it is still open. */
+	~PngWriter();
+
+	/**
+	* Creates the file and writes the header.
+	* @param channels 1 for greyscale or 3 for colour.
+	* @param level The compression level, from 0 (stored uncompressed) to 9 (smallest).
+	* */
+	bool open(const std::string& path, int width, int height, int channels, int level = 0);
+
+	/**
+	* Appends rows to the image.
+	* @param rows A CV_16UC1 or CV_16UC3 (BGR, as used by OpenCV) image of the opened width and channels.
+	* @param pool If not nullptr, the chunks are compressed on it. Otherwise they are compressed on the calling thread.
+	* */
+	bool writeRows(const cv::Mat& rows, ThreadPool* pool = nullptr);
+
+	/** Finishes the file. Returns false if fewer rows than the height were written or writing failed. */
+	bool close();
+};
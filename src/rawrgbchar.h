@@ -1,6 +1,7 @@
 #pragma once
 /** Defines the RawRgbEds typedef for referencing raw RGB data in an char vector.
  * The format is <width,height,vector>
+ * Every reader here accepts both versions of the .rawrgb format (see rawrgbformat.h).
  * */
 
 #include <tuple>
@@ -8,11 +9,28 @@
 #include <fstream>
 #include "io.h"
 #include <stdint.h>
+#include <utility>
+#include "rawrgbformat.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 typedef std::tuple<int, int, std::vector<uint16_t> > RawRgbChar;
 
-/** Loads the raw RGB values into a char stream, intended for the Ground Truth application. */
-static bool LoadRawRgb(const std::string& path, RawRgbChar& out)
+/**
+* Loads the raw RGB values into a char stream, intended for the Ground Truth application.
+* @param pool The pool to decode a version 2 file on, or nullptr to decode it on the calling thread.
+* */
+static bool LoadRawRgb(const std::string& path, RawRgbChar& out, ThreadPool* pool = nullptr)
 {
 	std::fstream in(path, std::ios::in | std::ios::binary);
 	if (in.fail())
@@ -22,6 +40,18 @@ static bool LoadRawRgb(const std::string& path, RawRgbChar& out)
 	int& height = std::get<1>(out);
 	std::vector<uint16_t>& container = std::get<2>(out);
 
+	char magic[sizeof(kRawRgbMagic)] = {};
+	in.read(magic, sizeof(magic));
+	if (memcmp(magic, kRawRgbMagic, sizeof(magic)) == 0)
+	{
+		in.seekg(0, std::ios::end);
+		std::vector<unsigned char> file((size_t)in.tellg());
+		in.seekg(0);
+		in.read((char*)&file[0], file.size());
+		return !in.fail() && DecodeRawRgb(&file[0], file.size(), width, height, container, pool);
+	}
+
+	in.clear();
 	in.seekg(0);
 	in.read((char*)&width, sizeof(int));
 	in.read((char*)&height, sizeof(int));
@@ -34,3 +64,285 @@ static bool LoadRawRgb(const std::string& path, RawRgbChar& out)
 
 	return true;
 }
+
+/**
+* Maps a .rawrgb file into memory read-only, so that its pixels can be used where they lie instead of
+* being loaded into a buffer. Nothing is read until the pixels are touched, and the operating system is
+* asked to read ahead, since they are used from top to bottom. Compressed files cannot be used in place,
+* so they are decoded from the mapping into a buffer instead.
+* */
+class RawRgbMapping
+{
+	const unsigned char* mData = nullptr;
+	std::vector<uint16_t> mDecoded;
+	size_t mSize = 0;
+	int mWidth = 0;
+	int mHeight = 0;
+
+#ifdef _WIN32
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+#endif
+
+	RawRgbMapping(const RawRgbMapping&) = delete;
+	RawRgbMapping& operator = (const RawRgbMapping&) = delete;
+
+public:
+
+	RawRgbMapping() {}
+
+	RawRgbMapping(RawRgbMapping&& other)
+	{
+		*this = std::move(other);
+	}
+
+	RawRgbMapping& operator = (RawRgbMapping&& other)
+	{
+		close();
+		std::swap(mData, other.mData);
+		std::swap(mDecoded, other.mDecoded);
+		std::swap(mSize, other.mSize);
+		std::swap(mWidth, other.mWidth);
+		std::swap(mHeight, other.mHeight);
+#ifdef _WIN32
+		std::swap(mFile, other.mFile);
+		std::swap(mMapping, other.mMapping);
+#endif
+		return *this;
+	}
+
+	/** Unmaps the file. */
+	~RawRgbMapping()
+	{
+		close();
+	}
+
+	/**
+	* Maps the file, returning false if it cannot be mapped or is shorter than its header says.
+	* @param pool The pool to decode a version 2 file on, or nullptr to decode it on the calling thread.
+	* */
+	bool open(const std::string& path, ThreadPool* pool = nullptr)
+	{
+		close();
+#ifdef _WIN32
+		mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size;
+		if (mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFile, &size) || size.QuadPart < 2 * (LONGLONG)sizeof(int))
+		{
+			close();
+			return false;
+		}
+		mSize = (size_t)size.QuadPart;
+
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		mData = mMapping ? (const unsigned char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!mData)
+		{
+			close();
+			return false;
+		}
+#else
+		const int file = ::open(path.c_str(), O_RDONLY);
+		struct stat status;
+		if (file < 0 || fstat(file, &status) != 0 || status.st_size < 2 * (off_t)sizeof(int))
+		{
+			if (file >= 0)
+				::close(file);
+			return false;
+		}
+
+		void* data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file);
+		if (data == MAP_FAILED)
+			return false;
+		mData = (const unsigned char*)data;
+		mSize = (size_t)status.st_size;
+
+		//The pixels are used from top to bottom, so start reading them in now.
+		madvise(data, mSize, MADV_SEQUENTIAL);
+		madvise(data, mSize, MADV_WILLNEED);
+#endif
+
+		if (IsRawRgbV2(mData, mSize))
+		{
+			int width = 0, height = 0;
+			std::vector<uint16_t> decoded;
+			const bool valid = DecodeRawRgb(mData, mSize, width, height, decoded, pool);
+			close();
+			if (!valid)
+				return false;
+
+			mDecoded.swap(decoded);
+			mWidth = width;
+			mHeight = height;
+			return true;
+		}
+
+		mWidth = ((const int*)mData)[0];
+		mHeight = ((const int*)mData)[1];
+		if (mWidth <= 0 || mHeight <= 0 || mSize < 2 * sizeof(int) + (size_t)mWidth * mHeight * 3 * sizeof(uint16_t))
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	/** Returns the width of the image. */
+	int width() const { return mWidth; }
+
+	/** Returns the height of the image. */
+	int height() const { return mHeight; }
+
+	/** Returns the width*height*3 values of the image, valid until the file is unmapped. */
+	const uint16_t* pixels() const
+	{
+		return mDecoded.empty() ? (const uint16_t*)(mData + 2 * sizeof(int)) : &mDecoded[0];
+	}
+
+	/** Unmaps the file and releases any decoded pixels. */
+	void close()
+	{
+#ifdef _WIN32
+		if (mData)
+			UnmapViewOfFile(mData);
+		if (mMapping)
+			CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE)
+			CloseHandle(mFile);
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+#else
+		if (mData)
+			munmap((void*)mData, mSize);
+#endif
+		mData = nullptr;
+		std::vector<uint16_t>().swap(mDecoded);
+		mSize = 0;
+		mWidth = 0;
+		mHeight = 0;
+	}
+};
+
+/**
+* Reads a .rawrgb file a band of rows at a time, for streaming ground truth generation.
+* Compressed files are decoded a block at a time, keeping only the last block.
+* */
+class RawRgbReader
+{
+	std::fstream mIn;
+	int mWidth = 0;
+	int mHeight = 0;
+
+	//The header and block table of a compressed file, whose blockCount is 0 otherwise.
+	RawRgbHeader mHeader = RawRgbHeader();
+	std::vector<RawRgbBlock> mBlocks;
+
+	//The last block decoded, and its pixels.
+	int mBlock = -1;
+	std::vector<uint16_t> mBlockPixels;
+	std::vector<unsigned char> mBlockData;
+
+	/** Returns the pixels of a row of a compressed file, decoding its block if needed, or nullptr upon failure. */
+	const uint16_t* compressedRow(int row)
+	{
+		const int block = row / mHeader.blockRows;
+		if (block != mBlock)
+		{
+			mBlock = -1;
+			const RawRgbBlock& entry = mBlocks[block];
+			mBlockData.resize(entry.size);
+			mBlockPixels.resize((size_t)mHeader.blockRows * mWidth * 3);
+			mIn.seekg((std::streamoff)entry.offset);
+			mIn.read((char*)mBlockData.data(), entry.size);
+			if (mIn.fail() || RawRgbChecksum(mBlockData.data(), entry.size) != entry.checksum ||
+				!DecompressRawRgbBlock(mBlockData.data(), entry.size, mWidth, RawRgbBlockRows(mHeader, block),
+				&mBlockPixels[0]))
+				return nullptr;
+			mBlock = block;
+		}
+		return &mBlockPixels[(size_t)(row - block * mHeader.blockRows) * mWidth * 3];
+	}
+
+public:
+
+	/** Opens the file and reads its header, returning false upon failure. */
+	bool open(const std::string& path)
+	{
+		mIn.open(path, std::ios::in | std::ios::binary);
+		if (mIn.fail())
+			return false;
+
+		char magic[sizeof(kRawRgbMagic)] = {};
+		mIn.read(magic, sizeof(magic));
+		if (memcmp(magic, kRawRgbMagic, sizeof(magic)) == 0)
+		{
+			if (!ReadRawRgbHeader(mIn, mHeader, mBlocks))
+				return false;
+			mWidth = mHeader.width;
+			mHeight = mHeader.height;
+			return true;
+		}
+
+		mIn.clear();
+		mIn.seekg(0);
+		mIn.read((char*)&mWidth, sizeof(int));
+		mIn.read((char*)&mHeight, sizeof(int));
+
+		return !mIn.fail() && mWidth > 0 && mHeight > 0;
+	}
+
+	/** Returns the width of the image. */
+	int width() const { return mWidth; }
+
+	/** Returns the height of the image. */
+	int height() const { return mHeight; }
+
+	/**
+	* Reads rows [row, row + count) into out, which must hold count*width*3 values.
+	* Returns false if the file is too short.
+	* */
+	bool readRows(int row, int count, uint16_t* out)
+	{
+		if (mHeader.blockCount)
+			return readRegion(row, count, 0, mWidth, out);
+
+		const std::streamoff rowBytes = (std::streamoff)mWidth * 3 * sizeof(uint16_t);
+		mIn.seekg(2 * sizeof(int) + row * rowBytes);
+		mIn.read((char*)out, count * rowBytes);
+		return !mIn.fail();
+	}
+
+	/**
+	* Reads columns [x, x + width) of rows [row, row + count) into out, which must hold count*width*3
+	* values, so that only that region of the file is read.
+	* Returns false if the file is too short.
+	* */
+	bool readRegion(int row, int count, int x, int width, uint16_t* out)
+	{
+		if (mHeader.blockCount)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				const uint16_t* pixels = row + i < mHeight ? compressedRow(row + i) : nullptr;
+				if (!pixels)
+					return false;
+				memcpy(out + (size_t)i * width * 3, pixels + (size_t)x * 3, (size_t)width * 3 * sizeof(uint16_t));
+			}
+			return true;
+		}
+
+		if (x == 0 && width == mWidth)
+			return readRows(row, count, out);
+
+		const std::streamoff rowBytes = (std::streamoff)mWidth * 3 * sizeof(uint16_t);
+		const std::streamoff regionBytes = (std::streamoff)width * 3 * sizeof(uint16_t);
+		for (int i = 0; i < count; ++i)
+		{
+			mIn.seekg(2 * sizeof(int) + (row + i) * rowBytes + (std::streamoff)x * 3 * sizeof(uint16_t));
+			mIn.read((char*)(out + (size_t)i * width * 3), regionBytes);
+		}
+		return !mIn.fail();
+	}
+};
@@ -6,28 +6,60 @@
 #include <tuple>
 #include <fstream>
 #include "edsstreamcontainer.h"
+#include "rawrgbformat.h"
+#include "capturebundle.h"
 
 typedef std::tuple<int, int, EdsStreamContainer> RawRgbEds;
 
-/** Saves the raw RGB values from the eds stream in a custom minimal format for use
-by the Ground Truth application. */
-static bool SaveRawRgbEds(const std::string& path, const RawRgbEds& rgb)
+/**
+* Saves the raw RGB values from the eds stream in a custom minimal format for use by the Ground Truth
+* application, compressed as version 2 of the format (see rawrgbformat.h).
+* @param pool The pool to compress on, or nullptr to compress on the calling thread.
+* */
+static bool SaveRawRgbEds(const std::string& path, const RawRgbEds& rgb, ThreadPool* pool = nullptr)
 {
 	int width = std::get<0>(rgb);
 	int height = std::get<1>(rgb);
 	const EdsStreamContainer& container = std::get<2>(rgb);
 
-	if (width*height == 0 || container.size() == 0)
+	if (width*height == 0 || container.size() < (size_t)width * height * 3 * sizeof(uint16_t))
 		return false;
 
-	std::fstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
-	if (out.fail())
+	return SaveRawRgb(path, width, height, (const uint16_t*)container.pointer(), pool);
+}
+
+/**
+* Saves the raw RGB values of every plate of a capture set as one capture bundle (see capturebundle.h), for
+* use by the Ground Truth application.
+* @param plates The plates, which must all be the same size.
+* @param pool The pool to compress on, or nullptr to compress on the calling thread.
+* @return false if there are no plates, they differ in size or the bundle could not be written.
+* */
+static bool SaveRawRgbEdsBundle(const std::string& path, const std::vector<const RawRgbEds*>& plates,
+	ThreadPool* pool = nullptr)
+{
+	if (plates.empty())
+		return false;
+
+	const int width = std::get<0>(*plates[0]);
+	const int height = std::get<1>(*plates[0]);
+	for (const RawRgbEds* plate : plates)
+		if (std::get<0>(*plate) != width || std::get<1>(*plate) != height ||
+			std::get<2>(*plate).size() < (size_t)width * height * 3 * sizeof(uint16_t))
+			return false;
+
+	CaptureBundleWriter writer;
+	if (!writer.open(path, width, height, (int)plates.size()))
 		return false;
 
-	out.seekp(0);
-	out.write((char*)&width, sizeof(int));
-	out.write((char*)&height, sizeof(int));
-	out.write((char*)container.pointer(), container.size());
+	std::vector<const uint16_t*> rows(plates.size());
+	for (int row = 0; row < height; row += kCaptureBundleTileRows)
+	{
+		for (size_t i = 0; i < plates.size(); ++i)
+			rows[i] = (const uint16_t*)std::get<2>(*plates[i]).pointer() + (size_t)row * width * 3;
+		if (!writer.writeTile(&rows[0], pool))
+			return false;
+	}
 
-	return true;
-}
\ No newline at end of file
+	return writer.close();
+}
@@ -0,0 +1,410 @@
+#pragma once
+/** Defines version 2 of the .rawrgb format, which compresses the 16 bit samples losslessly so that
+ * temporary files take a fraction of the disk time. Version 1 files are two ints, width and height,
+ * followed by the width*height*3 samples; version 2 files start with a RawRgbHeader, whose magic can never
+ * be mistaken for a plausible width, followed by a RawRgbBlock entry for each block of kRawRgbBlockRows
+ * rows, followed by the blocks. Every block is compressed on its own, so blocks can be encoded and decoded
+ * in parallel and a band of rows can be read without decoding the rest of the file.
+ *
+ * A block is compressed by predicting each sample from the same channel of the pixel to its left, or of the
+ * pixel above for the first pixel of a row, and storing the zigzagged differences in groups of
+ * kRawRgbGroupSize, each group as a byte giving the number of bits of its largest difference followed by the
+ * differences packed into that many bits. A block that would not get smaller is stored as it is, which its
+ * size alone tells apart.
+ * */
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include "threadpool.h"
+
+static const char kRawRgbMagic[4] = { 'R', 'R', 'G', 'B' };
+static const int kRawRgbVersion = 2;
+
+//Rows compressed together. Small enough for a band of rows to need little more than it.
+static const int kRawRgbBlockRows = 16;
+
+//Differences sharing a bit width.
+static const int kRawRgbGroupSize = 32;
+
+//The only compression so far, the one described above.
+static const int kRawRgbDeltaPacked = 1;
+
+/** The start of a version 2 .rawrgb file. */
+struct RawRgbHeader
+{
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int channels;
+	int bitsPerSample;
+	int compression;
+	int blockRows;
+	int blockCount;
+
+	//The checksum of the header, with this field 0, and of the block table.
+	uint32_t checksum;
+};
+
+/** Where a block lies in the file and the checksum of its stored bytes. */
+struct RawRgbBlock
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t checksum;
+};
+
+/**
+* Returns a checksum of size bytes, continuing from hash. It is FNV-1a taken over 64 bit words rather than
+* bytes, so that it keeps up with the disk.
+* */
+static uint32_t RawRgbChecksum(const void* data, size_t size, uint32_t hash = 2166136261u)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = 14695981039346656037ull ^ hash;
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		h = (h ^ word) * 1099511628211ull;
+	}
+	for (; size > 0; --size, ++p)
+		h = (h ^ *p) * 1099511628211ull;
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+/** Returns whether data, of size bytes, starts with a version 2 header. */
+static bool IsRawRgbV2(const void* data, size_t size)
+{
+	return size >= sizeof(RawRgbHeader) && memcmp(data, kRawRgbMagic, sizeof(kRawRgbMagic)) == 0;
+}
+
+/**
+* Calls f(i) for every i below count.
+* @param pool The pool to spread the calls over, or nullptr to make them on the calling thread.
+* */
+template<typename F>
+static void ForEachRawRgbBlock(int count, ThreadPool* pool, const F& f)
+{
+	if (pool && count > 1)
+		pool->run(count, f);
+	else
+		for (int i = 0; i < count; ++i)
+			f(i);
+}
+
+/** Compresses rows of width pixels into out, or copies them if that is no smaller. */
+static void CompressRawRgbBlock(const uint16_t* in, int width, int rows, std::vector<unsigned char>& out)
+{
+	const size_t rowSamples = (size_t)width * 3;
+	const size_t count = rowSamples * rows;
+	const size_t rawBytes = count * sizeof(uint16_t);
+
+	//Zigzagged differences from the predictions, computed a row at a time so that the loops vectorise.
+	std::vector<uint16_t> differences(count);
+	for (int y = 0; y < rows; ++y)
+	{
+		const uint16_t* row = in + y * rowSamples;
+		uint16_t* d = &differences[y * rowSamples];
+		for (size_t x = 0; x < rowSamples; ++x)
+		{
+			const uint16_t prediction = x >= 3 ? row[x - 3] : y > 0 ? row[x - rowSamples] : 0;
+			const uint16_t difference = (uint16_t)(row[x] - prediction);
+			d[x] = (uint16_t)((difference << 1) ^ (uint16_t)-(int)(difference >> 15));
+		}
+	}
+
+	//Every group may need its bit width byte and 16 bits per difference.
+	out.resize(rawBytes + (count + kRawRgbGroupSize - 1) / kRawRgbGroupSize);
+	unsigned char* p = &out[0];
+
+	for (size_t group = 0; group < count; group += kRawRgbGroupSize)
+	{
+		const int n = (int)std::min<size_t>(kRawRgbGroupSize, count - group);
+		const uint16_t* d = &differences[group];
+		unsigned all = 0;
+		for (int i = 0; i < n; ++i)
+			all |= d[i];
+
+		int bits = 0;
+		while ((all >> bits) != 0)
+			++bits;
+		*p++ = (unsigned char)bits;
+
+		uint64_t buffer = 0;
+		int filled = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			buffer |= (uint64_t)d[i] << filled;
+			filled += bits;
+			if (filled >= 32)
+			{
+				memcpy(p, &buffer, 4);
+				p += 4;
+				buffer >>= 32;
+				filled -= 32;
+			}
+		}
+		for (; filled > 0; filled -= 8, buffer >>= 8)
+			*p++ = (unsigned char)buffer;
+	}
+
+	const size_t size = p - &out[0];
+	if (size >= rawBytes)
+	{
+		out.resize(rawBytes);
+		memcpy(&out[0], in, rawBytes);
+	}
+	else
+		out.resize(size);
+}
+
+/**
+* Decompresses a block of rows of width pixels into out.
+* @return false if the block is malformed.
+* */
+static bool DecompressRawRgbBlock(const unsigned char* in, size_t size, int width, int rows, uint16_t* out)
+{
+	const size_t rowSamples = (size_t)width * 3;
+	const size_t count = rowSamples * rows;
+	if (size == count * sizeof(uint16_t))
+	{
+		memcpy(out, in, size);
+		return true;
+	}
+
+	//Unpack the zigzagged differences into out, then undo the predictions in place.
+	const unsigned char* end = in + size;
+	for (size_t group = 0; group < count; group += kRawRgbGroupSize)
+	{
+		const int n = (int)std::min<size_t>(kRawRgbGroupSize, count - group);
+		if (in == end)
+			return false;
+		const int bits = *in++;
+		const size_t bytes = ((size_t)n * bits + 7) / 8;
+		if (bits > 16 || (size_t)(end - in) < bytes)
+			return false;
+
+		const uint32_t mask = (1u << bits) - 1;
+		uint64_t buffer = 0;
+		int filled = 0;
+		const unsigned char* next = in;
+		for (int i = 0; i < n; ++i)
+		{
+			for (; filled < bits; filled += 8)
+				buffer |= (uint64_t)*next++ << filled;
+			out[group + i] = (uint16_t)(buffer & mask);
+			buffer >>= bits;
+			filled -= bits;
+		}
+		in += bytes;
+	}
+	if (in != end)
+		return false;
+
+	for (int y = 0; y < rows; ++y)
+	{
+		uint16_t* row = out + y * rowSamples;
+		for (size_t x = 0; x < rowSamples; ++x)
+		{
+			const uint16_t prediction = x >= 3 ? row[x - 3] : y > 0 ? row[x - rowSamples] : 0;
+			row[x] = (uint16_t)(prediction + ((row[x] >> 1) ^ (uint16_t)-(int)(row[x] & 1)));
+		}
+	}
+	return true;
+}
+
+/** Returns the number of rows in block i of an image of the given height. */
+static int RawRgbBlockRows(const RawRgbHeader& header, int i)
+{
+	return std::min(header.blockRows, header.height - i * header.blockRows);
+}
+
+/**
+* Checks a version 2 header and its block table against each other and against the file size.
+* @return false if the file is not a valid version 2 file.
+* */
+static bool CheckRawRgbHeader(const RawRgbHeader& header, const RawRgbBlock* blocks, uint64_t fileSize)
+{
+	if (memcmp(header.magic, kRawRgbMagic, sizeof(kRawRgbMagic)) != 0 || header.version != kRawRgbVersion ||
+		header.channels != 3 || header.bitsPerSample != 16 || header.compression != kRawRgbDeltaPacked ||
+		header.width <= 0 || header.height <= 0 || header.blockRows <= 0 ||
+		header.blockCount != (header.height + header.blockRows - 1) / header.blockRows)
+		return false;
+
+	RawRgbHeader copy = header;
+	copy.checksum = 0;
+	const uint32_t checksum = RawRgbChecksum(blocks, header.blockCount * sizeof(RawRgbBlock),
+		RawRgbChecksum(&copy, sizeof(copy)));
+	if (checksum != header.checksum)
+		return false;
+
+	for (int i = 0; i < header.blockCount; ++i)
+		if (blocks[i].offset > fileSize || blocks[i].size > fileSize - blocks[i].offset)
+			return false;
+	return true;
+}
+
+/**
+* Reads and checks the header and block table of a version 2 file whose magic has already been read.
+* @return false if the file is not a valid version 2 file.
+* */
+static bool ReadRawRgbHeader(std::istream& in, RawRgbHeader& header, std::vector<RawRgbBlock>& blocks)
+{
+	in.seekg(0, std::ios::end);
+	const uint64_t fileSize = (uint64_t)in.tellg();
+	in.seekg(0);
+	in.read((char*)&header, sizeof(header));
+	if (in.fail() || header.blockCount <= 0 || header.blockCount > header.height)
+		return false;
+
+	blocks.resize(header.blockCount);
+	in.read((char*)&blocks[0], blocks.size() * sizeof(RawRgbBlock));
+	return !in.fail() && CheckRawRgbHeader(header, &blocks[0], fileSize);
+}
+
+/**
+* Decodes a whole version 2 file held in memory.
+* @param pixels Receives the width*height*3 samples.
+* @param pool The pool to decode the blocks on, or nullptr to decode them on the calling thread.
+* @return false if the file is malformed or a checksum does not match.
+* */
+static bool DecodeRawRgb(const unsigned char* file, size_t size, int& width, int& height, std::vector<uint16_t>& pixels,
+	ThreadPool* pool = nullptr)
+{
+	if (!IsRawRgbV2(file, size))
+		return false;
+
+	RawRgbHeader header;
+	memcpy(&header, file, sizeof(header));
+	if (header.blockCount <= 0 || header.blockCount > header.height ||
+		size < sizeof(header) + header.blockCount * sizeof(RawRgbBlock))
+		return false;
+
+	std::vector<RawRgbBlock> blocks(header.blockCount);
+	memcpy(&blocks[0], file + sizeof(header), blocks.size() * sizeof(RawRgbBlock));
+	if (!CheckRawRgbHeader(header, &blocks[0], size))
+		return false;
+
+	width = header.width;
+	height = header.height;
+	pixels.resize((size_t)width * height * 3);
+
+	std::atomic<bool> valid(true);
+	ForEachRawRgbBlock(header.blockCount, pool, [&](int i) {
+		const unsigned char* data = file + blocks[i].offset;
+		uint16_t* out = &pixels[(size_t)i * header.blockRows * width * 3];
+		if (RawRgbChecksum(data, blocks[i].size) != blocks[i].checksum ||
+			!DecompressRawRgbBlock(data, blocks[i].size, width, RawRgbBlockRows(header, i), out))
+			valid = false;
+	});
+	return valid;
+}
+
+/**
+* Writes a version 2 .rawrgb file a band of rows at a time, so that images larger than memory can be saved.
+* The block table is written once every block is known.
+* */
+class RawRgbWriter
+{
+	std::fstream mOut;
+	RawRgbHeader mHeader = RawRgbHeader();
+	std::vector<RawRgbBlock> mBlocks;
+	uint64_t mOffset = 0;
+	int mBlock = 0;
+
+public:
+
+	/** Creates the file for an image of width by height pixels, returning false upon failure. */
+	bool open(const std::string& path, int width, int height)
+	{
+		if (width <= 0 || height <= 0)
+			return false;
+
+		memcpy(mHeader.magic, kRawRgbMagic, sizeof(kRawRgbMagic));
+		mHeader.version = kRawRgbVersion;
+		mHeader.width = width;
+		mHeader.height = height;
+		mHeader.channels = 3;
+		mHeader.bitsPerSample = 16;
+		mHeader.compression = kRawRgbDeltaPacked;
+		mHeader.blockRows = kRawRgbBlockRows;
+		mHeader.blockCount = (height + kRawRgbBlockRows - 1) / kRawRgbBlockRows;
+		mHeader.checksum = 0;
+		mBlocks.assign(mHeader.blockCount, RawRgbBlock());
+		mBlock = 0;
+
+		mOut.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (mOut.fail())
+			return false;
+
+		mOffset = sizeof(mHeader) + mBlocks.size() * sizeof(RawRgbBlock);
+		mOut.seekp((std::streamoff)mOffset);
+		return !mOut.fail();
+	}
+
+	/**
+	* Compresses the next rows and appends them.
+	* @param pixels rows*width*3 samples. rows must be a multiple of kRawRgbBlockRows, except for the last rows of the image.
+	* @param pool The pool to compress the blocks on, or nullptr to compress them on the calling thread.
+	* */
+	bool writeRows(const uint16_t* pixels, int rows, ThreadPool* pool = nullptr)
+	{
+		const int count = (rows + kRawRgbBlockRows - 1) / kRawRgbBlockRows;
+		if (rows <= 0 || mBlock + count > mHeader.blockCount ||
+			rows != std::min(count * kRawRgbBlockRows, mHeader.height - mBlock * kRawRgbBlockRows))
+			return false;
+
+		std::vector<std::vector<unsigned char>> data(count);
+		RawRgbBlock* blocks = &mBlocks[mBlock];
+		ForEachRawRgbBlock(count, pool, [&](int i) {
+			CompressRawRgbBlock(pixels + (size_t)i * kRawRgbBlockRows * mHeader.width * 3, mHeader.width,
+				RawRgbBlockRows(mHeader, mBlock + i), data[i]);
+			blocks[i].size = (uint32_t)data[i].size();
+			blocks[i].checksum = RawRgbChecksum(data[i].data(), data[i].size());
+		});
+
+		for (int i = 0; i < count; ++i)
+		{
+			blocks[i].offset = mOffset;
+			mOffset += blocks[i].size;
+			mOut.write((const char*)data[i].data(), data[i].size());
+		}
+		mBlock += count;
+		return !mOut.fail();
+	}
+
+	/** Writes the header and block table, returning false if rows are missing or any write failed. */
+	bool close()
+	{
+		if (mBlock != mHeader.blockCount)
+		{
+			mOut.close();
+			return false;
+		}
+
+		mHeader.checksum = RawRgbChecksum(&mBlocks[0], mBlocks.size() * sizeof(RawRgbBlock),
+			RawRgbChecksum(&mHeader, sizeof(mHeader)));
+		mOut.seekp(0);
+		mOut.write((const char*)&mHeader, sizeof(mHeader));
+		mOut.write((const char*)&mBlocks[0], mBlocks.size() * sizeof(RawRgbBlock));
+		mOut.close();
+		return !mOut.fail();
+	}
+};
+
+/**
+* Saves an image as a version 2 .rawrgb file.
+* @param pixels The width*height*3 samples.
+* @param pool The pool to compress the blocks on, or nullptr to compress them on the calling thread.
+* */
+static bool SaveRawRgb(const std::string& path, int width, int height, const uint16_t* pixels, ThreadPool* pool = nullptr)
+{
+	RawRgbWriter writer;
+	return writer.open(path, width, height) && writer.writeRows(pixels, height, pool) && writer.close();
+}
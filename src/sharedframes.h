@@ -0,0 +1,217 @@
+#pragma once
+/** Defines named shared memory holding the RGB frames of a capture set, so that CameraControl can hand
+ * them to GroundTruth without writing and reading temporary .rawrgb files. The segment starts with a
+ * SharedFramesHeader, followed by the frames in order, each width*height*3 uint16_t values laid out as in
+ * a .rawrgb file. POSIX shared memory is used where it exists, and a named file mapping on Windows; either
+ * way the segment is identified by a short name that is passed to GroundTruth with --shared-frames.
+ * */
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char kSharedFramesMagic[4] = { 'G', 'T', 'S', 'M' };
+static const int kSharedFramesVersion = 1;
+
+/** The start of a shared frames segment. Its size keeps the frames 32 byte aligned. */
+struct SharedFramesHeader
+{
+	char magic[4];
+	int version;
+	int count;
+	int width;
+	int height;
+	int reserved[3];
+};
+
+/**
+* Creates or opens a shared frames segment and maps it into memory.
+* */
+class SharedFrames
+{
+	std::string mName;
+	unsigned char* mData = nullptr;
+	size_t mSize = 0;
+
+	//Whether the segment was created here, in which case it is removed when closed.
+	bool mOwner = false;
+
+#ifdef _WIN32
+	HANDLE mMapping = nullptr;
+#endif
+
+	SharedFrames(const SharedFrames&) = delete;
+	SharedFrames& operator = (const SharedFrames&) = delete;
+
+	/** Returns the name of the segment as the operating system knows it. */
+	static std::string systemName(const std::string& name)
+	{
+#ifdef _WIN32
+		return "Local\\" + name;
+#else
+		return "/" + name;
+#endif
+	}
+
+	/** Returns the header at the start of the segment. */
+	SharedFramesHeader& header() const
+	{
+		return *(SharedFramesHeader*)mData;
+	}
+
+	/**
+	* Maps the segment called name, creating it with size bytes if create is set, or otherwise mapping all
+	* of an existing one for reading. Returns false upon failure.
+	* */
+	bool map(const std::string& name, size_t size, bool create)
+	{
+		mName = name;
+		const std::string systemPath = systemName(name);
+#ifdef _WIN32
+		if (create)
+			mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+				(DWORD)((unsigned long long)size >> 32), (DWORD)size, systemPath.c_str());
+		else
+			mMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, systemPath.c_str());
+		if (!mMapping || (create && GetLastError() == ERROR_ALREADY_EXISTS))
+			return false;
+
+		mData = (unsigned char*)MapViewOfFile(mMapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+		if (!mData)
+			return false;
+
+		if (!size)
+		{
+			MEMORY_BASIC_INFORMATION info;
+			VirtualQuery(mData, &info, sizeof(info));
+			size = info.RegionSize;
+		}
+#else
+		const int file = shm_open(systemPath.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDONLY, 0600);
+		if (file < 0)
+			return false;
+		mOwner = create;
+
+		struct stat status;
+		if ((create && ftruncate(file, (off_t)size) != 0) || (!create && fstat(file, &status) != 0))
+		{
+			::close(file);
+			return false;
+		}
+		if (!create)
+			size = (size_t)status.st_size;
+
+		void* data = size ? mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0) :
+			MAP_FAILED;
+		::close(file);
+		if (data == MAP_FAILED)
+			return false;
+		mData = (unsigned char*)data;
+#endif
+		mSize = size;
+		return true;
+	}
+
+public:
+
+	SharedFrames() {}
+
+	/** Unmaps the segment, removing it if it was created here. */
+	~SharedFrames()
+	{
+		close();
+	}
+
+	/**
+	* Creates a segment for count frames of width by height pixels, failing if one of that name exists.
+	* The frames are then filled in through frame().
+	* @return false upon failure, for instance where shared memory is not available.
+	* */
+	bool create(const std::string& name, int count, int width, int height)
+	{
+		close();
+		const size_t size = sizeof(SharedFramesHeader) + (size_t)count * width * height * 3 * sizeof(uint16_t);
+		if (count <= 0 || width <= 0 || height <= 0 || !map(name, size, true))
+		{
+			close();
+			return false;
+		}
+
+		SharedFramesHeader& h = header();
+		memcpy(h.magic, kSharedFramesMagic, sizeof(h.magic));
+		h.version = kSharedFramesVersion;
+		h.count = count;
+		h.width = width;
+		h.height = height;
+		return true;
+	}
+
+	/** Maps an existing segment for reading, returning false if it does not exist or is not valid. */
+	bool open(const std::string& name)
+	{
+		close();
+		if (!map(name, 0, false) || mSize < sizeof(SharedFramesHeader))
+		{
+			close();
+			return false;
+		}
+
+		const SharedFramesHeader& h = header();
+		const bool valid = memcmp(h.magic, kSharedFramesMagic, sizeof(h.magic)) == 0 &&
+			h.version == kSharedFramesVersion && h.count > 0 && h.width > 0 && h.height > 0 &&
+			mSize >= sizeof(SharedFramesHeader) + (size_t)h.count * h.width * h.height * 3 * sizeof(uint16_t);
+		if (!valid)
+			close();
+		return valid;
+	}
+
+	/** Returns the name of the segment, to be passed to GroundTruth. */
+	const std::string& name() const { return mName; }
+
+	/** Returns the number of frames. */
+	int count() const { return header().count; }
+
+	/** Returns the width of the frames. */
+	int width() const { return header().width; }
+
+	/** Returns the height of the frames. */
+	int height() const { return header().height; }
+
+	/** Returns the pixels of frame i. They may only be written if the segment was created here. */
+	uint16_t* frame(int i) const
+	{
+		return (uint16_t*)(mData + sizeof(SharedFramesHeader)) + (size_t)i * width() * height() * 3;
+	}
+
+	/** Unmaps the segment, removing it if it was created here. */
+	void close()
+	{
+#ifdef _WIN32
+		if (mData)
+			UnmapViewOfFile(mData);
+		if (mMapping)
+			CloseHandle(mMapping);
+		mMapping = nullptr;
+#else
+		if (mData)
+			munmap(mData, mSize);
+		if (mOwner)
+			shm_unlink(systemName(mName).c_str());
+#endif
+		mData = nullptr;
+		mSize = 0;
+		mOwner = false;
+	}
+};
@@ -0,0 +1,587 @@
+#pragma once
+/**
+* Defines the lane types used by the ground truth solver.
+* The solver is written once as a template over its lane type T. T is either a scalar (float or double),
+* for a single pixel, or a GG::simd::Pack of the same precision, which holds several pixels in SIMD
+* registers. Both perform exactly the same floating point operations in the same order, so a pack gives
+* bit-identical results to the scalar path of the same precision as long as the compiler does not
+* contract multiplies and adds (see -ffp-contract=off in CMake). Constants must therefore be written as
+* T(...) in the solver, so that float code does not silently promote to double.
+*
+* The instruction set is chosen at compile time from the compiler flags. With AVX-512F a pack holds 16
+* doubles or 32 floats, with AVX2 8 doubles or 16 floats. Without either, GG_SIMD is left undefined and
+* only the scalar path exists.
+*
+* Pixels are loaded either from float images already normalised to [0;1], or straight from 16 bit images,
+* which are normalised in registers exactly as cv::Mat::convertTo(CV_32F, 1.0 / 65535) would. Results are
+* stored either as floats or quantised to 16 bits exactly as cv::Mat::convertTo(CV_16U, 65535) would.
+* */
+
+#include <stdint.h>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#define GG_SIMD
+#endif
+
+namespace GG
+{
+	/** A colour with each channel held in its own lane type (structure of arrays). */
+	template<class T>
+	struct Rgb
+	{
+		T x, y, z;
+	};
+
+	/** Returns v where x > threshold and 0 elsewhere (including where x is NaN). */
+	inline double zeroUnlessAbove(double x, double threshold, double v)
+	{
+		return x > threshold ? v : 0.0;
+	}
+
+	inline float zeroUnlessAbove(float x, double threshold, float v)
+	{
+		return x > (float)threshold ? v : 0.0f;
+	}
+
+	/** Returns the square root of x. */
+	inline double squareRoot(double x)
+	{
+		return std::sqrt(x);
+	}
+
+	inline float squareRoot(float x)
+	{
+		return std::sqrt(x);
+	}
+
+	/** Returns the absolute value of x. */
+	inline double absolute(double x)
+	{
+		return std::fabs(x);
+	}
+
+	inline float absolute(float x)
+	{
+		return std::fabs(x);
+	}
+
+	/** Returns the larger of a and b. */
+	inline double maximum(double a, double b)
+	{
+		return a > b ? a : b;
+	}
+
+	inline float maximum(float a, float b)
+	{
+		return a > b ? a : b;
+	}
+
+	/** Returns the number of pixels held by a lane type. */
+	inline int laneCount(double)
+	{
+		return 1;
+	}
+
+	inline int laneCount(float)
+	{
+		return 1;
+	}
+
+	/** Returns the machine epsilon of the precision of a lane type. */
+	inline double machineEpsilon(double)
+	{
+		return std::numeric_limits<double>::epsilon();
+	}
+
+	inline double machineEpsilon(float)
+	{
+		return std::numeric_limits<float>::epsilon();
+	}
+
+	/** Returns 1 if x is at most threshold, and 0 otherwise (including if x is NaN). */
+	inline unsigned long long atMostMask(double x, double threshold)
+	{
+		return x <= threshold ? 1 : 0;
+	}
+
+	inline unsigned long long atMostMask(float x, double threshold)
+	{
+		return x <= (float)threshold ? 1 : 0;
+	}
+
+	/** Returns 1 if x is below threshold or NaN, and 0 otherwise. */
+	inline unsigned long long belowMask(double x, double threshold)
+	{
+		return !(x >= threshold) ? 1 : 0;
+	}
+
+	inline unsigned long long belowMask(float x, double threshold)
+	{
+		return !(x >= (float)threshold) ? 1 : 0;
+	}
+
+	/** Loads one float value. */
+	inline void load(const float* p, double& out)
+	{
+		out = *p;
+	}
+
+	inline void load(const float* p, float& out)
+	{
+		out = *p;
+	}
+
+	/** Loads one interleaved float BGR pixel. */
+	template<class T>
+	inline void load(const float* p, Rgb<T>& out)
+	{
+		out.x = p[0];
+		out.y = p[1];
+		out.z = p[2];
+	}
+
+	//The normalisation of 16 bit samples, rounded to float as cv::Mat::convertTo does.
+	static const float kUnit16 = (float)(1.0 / 65535);
+
+	/** Loads one interleaved 16 bit BGR pixel, normalised to [0;1]. */
+	template<class T>
+	inline void load(const uint16_t* p, Rgb<T>& out)
+	{
+		out.x = (float)p[0] * kUnit16;
+		out.y = (float)p[1] * kUnit16;
+		out.z = (float)p[2] * kUnit16;
+	}
+
+	/**
+	* Scales a [0;1] float to 16 bits like cv::saturate_cast: the product is rounded to nearest even, and
+	* NaN or values beyond the range of int give 0, as the SSE conversion OpenCV relies on does.
+	* */
+	inline uint16_t quantise16(float v)
+	{
+		const float x = v * 65535.0f;
+		if (!(x > -2147483648.0f && x < 2147483648.0f))
+			return 0;
+		const float r = std::nearbyint(x);
+		return r <= 0 ? 0 : r >= 65535 ? 65535 : (uint16_t)r;
+	}
+
+	/** Stores one float value. */
+	inline void store(float* p, double v)
+	{
+		*p = (float)v;
+	}
+
+	inline void store(float* p, float v)
+	{
+		*p = v;
+	}
+
+	/** Stores one value quantised to 16 bits. It is rounded to float first, as if stored as a float. */
+	inline void store(uint16_t* p, double v)
+	{
+		*p = quantise16((float)v);
+	}
+
+	inline void store(uint16_t* p, float v)
+	{
+		*p = quantise16(v);
+	}
+
+	/** Stores one interleaved BGR pixel, as floats or quantised to 16 bits. */
+	template<class Out, class T>
+	inline void store(Out* p, const Rgb<T>& v)
+	{
+		store(p, v.x);
+		store(p + 1, v.y);
+		store(p + 2, v.z);
+	}
+
+#ifdef GG_SIMD
+	namespace simd
+	{
+		/**
+		* Per register type: the number of lanes, broadcast, arithmetic, and moving 8 floats in and out
+		* of the lanes [8g, 8g+8) of an array of registers.
+		* */
+		template<class R> struct Reg;
+
+#if defined(__AVX512F__)
+		template<> struct Reg<__m512d>
+		{
+			static const int kLanes = 8;
+			static __m512d set1(double v) { return _mm512_set1_pd(v); }
+			static __m512d add(__m512d a, __m512d b) { return _mm512_add_pd(a, b); }
+			static __m512d sub(__m512d a, __m512d b) { return _mm512_sub_pd(a, b); }
+			static __m512d mul(__m512d a, __m512d b) { return _mm512_mul_pd(a, b); }
+			static __m512d div(__m512d a, __m512d b) { return _mm512_div_pd(a, b); }
+			static __m512d sqrt(__m512d a) { return _mm512_sqrt_pd(a); }
+			static __m512d max(__m512d a, __m512d b) { return _mm512_max_pd(a, b); }
+			static __m512d abs(__m512d a) { return _mm512_abs_pd(a); }
+			static unsigned long long atMostMask(__m512d x, double t) { return _mm512_cmp_pd_mask(x, set1(t), _CMP_LE_OQ); }
+			static __m512d zeroUnlessAbove(__m512d x, double t, __m512d v) { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(x, set1(t), _CMP_GT_OQ), v); }
+			static unsigned long long belowMask(__m512d x, double t) { return _mm512_cmp_pd_mask(x, set1(t), _CMP_NGE_UQ); }
+			static void put8(__m512d* r, int g, __m256 f) { r[g] = _mm512_cvtps_pd(f); }
+			static __m256 get8(const __m512d* r, int g) { return _mm512_cvtpd_ps(r[g]); }
+		};
+
+		template<> struct Reg<__m512>
+		{
+			static const int kLanes = 16;
+			static __m512 set1(double v) { return _mm512_set1_ps((float)v); }
+			static __m512 add(__m512 a, __m512 b) { return _mm512_add_ps(a, b); }
+			static __m512 sub(__m512 a, __m512 b) { return _mm512_sub_ps(a, b); }
+			static __m512 mul(__m512 a, __m512 b) { return _mm512_mul_ps(a, b); }
+			static __m512 div(__m512 a, __m512 b) { return _mm512_div_ps(a, b); }
+			static __m512 sqrt(__m512 a) { return _mm512_sqrt_ps(a); }
+			static __m512 max(__m512 a, __m512 b) { return _mm512_max_ps(a, b); }
+			static __m512 abs(__m512 a) { return _mm512_abs_ps(a); }
+			static unsigned long long atMostMask(__m512 x, double t) { return _mm512_cmp_ps_mask(x, set1(t), _CMP_LE_OQ); }
+			static __m512 zeroUnlessAbove(__m512 x, double t, __m512 v) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, set1(t), _CMP_GT_OQ), v); }
+			static unsigned long long belowMask(__m512 x, double t) { return _mm512_cmp_ps_mask(x, set1(t), _CMP_NGE_UQ); }
+
+			//Even groups fill the low half of a register and odd groups the high half.
+			static void put8(__m512* r, int g, __m256 f)
+			{
+				if (g % 2 == 0)
+					r[g / 2] = _mm512_castps256_ps512(f);
+				else
+					r[g / 2] = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(r[g / 2]), _mm256_castps_pd(f), 1));
+			}
+			static __m256 get8(const __m512* r, int g)
+			{
+				if (g % 2 == 0)
+					return _mm512_castps512_ps256(r[g / 2]);
+				return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(r[g / 2]), 1));
+			}
+		};
+
+		typedef __m512d DoubleReg;
+		typedef __m512 FloatReg;
+#else
+		template<> struct Reg<__m256d>
+		{
+			static const int kLanes = 4;
+			static __m256d set1(double v) { return _mm256_set1_pd(v); }
+			static __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+			static __m256d sub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+			static __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+			static __m256d div(__m256d a, __m256d b) { return _mm256_div_pd(a, b); }
+			static __m256d sqrt(__m256d a) { return _mm256_sqrt_pd(a); }
+			static __m256d max(__m256d a, __m256d b) { return _mm256_max_pd(a, b); }
+			static __m256d abs(__m256d a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+			static unsigned long long atMostMask(__m256d x, double t) { return (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(x, set1(t), _CMP_LE_OQ)); }
+			static __m256d zeroUnlessAbove(__m256d x, double t, __m256d v) { return _mm256_and_pd(_mm256_cmp_pd(x, set1(t), _CMP_GT_OQ), v); }
+			static unsigned long long belowMask(__m256d x, double t) { return (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(x, set1(t), _CMP_NGE_UQ)); }
+			static void put8(__m256d* r, int g, __m256 f)
+			{
+				r[2 * g] = _mm256_cvtps_pd(_mm256_castps256_ps128(f));
+				r[2 * g + 1] = _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1));
+			}
+			static __m256 get8(const __m256d* r, int g)
+			{
+				return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(r[2 * g])), _mm256_cvtpd_ps(r[2 * g + 1]), 1);
+			}
+		};
+
+		template<> struct Reg<__m256>
+		{
+			static const int kLanes = 8;
+			static __m256 set1(double v) { return _mm256_set1_ps((float)v); }
+			static __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+			static __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+			static __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+			static __m256 div(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+			static __m256 sqrt(__m256 a) { return _mm256_sqrt_ps(a); }
+			static __m256 max(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+			static __m256 abs(__m256 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+			static unsigned long long atMostMask(__m256 x, double t) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(x, set1(t), _CMP_LE_OQ)); }
+			static __m256 zeroUnlessAbove(__m256 x, double t, __m256 v) { return _mm256_and_ps(_mm256_cmp_ps(x, set1(t), _CMP_GT_OQ), v); }
+			static unsigned long long belowMask(__m256 x, double t) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(x, set1(t), _CMP_NGE_UQ)); }
+			static void put8(__m256* r, int g, __m256 f) { r[g] = f; }
+			static __m256 get8(const __m256* r, int g) { return r[g]; }
+		};
+
+		typedef __m256d DoubleReg;
+		typedef __m256 FloatReg;
+#endif
+
+		//Two registers per pack give the out-of-order core independent work.
+		static const int kRegs = 2;
+
+		/** A group of kLanes values of one precision. */
+		template<class R>
+		struct Pack
+		{
+			static const int kLanes = kRegs * Reg<R>::kLanes;
+
+			R r[kRegs];
+
+			Pack() {}
+
+			/** Broadcasts v to every lane, rounding it to the precision of the pack. */
+			Pack(double v)
+			{
+				for (int i = 0; i < kRegs; ++i)
+					r[i] = Reg<R>::set1(v);
+			}
+
+			Pack& operator += (const Pack& p)
+			{
+				for (int i = 0; i < kRegs; ++i)
+					r[i] = Reg<R>::add(r[i], p.r[i]);
+				return *this;
+			}
+
+			Pack& operator *= (const Pack& p)
+			{
+				for (int i = 0; i < kRegs; ++i)
+					r[i] = Reg<R>::mul(r[i], p.r[i]);
+				return *this;
+			}
+		};
+
+		typedef Pack<DoubleReg> PackD;
+		typedef Pack<FloatReg> PackF;
+
+		/** Maps a scalar type to the pack of the same precision. */
+		template<class S> struct PackOf;
+		template<> struct PackOf<double> { typedef PackD type; };
+		template<> struct PackOf<float> { typedef PackF type; };
+
+		template<class R>
+		inline Pack<R> operator + (const Pack<R>& a, const Pack<R>& b)
+		{
+			Pack<R> o;
+			for (int i = 0; i < kRegs; ++i)
+				o.r[i] = Reg<R>::add(a.r[i], b.r[i]);
+			return o;
+		}
+
+		template<class R>
+		inline Pack<R> operator - (const Pack<R>& a, const Pack<R>& b)
+		{
+			Pack<R> o;
+			for (int i = 0; i < kRegs; ++i)
+				o.r[i] = Reg<R>::sub(a.r[i], b.r[i]);
+			return o;
+		}
+
+		template<class R>
+		inline Pack<R> operator * (const Pack<R>& a, const Pack<R>& b)
+		{
+			Pack<R> o;
+			for (int i = 0; i < kRegs; ++i)
+				o.r[i] = Reg<R>::mul(a.r[i], b.r[i]);
+			return o;
+		}
+
+		template<class R>
+		inline Pack<R> operator / (const Pack<R>& a, const Pack<R>& b)
+		{
+			Pack<R> o;
+			for (int i = 0; i < kRegs; ++i)
+				o.r[i] = Reg<R>::div(a.r[i], b.r[i]);
+			return o;
+		}
+
+		/**
+		* Splits 8 interleaved BGR float pixels (24 floats, in three registers) into one register per
+		* channel. The blends gather each channel's values into a fixed scrambled order, which the
+		* permutation then undoes.
+		* */
+		inline void deinterleave8(__m256 m0, __m256 m1, __m256 m2, __m256& x, __m256& y, __m256& z)
+		{
+			x = _mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x92), m2, 0x24);
+			y = _mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x24), m2, 0x49);
+			z = _mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x49), m2, 0x92);
+
+			x = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5));
+			y = _mm256_permutevar8x32_ps(y, _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6));
+			z = _mm256_permutevar8x32_ps(z, _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7));
+		}
+
+		/** Loads 8 floats. */
+		inline __m256 load8(const float* p)
+		{
+			return _mm256_loadu_ps(p);
+		}
+
+		/** Loads 8 16 bit samples, normalised to [0;1] floats. */
+		inline __m256 load8(const uint16_t* p)
+		{
+			const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(kUnit16));
+		}
+
+		/** The inverse of deinterleave8: interleaves 8 pixels into three registers of 24 floats. */
+		inline void interleave8(__m256 x, __m256 y, __m256 z, __m256& m0, __m256& m1, __m256& m2)
+		{
+			x = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5));
+			y = _mm256_permutevar8x32_ps(y, _mm256_setr_epi32(5, 0, 3, 6, 1, 4, 7, 2));
+			z = _mm256_permutevar8x32_ps(z, _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7));
+
+			m0 = _mm256_blend_ps(_mm256_blend_ps(x, y, 0x92), z, 0x24);
+			m1 = _mm256_blend_ps(_mm256_blend_ps(x, y, 0x24), z, 0x49);
+			m2 = _mm256_blend_ps(_mm256_blend_ps(x, y, 0x49), z, 0x92);
+		}
+
+		/** Stores 8 floats. */
+		inline void store8(float* p, __m256 v)
+		{
+			_mm256_storeu_ps(p, v);
+		}
+
+		/** Stores 8 floats quantised to 16 bits, with the same rounding and saturation as quantise16. */
+		inline void store8(uint16_t* p, __m256 v)
+		{
+			const __m256i i = _mm256_cvtps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(65535.0f)));
+			_mm_storeu_si128((__m128i*)p, _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+		}
+	}
+
+	template<class R>
+	inline simd::Pack<R> zeroUnlessAbove(const simd::Pack<R>& x, double threshold, const simd::Pack<R>& v)
+	{
+		simd::Pack<R> o;
+		for (int i = 0; i < simd::kRegs; ++i)
+			o.r[i] = simd::Reg<R>::zeroUnlessAbove(x.r[i], threshold, v.r[i]);
+		return o;
+	}
+
+	template<class R>
+	inline simd::Pack<R> squareRoot(const simd::Pack<R>& x)
+	{
+		simd::Pack<R> o;
+		for (int i = 0; i < simd::kRegs; ++i)
+			o.r[i] = simd::Reg<R>::sqrt(x.r[i]);
+		return o;
+	}
+
+	template<class R>
+	inline simd::Pack<R> absolute(const simd::Pack<R>& x)
+	{
+		simd::Pack<R> o;
+		for (int i = 0; i < simd::kRegs; ++i)
+			o.r[i] = simd::Reg<R>::abs(x.r[i]);
+		return o;
+	}
+
+	template<class R>
+	inline simd::Pack<R> maximum(const simd::Pack<R>& a, const simd::Pack<R>& b)
+	{
+		simd::Pack<R> o;
+		for (int i = 0; i < simd::kRegs; ++i)
+			o.r[i] = simd::Reg<R>::max(a.r[i], b.r[i]);
+		return o;
+	}
+
+	template<class R>
+	inline int laneCount(const simd::Pack<R>&)
+	{
+		return simd::Pack<R>::kLanes;
+	}
+
+	inline double machineEpsilon(const simd::PackD&)
+	{
+		return std::numeric_limits<double>::epsilon();
+	}
+
+	inline double machineEpsilon(const simd::PackF&)
+	{
+		return std::numeric_limits<float>::epsilon();
+	}
+
+	/** Returns a bit per lane, set where x is at most threshold. */
+	template<class R>
+	inline unsigned long long atMostMask(const simd::Pack<R>& x, double threshold)
+	{
+		unsigned long long mask = 0;
+		for (int i = 0; i < simd::kRegs; ++i)
+			mask |= simd::Reg<R>::atMostMask(x.r[i], threshold) << (i * simd::Reg<R>::kLanes);
+		return mask;
+	}
+
+	/** Returns a bit per lane, set where x is below threshold or NaN. */
+	template<class R>
+	inline unsigned long long belowMask(const simd::Pack<R>& x, double threshold)
+	{
+		unsigned long long mask = 0;
+		for (int i = 0; i < simd::kRegs; ++i)
+			mask |= simd::Reg<R>::belowMask(x.r[i], threshold) << (i * simd::Reg<R>::kLanes);
+		return mask;
+	}
+
+	/** Loads Pack<R>::kLanes interleaved BGR pixels, from floats or normalised from 16 bit samples. */
+	template<class In, class R>
+	inline void loadPack(const In* p, Rgb<simd::Pack<R> >& out)
+	{
+		for (int g = 0; g < simd::Pack<R>::kLanes / 8; ++g)
+		{
+			const In* q = p + 24 * g;
+			__m256 x, y, z;
+			simd::deinterleave8(simd::load8(q), simd::load8(q + 8), simd::load8(q + 16), x, y, z);
+			simd::Reg<R>::put8(out.x.r, g, x);
+			simd::Reg<R>::put8(out.y.r, g, y);
+			simd::Reg<R>::put8(out.z.r, g, z);
+		}
+	}
+
+	template<class R>
+	inline void load(const float* p, Rgb<simd::Pack<R> >& out)
+	{
+		loadPack(p, out);
+	}
+
+	template<class R>
+	inline void load(const uint16_t* p, Rgb<simd::Pack<R> >& out)
+	{
+		loadPack(p, out);
+	}
+
+	/** Loads Pack<R>::kLanes consecutive float values. */
+	template<class R>
+	inline void load(const float* p, simd::Pack<R>& out)
+	{
+		for (int g = 0; g < simd::Pack<R>::kLanes / 8; ++g)
+			simd::Reg<R>::put8(out.r, g, simd::load8(p + 8 * g));
+	}
+
+	/** Stores Pack<R>::kLanes values, as floats or quantised to 16 bits. */
+	template<class Out, class R>
+	inline void storePack(Out* p, const simd::Pack<R>& v)
+	{
+		for (int g = 0; g < simd::Pack<R>::kLanes / 8; ++g)
+			simd::store8(p + 8 * g, simd::Reg<R>::get8(v.r, g));
+	}
+
+	template<class R>
+	inline void store(float* p, const simd::Pack<R>& v)
+	{
+		storePack(p, v);
+	}
+
+	template<class R>
+	inline void store(uint16_t* p, const simd::Pack<R>& v)
+	{
+		storePack(p, v);
+	}
+
+	/** Stores Pack<R>::kLanes interleaved BGR pixels, as floats or quantised to 16 bits. */
+	template<class Out, class R>
+	inline void store(Out* p, const Rgb<simd::Pack<R> >& v)
+	{
+		for (int g = 0; g < simd::Pack<R>::kLanes / 8; ++g)
+		{
+			__m256 m0, m1, m2;
+			simd::interleave8(simd::Reg<R>::get8(v.x.r, g), simd::Reg<R>::get8(v.y.r, g), simd::Reg<R>::get8(v.z.r, g),
+				m0, m1, m2);
+			simd::store8(p + 24 * g, m0);
+			simd::store8(p + 24 * g + 8, m1);
+			simd::store8(p + 24 * g + 16, m2);
+		}
+	}
+#endif
+}
@@ -0,0 +1,644 @@
+/**
+* This application measures the speed and accuracy of the ground truth solver (GG::groundTruthAlpha2 and
+* its relatives in groundtruth.h), so that changes to it can be compared with numbers rather than guesses.
+*
+* It builds synthetic plates from a known alpha and foreground: a soft-edged object with partly transparent
+* regions, composited over n smooth backdrops of distinct colours as C_i = alpha * F + (1 - alpha) * B_i.
+* Every solver variant is then run on the plates at every image size, colour count and thread count given,
+* and its time and its error against the known alpha, F and AF are written to a JSON file.
+*
+* Options:
+* --sizes WxH,...  The image sizes to solve. Default 256x256,1024x768,2048x1536.
+* --colours N,...  The numbers of backdrops, between GG::kMinColours and GG::kMaxColours. Default 3.
+* --threads T,...  The thread counts to solve with, 0 meaning every hardware thread. Default 1,0.
+* --repeats R  The timed runs of each case, after one untimed run. The fastest is reported. Default 3.
+* --noise S  The standard deviation of Gaussian noise added to every plate, relative to full scale, to
+*                mimic sensor noise. Default 0, which leaves only the error of the solver and quantisation.
+* --variants NAME,...  Runs only the named variants (see kVariants). Default all of them.
+* --reference-size WxH  The size at which the original QR solver (groundTruthAlpha2Reference) is run, on one
+*                thread and once, since it is much slower. 0x0 skips it. Default 128x128.
+* --json PATH  Where to write the results. Default solverbenchmark.json.
+*
+* The JSON file holds the build and settings of the run, then one entry per case with its variant, size,
+* colours and threads; the fastest and mean time in seconds; the throughput in Mpix/s and wall time in
+* ns/pixel of the fastest run; the pixels refined and skipped (see GG::SolveStats); and the maximum and mean
+* absolute error of alpha, AF and F relative to full scale. F is only compared where the true alpha is at
+* least kForegroundMinAlpha, since it is undefined where the object is transparent. Values that are not
+* finite are counted in nonFinite rather than in the errors, and written as null.
+*
+* 16 bit variants read 16 bit plates and quantise their outputs, as GroundTruth does; their error includes
+* the quantisation of the plates. Float variants read the same plates unquantised.
+*/
+
+#include "io.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "groundtruth.h"
+#include "threadpool.h"
+
+//The true alpha above which the error of F is measured.
+static const double kForegroundMinAlpha = 0.1;
+
+//The background noise given to the variants that skip pure background (see SolveSettings::backgroundNoise).
+static const double kBenchmarkBackgroundNoise = 0.001;
+
+//The colours of the backdrops, as RGB, in the order the plates use them. They are spread so that any
+//leading subset of them is well conditioned, as the colours CameraControl cycles through are.
+static const double kBackdropColours[GG::kMaxColours][3] = {
+	{ 0.10, 0.15, 0.90 }, { 0.10, 0.85, 0.15 }, { 0.90, 0.10, 0.15 }, { 0.90, 0.85, 0.10 },
+	{ 0.85, 0.10, 0.85 }, { 0.10, 0.80, 0.85 }, { 0.95, 0.95, 0.95 }, { 0.10, 0.10, 0.10 },
+	{ 0.95, 0.55, 0.10 }, { 0.50, 0.10, 0.90 }, { 0.55, 0.90, 0.50 }, { 0.50, 0.50, 0.50 }
+};
+
+/** The implementations that can be measured. */
+enum class SolverKind { Closed, Factor, Reference };
+
+/** A solver together with the settings and image depth it is run with. */
+struct Variant
+{
+	const char* name;
+	SolverKind kind;
+	GG::Precision precision;
+
+	//CV_16U or CV_32F, for both the plates and the outputs.
+	int depth;
+	double backgroundNoise;
+};
+
+static const Variant kVariants[] = {
+	{ "float32-u16", SolverKind::Closed, GG::Precision::Float32, CV_16U, 0 },
+	{ "float64-u16", SolverKind::Closed, GG::Precision::Float64, CV_16U, 0 },
+	{ "mixed-u16", SolverKind::Closed, GG::Precision::Mixed, CV_16U, 0 },
+	{ "float32-f32", SolverKind::Closed, GG::Precision::Float32, CV_32F, 0 },
+	{ "float64-f32", SolverKind::Closed, GG::Precision::Float64, CV_32F, 0 },
+	{ "mixed-f32", SolverKind::Closed, GG::Precision::Mixed, CV_32F, 0 },
+	{ "float32-u16-skip", SolverKind::Closed, GG::Precision::Float32, CV_16U, kBenchmarkBackgroundNoise },
+	{ "float64-u16-skip", SolverKind::Closed, GG::Precision::Float64, CV_16U, kBenchmarkBackgroundNoise },
+	{ "factor-float32-u16", SolverKind::Factor, GG::Precision::Float32, CV_16U, 0 },
+	{ "factor-float64-u16", SolverKind::Factor, GG::Precision::Float64, CV_16U, 0 },
+	{ "reference-f32", SolverKind::Reference, GG::Precision::Float64, CV_32F, 0 }
+};
+
+static const int kVariantCount = sizeof(kVariants) / sizeof(kVariants[0]);
+
+/** The settings of a benchmark run. */
+struct BenchmarkOptions
+{
+	std::vector<cv::Size> sizes;
+	std::vector<int> colours;
+	std::vector<unsigned> threads;
+	std::vector<std::string> variants;
+	int repeats = 3;
+	double noise = 0;
+	cv::Size referenceSize = cv::Size(128, 128);
+	std::string json = "solverbenchmark.json";
+};
+
+/** The known alpha and foreground, and the plates made from them, in both depths. */
+struct SyntheticSet
+{
+	//CV_32FC1 and CV_32FC3, in the channel order of the plates.
+	cv::Mat alpha;
+	cv::Mat foreground;
+
+	//colours images with each backdrop and of each backdrop, as CV_16UC3 and as CV_32FC3.
+	std::vector<cv::Mat> c16, b16, c32, b32;
+};
+
+/** The timing and accuracy of one case. */
+struct CaseResult
+{
+	const Variant* variant;
+	cv::Size size;
+	int colours;
+	unsigned threads;
+
+	double bestSeconds;
+	double meanSeconds;
+	GG::SolveStats stats;
+
+	double alphaMax, alphaMean;
+	double afMax, afMean;
+	double fMax, fMean;
+	long long fPixels;
+	long long nonFinite;
+};
+
+/** Returns the seconds elapsed since start. */
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** A smooth step from 0 at edge0 to 1 at edge1. */
+static double SmoothStep(double edge0, double edge1, double x)
+{
+	const double t = std::min(1.0, std::max(0.0, (x - edge0) / (edge1 - edge0)));
+	return t * t * (3 - 2 * t);
+}
+
+/**
+* Builds the known alpha and foreground and the plates of a synthetic capture set.
+* The object is a disc with a soft edge, holding opaque, partly transparent and nearly transparent regions,
+* over a background that is exactly transparent. The backdrops darken slightly towards the corners, as a
+* monitor seen through a lens does.
+* */
+static void MakeSyntheticSet(cv::Size size, int colours, double noise, SyntheticSet& set)
+{
+	const int w = size.width, h = size.height;
+	set.alpha.create(h, w, CV_32FC1);
+	set.foreground.create(h, w, CV_32FC3);
+	set.c16.resize(colours); set.b16.resize(colours);
+	set.c32.resize(colours); set.b32.resize(colours);
+	for (int i = 0; i < colours; ++i)
+	{
+		set.c16[i].create(h, w, CV_16UC3); set.b16[i].create(h, w, CV_16UC3);
+		set.c32[i].create(h, w, CV_32FC3); set.b32[i].create(h, w, CV_32FC3);
+	}
+
+	//A fixed seed, so that every run measures the same plates.
+	std::mt19937 random(12345);
+	std::normal_distribution<double> gaussian(0.0, noise > 0 ? noise : 1.0);
+
+	for (int y = 0; y < h; ++y)
+	{
+		const double v = (y + 0.5) / h;
+		float* pA = set.alpha.ptr<float>(y);
+		float* pF = set.foreground.ptr<float>(y);
+		for (int x = 0; x < w; ++x)
+		{
+			const double u = (x + 0.5) / w;
+			const double r = std::sqrt((u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5));
+			const double inside = 1 - SmoothStep(0.28, 0.36, r);
+			const double pattern = 0.5 + 0.5 * std::sin(12 * u) * std::cos(9 * v);
+			const double alpha = std::min(1.0, inside * (0.2 + 1.0 * pattern));
+			pA[x] = (float)alpha;
+			pF[x * 3] = (float)(0.2 + 0.6 * u);
+			pF[x * 3 + 1] = (float)(0.2 + 0.6 * v);
+			pF[x * 3 + 2] = (float)(0.5 + 0.3 * std::sin(7 * (u + v)));
+		}
+
+		for (int i = 0; i < colours; ++i)
+		{
+			uint16_t* c16 = set.c16[i].ptr<uint16_t>(y);
+			uint16_t* b16 = set.b16[i].ptr<uint16_t>(y);
+			float* c32 = set.c32[i].ptr<float>(y);
+			float* b32 = set.b32[i].ptr<float>(y);
+			for (int x = 0; x < w; ++x)
+			{
+				const double u = (x + 0.5) / w;
+				const double vignette = 1 - 0.15 * ((u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5));
+				for (int k = 0; k < 3; ++k)
+				{
+					//The plates are in OpenCV's BGR order, so channel k holds colour component 2 - k.
+					double b = kBackdropColours[i][2 - k] * vignette;
+					double c = pA[x] * pF[x * 3 + k] + (1 - pA[x]) * b;
+					if (noise > 0)
+					{
+						b += gaussian(random);
+						c += gaussian(random);
+					}
+					b = std::min(1.0, std::max(0.0, b));
+					c = std::min(1.0, std::max(0.0, c));
+					b32[x * 3 + k] = (float)b;
+					c32[x * 3 + k] = (float)c;
+					b16[x * 3 + k] = (uint16_t)std::lround(b * 65535);
+					c16[x * 3 + k] = (uint16_t)std::lround(c * 65535);
+				}
+			}
+		}
+	}
+}
+
+/** Computes the background factors of the 16 bit plates, as WriteBackgroundCache does. */
+static cv::Mat MakeFactor(const SyntheticSet& set, int colours)
+{
+	const int w = set.alpha.cols;
+	cv::Mat factor(set.alpha.rows, w * GG::factorPlanes(colours), CV_32FC1);
+	std::vector<const uint16_t*> pb(colours);
+	for (int y = 0; y < factor.rows; ++y)
+	{
+		for (int i = 0; i < colours; ++i)
+			pb[i] = set.b16[i].ptr<uint16_t>(y);
+		GG::factorRow(&pb[0], colours, w, factor.ptr<float>(y));
+	}
+	return factor;
+}
+
+/** Reads a value of an output image relative to full scale. */
+static double OutputValue(const cv::Mat& image, int y, int i)
+{
+	if (image.depth() == CV_16U)
+		return image.ptr<uint16_t>(y)[i] / 65535.0;
+	return image.ptr<float>(y)[i];
+}
+
+/** Adds the absolute difference of an output from the truth to a maximum and sum, or counts it if not finite. */
+static void Accumulate(double value, double truth, double& max, double& sum, long long& nonFinite)
+{
+	if (!std::isfinite(value))
+	{
+		++nonFinite;
+		return;
+	}
+	const double error = std::fabs(value - truth);
+	max = std::max(max, error);
+	sum += error;
+}
+
+/** Measures the error of the outputs of a case against the known alpha and foreground. */
+static void MeasureError(const SyntheticSet& set, const cv::Mat& A, const cv::Mat& F, const cv::Mat& AF,
+	CaseResult& result)
+{
+	double alphaSum = 0, afSum = 0, fSum = 0;
+	result.alphaMax = result.afMax = result.fMax = 0;
+	result.fPixels = 0;
+	result.nonFinite = 0;
+
+	const int alphaChannels = A.channels();
+	for (int y = 0; y < A.rows; ++y)
+	{
+		const float* pA = set.alpha.ptr<float>(y);
+		const float* pF = set.foreground.ptr<float>(y);
+		for (int x = 0; x < A.cols; ++x)
+		{
+			Accumulate(OutputValue(A, y, x * alphaChannels), pA[x], result.alphaMax, alphaSum, result.nonFinite);
+			for (int k = 0; k < 3; ++k)
+				Accumulate(OutputValue(AF, y, x * 3 + k), pA[x] * pF[x * 3 + k], result.afMax, afSum, result.nonFinite);
+
+			if (pA[x] < kForegroundMinAlpha)
+				continue;
+			++result.fPixels;
+			for (int k = 0; k < 3; ++k)
+				Accumulate(OutputValue(F, y, x * 3 + k), pF[x * 3 + k], result.fMax, fSum, result.nonFinite);
+		}
+	}
+
+	const double pixels = (double)A.rows * A.cols;
+	result.alphaMean = alphaSum / pixels;
+	result.afMean = afSum / (3 * pixels);
+	result.fMean = result.fPixels ? fSum / (3.0 * result.fPixels) : 0;
+}
+
+/**
+* Runs one variant on a synthetic set, once untimed and then options.repeats times.
+* @param factor The background factors of the set, used by the factor variants.
+* @param pool The pool to solve on, whose size is the thread count of the case.
+* */
+static CaseResult RunCase(const Variant& variant, const SyntheticSet& set, int colours, const cv::Mat& factor,
+	ThreadPool& pool, int repeats)
+{
+	CaseResult result = CaseResult();
+	result.variant = &variant;
+	result.size = set.alpha.size();
+	result.colours = colours;
+	result.threads = pool.size();
+
+	const bool in16 = variant.depth == CV_16U;
+	const cv::Mat* c = in16 ? &set.c16[0] : &set.c32[0];
+	const cv::Mat* b = in16 ? &set.b16[0] : &set.b32[0];
+
+	GG::SolveSettings settings;
+	settings.precision = variant.precision;
+	settings.backgroundNoise = variant.backgroundNoise;
+
+	cv::Mat A;
+	cv::Mat F(result.size, CV_MAKETYPE(variant.depth, 3));
+	cv::Mat AF(result.size, CV_MAKETYPE(variant.depth, 3));
+	if (variant.kind == SolverKind::Factor)
+		A.create(result.size, CV_MAKETYPE(variant.depth, 1));
+	auto solve = [&]() {
+		GG::SolveStats stats;
+		if (variant.kind == SolverKind::Reference)
+			A = GG::groundTruthAlpha2Reference(c, b, colours, F, AF);
+		else if (variant.kind == SolverKind::Factor)
+			GG::groundTruthFromFactor(c, colours, factor, A, F, AF, &pool, settings, &stats);
+		else
+			A = GG::groundTruthAlpha2(c, b, colours, F, AF, &pool, settings, &stats, 1);
+		return stats;
+	};
+
+	//The first run also touches every page of the outputs, which the timed runs should not pay for.
+	if (variant.kind != SolverKind::Reference)
+		solve();
+
+	double total = 0;
+	result.bestSeconds = 0;
+	for (int r = 0; r < repeats; ++r)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		result.stats = solve();
+		const double seconds = SecondsSince(start);
+		total += seconds;
+		result.bestSeconds = r == 0 ? seconds : std::min(result.bestSeconds, seconds);
+	}
+	result.meanSeconds = total / repeats;
+
+	MeasureError(set, A, F, AF, result);
+	return result;
+}
+
+/** Writes a number to JSON, as null if it is not finite, which JSON cannot represent. */
+static std::string JsonNumber(double value)
+{
+	if (!std::isfinite(value))
+		return "null";
+	std::ostringstream ss;
+	ss << std::setprecision(9) << value;
+	return ss.str();
+}
+
+/** Returns the instruction set the solver was compiled for (see simdpack.h). */
+static const char* SimdName()
+{
+#if defined(__AVX512F__)
+	return "avx512";
+#elif defined(__AVX2__)
+	return "avx2";
+#else
+	return "scalar";
+#endif
+}
+
+/**
+* Writes the settings and results of a run as JSON.
+* @return false upon failure, which is reported.
+* */
+static bool WriteJson(const std::string& path, const BenchmarkOptions& options, const std::vector<CaseResult>& results)
+{
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (out.fail())
+	{
+		Error("Could not create " + path);
+		return false;
+	}
+
+	out << "{\n";
+	out << "  \"build\": { \"simd\": \"" << SimdName() << "\", \"hardwareThreads\": " <<
+		std::thread::hardware_concurrency() << " },\n";
+	out << "  \"settings\": { \"repeats\": " << options.repeats << ", \"noise\": " << JsonNumber(options.noise) <<
+		", \"foregroundMinAlpha\": " << JsonNumber(kForegroundMinAlpha) << " },\n";
+	out << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const CaseResult& r = results[i];
+		const double pixels = (double)r.size.width * r.size.height;
+		out << (i ? ",\n" : "\n");
+		out << "    { \"variant\": \"" << r.variant->name << "\", \"width\": " << r.size.width <<
+			", \"height\": " << r.size.height << ", \"colours\": " << r.colours << ", \"threads\": " << r.threads <<
+			", \"bestSeconds\": " << JsonNumber(r.bestSeconds) << ", \"meanSeconds\": " << JsonNumber(r.meanSeconds) <<
+			", \"mpixPerSecond\": " << JsonNumber(pixels / r.bestSeconds / 1e6) <<
+			", \"nsPerPixel\": " << JsonNumber(r.bestSeconds * 1e9 / pixels) <<
+			", \"refined\": " << r.stats.refined << ", \"skipped\": " << r.stats.skipped <<
+			", \"alphaMaxError\": " << JsonNumber(r.alphaMax) << ", \"alphaMeanError\": " << JsonNumber(r.alphaMean) <<
+			", \"afMaxError\": " << JsonNumber(r.afMax) << ", \"afMeanError\": " << JsonNumber(r.afMean) <<
+			", \"fMaxError\": " << JsonNumber(r.fMax) << ", \"fMeanError\": " << JsonNumber(r.fMean) <<
+			", \"fPixels\": " << r.fPixels << ", \"nonFinite\": " << r.nonFinite << " }";
+	}
+	out << "\n  ]\n}\n";
+
+	out.close();
+	if (out.fail())
+	{
+		Error("Could not write " + path);
+		return false;
+	}
+	return true;
+}
+
+/** Splits a comma separated list. */
+static std::vector<std::string> SplitList(const std::string& value)
+{
+	std::vector<std::string> items;
+	std::istringstream ss(value);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		items.push_back(item);
+	return items;
+}
+
+/** Reads a size given as WxH, returning false if it is malformed. */
+static bool ParseSize(const std::string& value, cv::Size& size, bool allowEmpty)
+{
+	std::istringstream ss(value);
+	char x;
+	return (ss >> size.width >> x >> size.height) && x == 'x' && ss.eof() &&
+		(allowEmpty ? size.width >= 0 && size.height >= 0 : size.width > 0 && size.height > 0);
+}
+
+/** Reads a list of integers no smaller than minimum, returning false if it is malformed. */
+template<class T>
+static bool ParseIntegers(const std::string& value, T minimum, std::vector<T>& out)
+{
+	out.clear();
+	for (const std::string& item : SplitList(value))
+	{
+		std::istringstream ss(item);
+		T number;
+		if (!(ss >> number) || !ss.eof() || number < minimum)
+			return false;
+		out.push_back(number);
+	}
+	return !out.empty();
+}
+
+/**
+* Reads the options.
+* @return false if an option is unknown or malformed.
+* */
+static bool ParseArguments(const std::vector<std::string>& arguments, BenchmarkOptions& options)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		const std::string& arg = arguments[i];
+		if (i + 1 >= arguments.size())
+		{
+			Error("Missing value for " + arg);
+			return false;
+		}
+		const std::string& value = arguments[++i];
+
+		if (arg == "--sizes")
+		{
+			options.sizes.clear();
+			for (const std::string& item : SplitList(value))
+			{
+				cv::Size size;
+				if (!ParseSize(item, size, false))
+				{
+					Error("Invalid size " + item + ", expected WxH");
+					return false;
+				}
+				options.sizes.push_back(size);
+			}
+		}
+		else if (arg == "--colours")
+		{
+			if (!ParseIntegers(value, GG::kMinColours, options.colours))
+			{
+				Error("Invalid colour counts " + value);
+				return false;
+			}
+			for (int n : options.colours)
+				if (n > GG::kMaxColours)
+				{
+					Error("At most " + ToString(GG::kMaxColours) + " colours are supported");
+					return false;
+				}
+		}
+		else if (arg == "--threads")
+		{
+			if (!ParseIntegers(value, 0u, options.threads))
+			{
+				Error("Invalid thread counts " + value);
+				return false;
+			}
+		}
+		else if (arg == "--repeats")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.repeats) || options.repeats < 1)
+			{
+				Error("Invalid repeat count " + value);
+				return false;
+			}
+		}
+		else if (arg == "--noise")
+		{
+			std::istringstream ss(value);
+			if (!(ss >> options.noise) || options.noise < 0)
+			{
+				Error("Invalid noise " + value);
+				return false;
+			}
+		}
+		else if (arg == "--variants")
+		{
+			options.variants = SplitList(value);
+			for (const std::string& name : options.variants)
+			{
+				bool known = false;
+				for (int v = 0; v < kVariantCount; ++v)
+					known = known || name == kVariants[v].name;
+				if (!known)
+				{
+					Error("Unknown variant " + name);
+					return false;
+				}
+			}
+		}
+		else if (arg == "--reference-size")
+		{
+			if (!ParseSize(value, options.referenceSize, true))
+			{
+				Error("Invalid size " + value + ", expected WxH");
+				return false;
+			}
+		}
+		else if (arg == "--json")
+			options.json = value;
+		else
+		{
+			Error("Unknown option " + arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Returns whether the variant is to be run. */
+static bool Selected(const BenchmarkOptions& options, const Variant& variant)
+{
+	if (options.variants.empty())
+		return true;
+	for (const std::string& name : options.variants)
+		if (name == variant.name)
+			return true;
+	return false;
+}
+
+/** Reports a case as it finishes, so that long runs show progress. */
+static void ReportCase(const CaseResult& r)
+{
+	const double pixels = (double)r.size.width * r.size.height;
+	Inform(std::string(r.variant->name) + " " + ToString(r.size.width) + "x" + ToString(r.size.height) + ", " +
+		ToString(r.colours) + " colours, " + ToString(r.threads) + " threads: " +
+		ToString(pixels / r.bestSeconds / 1e6) + " Mpix/s, alpha error max " + ToString(r.alphaMax) +
+		" mean " + ToString(r.alphaMean));
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseArguments(std::vector<std::string>(argv + 1, argv + argc), options))
+		return 1;
+	if (options.sizes.empty())
+		options.sizes = { cv::Size(256, 256), cv::Size(1024, 768), cv::Size(2048, 1536) };
+	if (options.colours.empty())
+		options.colours = { 3 };
+	if (options.threads.empty())
+		options.threads = { 1, 0 };
+
+	//Resolve 0 to the hardware thread count, dropping counts given twice.
+	std::vector<unsigned> threads;
+	for (unsigned t : options.threads)
+	{
+		const unsigned resolved = t ? t : std::max(1u, std::thread::hardware_concurrency());
+		if (std::find(threads.begin(), threads.end(), resolved) == threads.end())
+			threads.push_back(resolved);
+	}
+
+	std::vector<std::unique_ptr<ThreadPool> > pools;
+	for (unsigned t : threads)
+		pools.emplace_back(new ThreadPool(t));
+	ThreadPool serial(1);
+
+	std::vector<CaseResult> results;
+	for (int colours : options.colours)
+	{
+		for (const cv::Size& size : options.sizes)
+		{
+			SyntheticSet set;
+			MakeSyntheticSet(size, colours, options.noise, set);
+			const cv::Mat factor = MakeFactor(set, colours);
+
+			for (int v = 0; v < kVariantCount; ++v)
+			{
+				if (kVariants[v].kind == SolverKind::Reference || !Selected(options, kVariants[v]))
+					continue;
+				for (auto& pool : pools)
+				{
+					results.push_back(RunCase(kVariants[v], set, colours, factor, *pool, options.repeats));
+					ReportCase(results.back());
+				}
+			}
+		}
+
+		//The reference solver is serial and slow, so it runs once on a set of its own.
+		for (int v = 0; v < kVariantCount; ++v)
+		{
+			if (kVariants[v].kind != SolverKind::Reference || !Selected(options, kVariants[v]) ||
+				options.referenceSize.area() == 0)
+				continue;
+			SyntheticSet set;
+			MakeSyntheticSet(options.referenceSize, colours, options.noise, set);
+			results.push_back(RunCase(kVariants[v], set, colours, cv::Mat(), serial, 1));
+			ReportCase(results.back());
+		}
+	}
+
+	if (!WriteJson(options.json, options, results))
+		return 1;
+	Inform("Results written to " + options.json);
+	return 0;
+}
@@ -1,15 +1,25 @@
 #include <QtGui>
 #include <QApplication>
 #include "window.h"
+#include "trace.h"
 #include <memory>
+#include <cstdlib>
 
 int main(int argc, char *argv[])
 {
 QApplication a(argc, argv);
+
+//GROUND_TRUTH_TRACE names a Chrome trace-event file to record the stages of every sequence to (see trace.h).
+const char* trace = std::getenv("GROUND_TRUTH_TRACE");
+if (trace && *trace)
+	OpenTrace(trace, "CameraControl", true);
+
 std::unique_ptr<Window> w(Window::create());
 if (w.get() == nullptr)
 	return 1;
 
 w->show();
-return a.exec();
-}
\ No newline at end of file
+int code = a.exec();
+CloseTrace();
+return code;
+}
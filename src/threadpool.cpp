@@ -0,0 +1,137 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads) : mRemaining(0)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < threads; ++i)
+		mQueues.push_back(std::unique_ptr<Queue>(new Queue()));
+
+	for (unsigned i = 1; i < threads; ++i)
+		mThreads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+
+	for (auto it = mThreads.begin(); it != mThreads.end(); ++it)
+		it->join();
+}
+
+unsigned ThreadPool::size() const
+{
+	return (unsigned)mQueues.size();
+}
+
+bool ThreadPool::pop(unsigned participant, int& task)
+{
+	//Own queue first, in order
+	{
+		Queue& own = *mQueues[participant];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	//Steal from the far end of the others
+	for (size_t i = 1; i < mQueues.size(); ++i)
+	{
+		Queue& other = *mQueues[(participant + i) % mQueues.size()];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty())
+		{
+			task = other.tasks.back();
+			other.tasks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::work(unsigned participant)
+{
+	int task;
+	while (pop(participant, task))
+	{
+		(*mTask)(task);
+
+		if (--mRemaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mDone.notify_all();
+		}
+	}
+}
+
+void ThreadPool::workerLoop(unsigned participant)
+{
+	unsigned seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&] { return mStopping || mGeneration != seen; });
+			if (mStopping)
+				return;
+			seen = mGeneration;
+			++mBusy;
+		}
+
+		work(participant);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			--mBusy;
+		}
+		mDone.notify_all();
+	}
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& task)
+{
+	if (count <= 0)
+		return;
+
+	if (mThreads.empty())
+	{
+		for (int i = 0; i < count; ++i)
+			task(i);
+		return;
+	}
+
+	mTask = &task;
+	mRemaining = count;
+
+	//Deal out contiguous blocks
+	const long long participants = (long long)mQueues.size();
+	for (long long q = 0; q < participants; ++q)
+	{
+		Queue& queue = *mQueues[(size_t)q];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (long long i = count * q / participants; i < count * (q + 1) / participants; ++i)
+			queue.tasks.push_back((int)i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mGeneration;
+	}
+	mWake.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock, [this] { return mRemaining == 0 && mBusy == 0; });
+}
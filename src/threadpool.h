@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+/**
+* A fixed set of worker threads for running indexed tasks, such as the row bands of an image.
+* Each call to run() deals the task indices out in contiguous blocks, one queue per thread. A thread
+* works through its own queue from the front and, once that is empty, steals from the back of the
+* other queues. Uneven tasks therefore still balance, while neighbouring tasks mostly stay on the same
+* thread. The thread calling run() takes part in the work.
+* */
+class ThreadPool
+{
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<int> tasks;
+	};
+
+	//Worker threads. The caller of run() is participant 0 and has no thread here.
+	std::vector<std::thread> mThreads;
+
+	//One queue per participant.
+	std::vector<std::unique_ptr<Queue> > mQueues;
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+
+	//The task of the current run. Only read after popping an index, which orders it after run() set it.
+	const std::function<void(int)>* mTask = nullptr;
+
+	//Tasks of the current run that have not finished.
+	std::atomic<int> mRemaining;
+
+	//Protected by mMutex.
+	unsigned mGeneration = 0;
+	unsigned mBusy = 0;
+	bool mStopping = false;
+
+	/** Takes a task from the participant's own queue, or steals one from another queue. */
+	bool pop(unsigned participant, int& task);
+
+	/** Runs tasks until every queue is empty. */
+	void work(unsigned participant);
+
+	/** The body of a worker thread. */
+	void workerLoop(unsigned participant);
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator = (const ThreadPool&);
+
+public:
+
+	/**
+	* Starts the pool.
+	* @param threads The total number of threads to compute with, including the caller of run().
+	*                0 uses one per hardware thread, and 1 runs everything on the calling thread.
+	* */
+	explicit ThreadPool(unsigned threads = 0);
+
+	/** Stops and joins the worker threads. */
+	~ThreadPool();
+
+	/** Returns the number of threads that compute, including the caller of run(). */
+	unsigned size() const;
+
+	/**
+	* Calls task(i) for every i in [0, count), returning once all calls have finished.
+	* Calls may happen in any order and on any thread, so tasks must be independent.
+	* */
+	void run(int count, const std::function<void(int)>& task);
+};
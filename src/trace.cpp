@@ -0,0 +1,254 @@
+#include "trace.h"
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include "io.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+//The size the recorded events may reach before they are appended to the file.
+static const size_t kTraceFlushBytes = 1 << 20;
+
+/** The open trace file and the events not yet written to it. */
+struct TraceState
+{
+	std::mutex mutex;
+	std::atomic<bool> enabled{ false };
+	std::string path;
+	std::string process;
+	std::string events;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int file = -1;
+#endif
+
+	//The wall clock time, in microseconds since the epoch, at the moment of startSteady. Spans are timed
+	//on the steady clock and placed on the shared timeline from this point.
+	long long startMicroseconds = 0;
+	std::chrono::steady_clock::time_point startSteady;
+};
+
+static TraceState& State()
+{
+	static TraceState state;
+	return state;
+}
+
+/** Returns the id of this process. */
+static unsigned long ProcessId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return (unsigned long)getpid();
+#endif
+}
+
+/** Returns a small number for the calling thread, 1 for the first to record a span, which a viewer lists in order. */
+static int ThreadId()
+{
+	static std::atomic<int> next{ 1 };
+	thread_local int id = next++;
+	return id;
+}
+
+/** Appends text to a JSON string, escaping it. Windows paths hold backslashes. */
+static void AppendEscaped(std::string& out, const std::string& text)
+{
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		const char c = text[i];
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+			out += escaped;
+		}
+		else
+			out += c;
+	}
+}
+
+/** Appends the events held to the file in a single write, clearing them. The state must be locked. */
+static bool WriteEvents(TraceState& state)
+{
+	if (state.events.empty())
+		return true;
+
+#ifdef _WIN32
+	DWORD written = 0;
+	const bool succeeded = WriteFile(state.file, state.events.data(), (DWORD)state.events.size(), &written, nullptr) &&
+		written == state.events.size();
+#else
+	const bool succeeded = write(state.file, state.events.data(), state.events.size()) == (ssize_t)state.events.size();
+#endif
+	state.events.clear();
+	if (!succeeded)
+		Warning("Could not write to the trace " + state.path);
+	return succeeded;
+}
+
+/** Writes any events held and closes the file. The state must be locked. */
+static void CloseFile(TraceState& state)
+{
+	state.enabled = false;
+#ifdef _WIN32
+	if (state.file == INVALID_HANDLE_VALUE)
+		return;
+	WriteEvents(state);
+	CloseHandle(state.file);
+	state.file = INVALID_HANDLE_VALUE;
+#else
+	if (state.file == -1)
+		return;
+	WriteEvents(state);
+	close(state.file);
+	state.file = -1;
+#endif
+	state.path.clear();
+}
+
+/** Adds a metadata event naming this process or thread. The state must be locked. */
+static void AddName(TraceState& state, const char* kind, int thread, const std::string& name)
+{
+	state.events += "{\"name\":\"" + std::string(kind) + "\",\"ph\":\"M\",\"pid\":" + ToString(ProcessId()) +
+		",\"tid\":" + ToString(thread) + ",\"args\":{\"name\":\"";
+	AppendEscaped(state.events, name);
+	state.events += "\"}},\n";
+}
+
+bool OpenTrace(const std::string& path, const std::string& process, bool truncate)
+{
+	TraceState& state = State();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	CloseFile(state);
+
+	//Appending keeps the writes of other processes whole, as each goes to the end of the file as one piece.
+#ifdef _WIN32
+	state.file = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size = {};
+	if (state.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(state.file, &size))
+#else
+	state.file = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+	struct stat size = {};
+	if (state.file == -1 || fstat(state.file, &size) != 0)
+#endif
+	{
+		Error("Could not open the trace " + path);
+		CloseFile(state);
+		return false;
+	}
+
+	state.path = path;
+	state.process = process;
+	state.startMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	state.startSteady = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+	if (size.QuadPart == 0)
+#else
+	if (size.st_size == 0)
+#endif
+		state.events = "[\n";
+	AddName(state, "process_name", 0, process);
+	AddName(state, "thread_name", ThreadId(), "main");
+	state.enabled = true;
+	Inform("Tracing to " + path);
+	return WriteEvents(state);
+}
+
+bool TraceEnabled()
+{
+	return State().enabled;
+}
+
+std::string TracePath()
+{
+	TraceState& state = State();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.path;
+}
+
+void FlushTrace()
+{
+	TraceState& state = State();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	if (state.enabled)
+		WriteEvents(state);
+}
+
+void CloseTrace()
+{
+	TraceState& state = State();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	CloseFile(state);
+}
+
+TraceSpan::TraceSpan(const char* name, const std::string& detail) : mActive(TraceEnabled())
+{
+	if (!mActive)
+		return;
+	mName = name;
+	mDetail = detail;
+	mStart = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan()
+{
+	end();
+}
+
+void TraceSpan::end()
+{
+	if (!mActive)
+		return;
+	mActive = false;
+	const auto now = std::chrono::steady_clock::now();
+	const int thread = ThreadId();
+
+	TraceState& state = State();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	if (!state.enabled)
+		return;
+
+	//A span started before the trace was reopened is placed on the timeline of the new trace.
+	const long long start = state.startMicroseconds +
+		std::chrono::duration_cast<std::chrono::microseconds>(mStart - state.startSteady).count();
+	const long long duration = std::chrono::duration_cast<std::chrono::microseconds>(now - mStart).count();
+
+	std::string& events = state.events;
+	events += "{\"name\":\"";
+	AppendEscaped(events, mName);
+	events += "\",\"cat\":\"";
+	AppendEscaped(events, state.process);
+	events += "\",\"ph\":\"X\",\"ts\":" + ToString(start) + ",\"dur\":" + ToString(duration) +
+		",\"pid\":" + ToString(ProcessId()) + ",\"tid\":" + ToString(thread);
+	if (!mDetail.empty())
+	{
+		events += ",\"args\":{\"detail\":\"";
+		AppendEscaped(events, mDetail);
+		events += "\"}";
+	}
+	events += "},\n";
+
+	if (events.size() >= kTraceFlushBytes)
+		WriteEvents(state);
+}
@@ -0,0 +1,61 @@
+#pragma once
+/** Records how long the stages of a capture take, as spans in a Chrome trace-event file that chrome://tracing
+ * or Perfetto opens. CameraControl and GroundTruth append to the same file, each under its own process id,
+ * with timestamps in microseconds since the Unix epoch, so that a whole session lies on one timeline.
+ *
+ * The file is in the JSON Array Format: "[" followed by one complete ("ph":"X") event per line, each ending
+ * in a comma. The closing "]" is left out, which the format allows, so that either process may append more
+ * events at any time. Events are kept in memory and appended with a single write, so that the lines of the
+ * two processes are never interleaved.
+ *
+ * Nothing is recorded until OpenTrace is called, and a TraceSpan then costs only a clock read.
+ * */
+
+#include <string>
+#include <chrono>
+
+/**
+* Starts recording spans to a trace file, finishing with any file already open.
+* @param process The name the events of this process are shown under.
+* @param truncate Whether to start a new file rather than append to an existing one.
+* @return false upon failure, which is reported, leaving tracing off.
+* */
+bool OpenTrace(const std::string& path, const std::string& process, bool truncate);
+
+/** Returns whether spans are being recorded. */
+bool TraceEnabled();
+
+/** Returns the path of the trace file, or an empty string if spans are not being recorded. */
+std::string TracePath();
+
+/** Appends the spans recorded so far to the trace file. */
+void FlushTrace();
+
+/** Appends the spans recorded so far and stops recording. */
+void CloseTrace();
+
+/**
+* A span of time on the calling thread, from construction until end() or destruction, recorded as a complete
+* event if tracing is on when it starts.
+* */
+class TraceSpan
+{
+	std::string mName;
+	std::string mDetail;
+	std::chrono::steady_clock::time_point mStart;
+	bool mActive;
+
+public:
+	/**
+	* @param name The name of the stage.
+	* @param detail If not empty, shown with the span, such as the path it works on.
+	* */
+	explicit TraceSpan(const char* name, const std::string& detail = std::string());
+	~TraceSpan();
+
+	/** Ends the span early. Does nothing if it has already ended. */
+	void end();
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+};
@@ -5,6 +5,7 @@
 #include "qinputdialog.h"
 #include <fstream>
 #include <qfiledialog.h>
+#include "groundtruthkernel.h"
 
 
 Window* Window::sWindow = nullptr;
@@ -300,9 +301,10 @@ void Window::shootEvent()
 		return;
 	}
 
-	if (saveGroundTruth && colours.size() < 5)
+	if (saveGroundTruth && colours.size() < GG::kMinColours)
 	{
-		Inform("Can not take photos: Please select at least five colours for ground truth generation.");
+		Inform("Can not take photos: Please select at least " + ToString(GG::kMinColours) +
+			" colours for ground truth generation.");
 		shooting = false;
 		return;
 	}
@@ -311,8 +313,12 @@ void Window::shootEvent()
 	disableEvents();
 
 	//Shoot sequence
+	//The ground truth can be limited to a region drawn on the live view, or to the object.
+	QRectF region = ui.PreviewWidget->region();
+	bool autoCrop = ui.CheckAutoCrop->isChecked();
+
 	if (!mActionClass->shootSequence(startTime, colours, saveProcessed,
-		saveRaw, saveGroundTruth, processedExtension, mSaveDir))
+		saveRaw, saveGroundTruth, processedExtension, mSaveDir, region, autoCrop))
 		Error("Failed taking image sequence");
 
 	enableEvents();
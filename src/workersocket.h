@@ -0,0 +1,243 @@
+#pragma once
+/** Defines the connection between CameraControl and a GroundTruth worker started with --serve, so that
+ * capture sets can be handed to a process that stays running between them. The worker listens on a Unix
+ * domain socket, which Windows supports from Windows 10 onwards. Messages are lines of text:
+ * the client sends the arguments of a job as they would be given to GroundTruth (see SplitArguments),
+ * and the worker answers with "status <stage>" lines followed by "done <exit code> <seconds>". A job asking
+ * for a preview gets "status preview <path>" once the preview is saved.
+ * "quit" stops the worker.
+ * */
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cctype>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+typedef SOCKET SocketHandle;
+static const SocketHandle kNoSocket = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SocketHandle;
+static const SocketHandle kNoSocket = -1;
+#endif
+
+/**
+* Splits a line into arguments at whitespace. Arguments containing spaces are enclosed in double quotes.
+* @return false if a quote is not closed.
+* */
+static bool SplitArguments(const std::string& line, std::vector<std::string>& arguments)
+{
+	for (size_t i = 0; i < line.size();)
+	{
+		if (isspace((unsigned char)line[i]))
+		{
+			++i;
+			continue;
+		}
+
+		const bool quoted = line[i] == '"';
+		const size_t begin = quoted ? i + 1 : i;
+		size_t end = begin;
+		while (end < line.size() && (quoted ? line[end] != '"' : !isspace((unsigned char)line[end])))
+			++end;
+		if (quoted && end == line.size())
+			return false;
+
+		arguments.push_back(line.substr(begin, end - begin));
+		i = quoted ? end + 1 : end;
+	}
+	return true;
+}
+
+/** Joins arguments into a line that SplitArguments splits back into them. */
+static std::string JoinArguments(const std::vector<std::string>& arguments)
+{
+	std::string line;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (i)
+			line += ' ';
+		const bool quote = arguments[i].empty() || arguments[i].find_first_of(" \t") != std::string::npos;
+		line += quote ? '"' + arguments[i] + '"' : arguments[i];
+	}
+	return line;
+}
+
+/**
+* A connected or listening Unix domain socket exchanging lines of text.
+* */
+class WorkerSocket
+{
+	SocketHandle mSocket = kNoSocket;
+
+	//Received bytes not yet returned as a line.
+	std::string mBuffer;
+
+	/** Fills address with path, returning false if the path is too long for a socket. */
+	static bool makeAddress(const std::string& path, sockaddr_un& address)
+	{
+		address = sockaddr_un();
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+		path.copy(address.sun_path, path.size());
+		return true;
+	}
+
+	WorkerSocket(const WorkerSocket&) = delete;
+	WorkerSocket& operator = (const WorkerSocket&) = delete;
+
+public:
+
+	WorkerSocket() {}
+
+	WorkerSocket(WorkerSocket&& other) : mSocket(other.mSocket), mBuffer(std::move(other.mBuffer))
+	{
+		other.mSocket = kNoSocket;
+	}
+
+	WorkerSocket& operator = (WorkerSocket&& other)
+	{
+		close();
+		mSocket = other.mSocket;
+		mBuffer = std::move(other.mBuffer);
+		other.mSocket = kNoSocket;
+		return *this;
+	}
+
+	/** Closes the socket. */
+	~WorkerSocket()
+	{
+		close();
+	}
+
+	/** Initialises the socket library, which Windows requires once per process. Returns false upon failure. */
+	static bool startup()
+	{
+#ifdef _WIN32
+		static bool started = false;
+		WSADATA data;
+		if (!started)
+			started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		return started;
+#else
+		return true;
+#endif
+	}
+
+	/** Connects to a worker listening at path, returning false if there is none. */
+	bool connect(const std::string& path)
+	{
+		close();
+		sockaddr_un address;
+		if (!makeAddress(path, address))
+			return false;
+
+		mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (mSocket == kNoSocket)
+			return false;
+
+		if (::connect(mSocket, (const sockaddr*)&address, sizeof(address)) != 0)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	/** Listens for connections at path, replacing any socket file left there. Returns false upon failure. */
+	bool listen(const std::string& path)
+	{
+		close();
+		sockaddr_un address;
+		if (!makeAddress(path, address))
+			return false;
+
+		mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (mSocket == kNoSocket)
+			return false;
+
+		std::remove(path.c_str());
+		if (bind(mSocket, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(mSocket, 8) != 0)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	/** Waits for the next connection to a listening socket. The result is not valid upon failure. */
+	WorkerSocket accept()
+	{
+		WorkerSocket client;
+		client.mSocket = ::accept(mSocket, nullptr, nullptr);
+		return client;
+	}
+
+	/** Returns whether the socket is open. */
+	bool valid() const
+	{
+		return mSocket != kNoSocket;
+	}
+
+	/** Sends line followed by a line break, returning false if the connection is lost. */
+	bool writeLine(const std::string& line)
+	{
+		//A client that went away must not end the worker with SIGPIPE where that exists.
+#ifdef MSG_NOSIGNAL
+		const int flags = MSG_NOSIGNAL;
+#else
+		const int flags = 0;
+#endif
+		const std::string message = line + '\n';
+		for (size_t sent = 0; sent < message.size();)
+		{
+			const int result = (int)send(mSocket, message.data() + sent, (int)(message.size() - sent), flags);
+			if (result <= 0)
+				return false;
+			sent += result;
+		}
+		return true;
+	}
+
+	/** Waits for the next line, without its line break. Returns false once the connection is closed. */
+	bool readLine(std::string& line)
+	{
+		for (;;)
+		{
+			const size_t end = mBuffer.find('\n');
+			if (end != std::string::npos)
+			{
+				line = mBuffer.substr(0, end);
+				mBuffer.erase(0, end + 1);
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				return true;
+			}
+
+			char chunk[4096];
+			const int received = (int)recv(mSocket, chunk, sizeof(chunk), 0);
+			if (received <= 0)
+				return false;
+			mBuffer.append(chunk, received);
+		}
+	}
+
+	/** Closes the socket. */
+	void close()
+	{
+		if (mSocket == kNoSocket)
+			return;
+#ifdef _WIN32
+		closesocket(mSocket);
+#else
+		::close(mSocket);
+#endif
+		mSocket = kNoSocket;
+	}
+};